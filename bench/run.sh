@@ -0,0 +1,476 @@
+#!/bin/sh
+#
+# Reproducible startup benchmark for wrapper.c
+#
+# Builds the wrapper, stand-in versions of the bundled libs (created with linker version
+# scripts, so they look newer than the system's and are used) and a dummy app that just
+# returns in a temporary directory, then measures
+#  - the time per launch, cold (after dropping the page cache, only as root) and warm,
+#    with all libs checked (WRAPPER_NO_CACHE=1) and with the launch cache,
+#    and how much that adds to starting the app directly
+#  - how long probing each lib, all checks and writing the launch cache take (from WRAPPER_TRACE)
+#  - the number of syscalls the wrapper makes (with strace, if it's installed)
+# (case "basic"), how many paths the dynamic linker tries for the libs of an app that links a
+# few system libs and the stand-ins, with LD_LIBRARY_PATH vs. the LD_AUDIT module (case "audit"),
+# how long bursts of launches take directly vs. through the launcher daemon (case "daemon"),
+# launches with the normal build vs. a static NO_DLOPEN build (case "static"),
+# and if the right libstdc++/libgcc is used when both the system's and the bundled one are
+# newer than any version the wrapper knows (case "newer")
+# and compares the results with the upper bounds in bench/thresholds.txt.
+#
+# Usage: bench/run.sh [-n runs] [-j results.json] [-c results.csv] [-t thresholds] [-k] [case ...]
+#   -n  launches per timing (default 200)
+#   -j  write the results as JSON to that file
+#   -c  write the results as CSV to that file
+#   -t  thresholds file (default: thresholds.txt next to this script), "-" to not compare
+#   -k  keep the temporary directory
+# Cases (default: all): basic audit daemon static newer
+# Set CC and CFLAGS to build with a different compiler or different #defines
+# (e.g. CFLAGS=-DPARALLEL_PROBES).
+#
+# Exits with 1 if a measured value is above its threshold, 2 on errors.
+#
+# (C) 2017-2023 Daniel Gibson
+#
+# LICENSE
+#   This software is dual-licensed to the public domain and under the following
+#   license: you are granted a perpetual, irrevocable license to copy, modify,
+#   publish, and distribute this file as you see fit.
+#   No warranty implied; use at your own risk.
+
+set -e
+
+bench_dir=$(cd "$(dirname "$0")" && pwd)
+repo_dir=$(dirname "$bench_dir")
+
+runs=200
+json_out=""
+csv_out=""
+thresholds="$bench_dir/thresholds.txt"
+keep=0
+while getopts "n:j:c:t:k" opt; do
+	case $opt in
+		n) runs=$OPTARG ;;
+		j) json_out=$OPTARG ;;
+		c) csv_out=$OPTARG ;;
+		t) thresholds=$OPTARG ;;
+		k) keep=1 ;;
+		*) sed -n 's/^# \{0,1\}//;/^Usage/,/^Exits/p' "$0" >&2; exit 2 ;;
+	esac
+done
+shift $((OPTIND - 1))
+cases=${*:-basic audit daemon static newer}
+
+: "${CC:=gcc}"
+: "${CFLAGS:=}"
+
+work=$(mktemp -d "${TMPDIR:-/tmp}/wrapper-bench.XXXXXX")
+daemon_pid=""
+cleanup() {
+	[ -z "$daemon_pid" ] || kill "$daemon_pid" 2> /dev/null || true
+	[ $keep -ne 0 ] || rm -rf "$work"
+}
+trap cleanup EXIT
+[ $keep -eq 0 ] || echo "Keeping $work"
+results="$work/results.txt" # "<metric> <value> <unit>" per line
+: > "$results"
+
+# only the settings of this script should influence the wrapper
+for var in $(env | sed -n 's/^\(WRAPPER_[A-Za-z0-9_]*\)=.*/\1/p'); do
+	unset "$var"
+done
+unset LD_LIBRARY_PATH LD_PRELOAD LD_AUDIT
+export XDG_CACHE_HOME="$work/cache"
+have_strace=0
+command -v strace > /dev/null 2>&1 && have_strace=1
+
+die() {
+	echo "ERROR: $*" >&2
+	exit 2
+}
+
+# metric <name> <value> <unit> - records a result ("" as value if it couldn't be measured)
+metric() {
+	echo "$1 ${2:--} $3" >> "$results"
+	printf "  %-32s %12s %s\n" "$1" "${2:-(skipped)}" "$3"
+}
+
+# make_lib <out> <soname> <version script> <C code>
+make_lib() {
+	mkdir -p "$(dirname "$1")"
+	printf '%b' "$3" > "$work/v.map"
+	printf '%s\n' "$4" | $CC -shared -fPIC -O2 -x c - -x none -Wl,--version-script="$work/v.map" \
+		-Wl,-soname,"$2" -o "$1" || die "couldn't build the stand-in $2"
+}
+
+# sets up $work/app: a dummy app, stand-ins for the bundled libs and the wrapper, built with
+# the given extra flags (and CFLAGS) as YourGameWrapper
+setup_app() {
+	app="$work/app"
+	rm -rf "$app"
+	mkdir -p "$app/bin"
+	echo 'int main(void) { return 0; }' | $CC -O2 -x c - -o "$app/bin/YourGame" || die "couldn't build the dummy app"
+
+	# newer than any libstdc++/libgcc the wrapper knows, so they're always used
+	make_lib "$app/libs/stdcpp/libstdc++.so.6" libstdc++.so.6 \
+		'GLIBCXX_3.4 { global: f; local: *; };\nGLIBCXX_3.4.99 { global: g; } GLIBCXX_3.4;\n' \
+		'void f(void){} void g(void){}'
+	make_lib "$app/libs/gcc/libgcc_s.so.1" libgcc_s.so.1 \
+		'GCC_3.0 { global: __mulvsi3; local: *; };\nGCC_99.0.0 { global: __truncdfbf2; } GCC_3.0;\n' \
+		'void __mulvsi3(void){} void __truncdfbf2(void){}'
+	make_lib "$app/libs/sdl2/libSDL2-2.0.so.0" libSDL2-2.0.so.0 \
+		'SDL2_0.0 { global: SDL_GetVersion; local: *; };\n' \
+		'typedef struct { unsigned char major, minor, patch; } SDL_version;
+		 void SDL_GetVersion(SDL_version* v) { v->major = 2; v->minor = 99; v->patch = 0; }'
+
+	build_wrapper "$app/YourGameWrapper" "$@"
+}
+
+# build_wrapper <out> [flags...] - builds wrapper.c with CFLAGS and the given flags
+build_wrapper() {
+	out=$1
+	shift
+	# shellcheck disable=SC2086
+	$CC -std=gnu99 -O2 $CFLAGS "$@" -o "$out" "$repo_dir/wrapper.c" -ldl || die "couldn't build the wrapper"
+	rm -rf "$XDG_CACHE_HOME"
+}
+
+# replaces the dummy app with one that links the stand-ins of libstdc++ and SDL2 and a few
+# libs of glibc, so the dynamic linker has to look for some libs
+build_linking_app() {
+	echo 'void g(void); void SDL_GetVersion(void*); int main(void) { if(0) { g(); SDL_GetVersion(0); } return 0; }' \
+		| $CC -O2 -x c - -x none -o "$app/bin/YourGame" -Wl,--no-as-needed -Wl,--allow-shlib-undefined \
+			-L"$app/libs/stdcpp" -L"$app/libs/sdl2" -l:libstdc++.so.6 -l:libSDL2-2.0.so.0 \
+			-lm -lpthread -lrt -ldl -lresolv -lutil \
+		|| die "couldn't build the dummy app linking libs"
+}
+
+now_ns() {
+	date +%s%N
+}
+
+# time_runs <n> <command...> - prints the average time per run in ms
+time_runs() {
+	n=$1
+	shift
+	start=$(now_ns)
+	i=0
+	while [ $i -lt "$n" ]; do
+		"$@" > /dev/null 2>&1 || true
+		i=$((i + 1))
+	done
+	end=$(now_ns)
+	awk -v s="$start" -v e="$end" -v n="$n" 'BEGIN { printf "%.3f", (e - s) / n / 1e6 }'
+}
+
+# cold_run <command...> - prints the time of a run with an empty page cache in ms (average of
+# 3), or nothing if the page cache can't be dropped (needs root)
+cold_run() {
+	[ -w /proc/sys/vm/drop_caches ] || return 0
+	total=0
+	for i in 1 2 3; do
+		sync
+		echo 3 > /proc/sys/vm/drop_caches
+		total=$(awk -v t="$total" -v r="$(time_runs 1 "$@")" 'BEGIN { printf "%.3f", t + r }')
+	done
+	awk -v t="$total" 'BEGIN { printf "%.3f", t / 3 }'
+}
+
+# count_syscalls <command...> - prints the number of syscalls of the command (and its children),
+# or nothing without strace
+count_syscalls() {
+	[ $have_strace -eq 1 ] || return 0
+	strace -f -qq -o "$work/strace.txt" "$@" > /dev/null 2>&1 || true
+	# unfinished calls are continued in a "<... resumed>" line, signals and exits aren't calls
+	grep -c -v -E '^([0-9]+ +)?(<\.\.\. |\+\+\+ |--- )' "$work/strace.txt" || true
+}
+
+# burst <n> <command...> - starts the command n times at once (with the file the app appends
+# a line to when it ran as first argument) and prints how long it took until all apps ran in ms
+burst() {
+	n=$1
+	shift
+	: > "$work/done"
+	start=$(now_ns)
+	i=0
+	while [ $i -lt "$n" ]; do
+		"$@" "$work/done" > /dev/null 2>&1 &
+		i=$((i + 1))
+	done
+	wait
+	# with the daemon, the clients return as soon as the daemon started the instance
+	while [ "$(wc -l < "$work/done")" -lt "$n" ]; do
+		[ $(( ($(now_ns) - start) / 1000000000 )) -lt 30 ] || die "only $(wc -l < "$work/done") of $n instances ran"
+	done
+	end=$(now_ns)
+	awk -v s="$start" -v e="$end" 'BEGIN { printf "%.3f", (e - s) / 1e6 }'
+}
+
+# count_app_lib_tries <command...> - prints how many paths the dynamic linker tried for the
+# libs of the app (not of the wrapper), from LD_DEBUG=libs
+count_app_lib_tries() {
+	rm -f "$work/lddebug".*
+	LD_DEBUG=libs LD_DEBUG_OUTPUT="$work/lddebug" "$@" > /dev/null 2>&1 || true
+	# the app replaces the wrapper (same PID), so its lines are appended to the wrapper's file,
+	# after the wrapper's own libs were loaded ("transferring control: <wrapper>")
+	app_log=$(grep -l 'initialize program: .*bin/YourGame$' "$work/lddebug".* 2> /dev/null | head -n 1)
+	[ -n "$app_log" ] || return 0
+	awk '/transferring control: / { after_wrapper = 1 } after_wrapper && /trying file=/ { n++ }
+		END { print n + 0 }' "$app_log"
+}
+
+# count_app_opens <command...> - prints the number of open() calls of the app (after the
+# wrapper exec()ed it), or nothing without strace
+count_app_opens() {
+	[ $have_strace -eq 1 ] || return 0
+	strace -f -qq -e trace=execve,open,openat -o "$work/strace.txt" "$@" > /dev/null 2>&1 || true
+	awk -v app="$app/bin/YourGame" '
+		/execve\(/ && index($0, "\"" app "\"") > 0 && / = 0$/ { in_app = 1; next }
+		in_app && /(open|openat)\(/ && !/<\.\.\. / { n++ }
+		END { if(in_app) print n + 0 }' "$work/strace.txt"
+}
+
+diff_ms() {
+	[ -n "$1" ] && [ -n "$2" ] || return 0
+	awk -v a="$1" -v b="$2" 'BEGIN { printf "%.3f", a - b }'
+}
+
+diff_int() {
+	[ -n "$1" ] && [ -n "$2" ] || return 0
+	echo $(($1 - $2))
+}
+
+case_basic() {
+	echo "basic: the default build"
+	setup_app
+	wrapper="$app/YourGameWrapper"
+
+	# make sure the stand-ins are really used, otherwise the numbers are meaningless
+	WRAPPER_NO_CACHE=1 WRAPPER_TRACE="$work/trace.json" "$wrapper" > /dev/null 2>&1 || die "the wrapper failed"
+	grep -q '"lib":"libstdc++.so.6".*"use_bundled":1' "$work/trace.json" \
+		|| die "the wrapper didn't use the stand-in libstdc++, see $work/trace.json"
+
+	direct_ms=$(time_runs "$runs" "$app/bin/YourGame")
+	metric direct_ms "$direct_ms" ms
+
+	nocache_ms=$(time_runs "$runs" env WRAPPER_NO_CACHE=1 "$wrapper")
+	metric nocache_ms "$nocache_ms" ms
+	# env itself is an exec as well, so compare with starting the app through it
+	env_ms=$(time_runs "$runs" env "$app/bin/YourGame")
+	metric overhead_nocache_ms "$(diff_ms "$nocache_ms" "$env_ms")" ms
+
+	"$wrapper" > /dev/null 2>&1 # writes the launch cache
+	cached_ms=$(time_runs "$runs" "$wrapper")
+	metric cached_ms "$cached_ms" ms
+	metric overhead_cached_ms "$(diff_ms "$cached_ms" "$direct_ms")" ms
+
+	metric cold_nocache_ms "$(cold_run env WRAPPER_NO_CACHE=1 "$wrapper")" ms
+	metric cold_cached_ms "$(cold_run "$wrapper")" ms
+
+	# the average duration of each "probe" event (one per checked lib) and of the phases around them
+	trace_runs=$(( (runs < 50) ? runs : 50 ))
+	i=0
+	: > "$work/events.txt"
+	while [ $i -lt $trace_runs ]; do
+		WRAPPER_NO_CACHE=1 WRAPPER_TRACE="$work/trace.json" "$wrapper" > /dev/null 2>&1 || true
+		sed -n -e 's/^{"name":"probe".*"dur":\([0-9]*\),"args":{"lib":"\([^"]*\)".*/probe_us:\2 \1/p' \
+			-e 's/^{"name":"\(check_fallback_libs\|write_launch_cache\)".*"dur":\([0-9]*\).*/\1_us \2/p' \
+			"$work/trace.json" >> "$work/events.txt"
+		i=$((i + 1))
+	done
+	awk '{ sum[$1] += $2; cnt[$1]++ } END { for(ev in sum) printf "%s %.1f\n", ev, sum[ev] / cnt[ev] }' \
+		"$work/events.txt" | sort > "$work/event_avg.txt"
+	while read -r ev us; do
+		metric "$ev" "$us" us
+	done < "$work/event_avg.txt"
+
+	direct_calls=$(count_syscalls "$app/bin/YourGame")
+	metric syscalls_nocache "$(diff_int "$(count_syscalls env WRAPPER_NO_CACHE=1 "$wrapper")" "$direct_calls")" calls
+	metric syscalls_cached "$(diff_int "$(count_syscalls "$wrapper")" "$direct_calls")" calls
+}
+
+case_audit() {
+	echo "audit: LD_LIBRARY_PATH vs. the LD_AUDIT module (AUDIT_MODULE)"
+	setup_app
+	build_linking_app
+	$CC -std=gnu99 -shared -fPIC -O2 -o "$app/wrapper_audit.so" "$repo_dir/wrapper_audit.c" \
+		|| die "couldn't build the audit module"
+	mv "$app/YourGameWrapper" "$app/YourGameWrapper.ldpath"
+	build_wrapper "$app/YourGameWrapper.audit" -DAUDIT_MODULE='"wrapper_audit.so"'
+
+	for mode in ldpath audit; do
+		wrapper="$app/YourGameWrapper.$mode"
+		"$wrapper" > /dev/null 2>&1 || die "the app didn't start through $wrapper"
+		eval "tries_$mode=\$(count_app_lib_tries \"\$wrapper\")"
+		eval "opens_$mode=\$(count_app_opens \"\$wrapper\")"
+		eval "launch_$mode=\$(time_runs \"\$runs\" \"\$wrapper\")"
+	done
+	# shellcheck disable=SC2154
+	{
+		metric app_lib_tries_ld_library_path "$tries_ldpath" paths
+		metric app_lib_tries_audit "$tries_audit" paths
+		# should be negative: the module only redirects the overridden libs
+		metric audit_extra_lib_tries "$(diff_int "$tries_audit" "$tries_ldpath")" paths
+		metric app_opens_ld_library_path "$opens_ldpath" calls
+		metric app_opens_audit "$opens_audit" calls
+		metric audit_extra_opens "$(diff_int "$opens_audit" "$opens_ldpath")" calls
+		metric launch_ld_library_path_ms "$launch_ldpath" ms
+		metric launch_audit_ms "$launch_audit" ms
+	}
+}
+
+case_daemon() {
+	echo "daemon: bursts of launches directly vs. through the launcher daemon (LAUNCHER_DAEMON)"
+	setup_app -DLAUNCHER_DAEMON
+	wrapper="$app/YourGameWrapper"
+	printf '%s\n' '#include <fcntl.h>
+		#include <unistd.h>
+		int main(int argc, char** argv) {
+			int fd = (argc > 1) ? open(argv[1], O_WRONLY | O_APPEND) : -1;
+			return (fd >= 0 && write(fd, "x\n", 2) == 2) ? 0 : 1;
+		}' | $CC -O2 -x c - -o "$app/bin/YourGame" || die "couldn't build the dummy app for bursts"
+
+	: > "$work/done"
+	"$wrapper" "$work/done" > /dev/null 2>&1 || die "the app didn't start through $wrapper" # writes the launch cache
+	WRAPPER_DAEMON="$work/daemon.sock" "$wrapper" > /dev/null 2>&1 &
+	daemon_pid=$!
+	i=0
+	while [ ! -S "$work/daemon.sock" ]; do
+		[ $i -lt 500 ] || die "the launcher daemon didn't start"
+		sleep 0.01
+		i=$((i + 1))
+	done
+
+	burst_size=$(( (runs < 100) ? runs : 100 ))
+	bursts=5
+	direct_total=0
+	daemon_total=0
+	i=0
+	while [ $i -lt $bursts ]; do
+		direct_total=$(awk -v t="$direct_total" -v b="$(burst $burst_size "$wrapper")" 'BEGIN { printf "%.3f", t + b }')
+		daemon_total=$(awk -v t="$daemon_total" -v b="$(burst $burst_size env WRAPPER_CONNECT="$work/daemon.sock" "$wrapper")" \
+			'BEGIN { printf "%.3f", t + b }')
+		i=$((i + 1))
+	done
+	kill "$daemon_pid" 2> /dev/null || true
+	wait "$daemon_pid" 2> /dev/null || true
+	daemon_pid=""
+
+	direct_ms=$(awk -v t="$direct_total" -v n=$bursts 'BEGIN { printf "%.3f", t / n }')
+	daemon_ms=$(awk -v t="$daemon_total" -v n=$bursts 'BEGIN { printf "%.3f", t / n }')
+	metric "burst${burst_size}_direct_ms" "$direct_ms" ms
+	metric "burst${burst_size}_daemon_ms" "$daemon_ms" ms
+	# should be negative: that's what the daemon is for
+	metric daemon_extra_ms_per_launch "$(awk -v d="$direct_ms" -v c="$daemon_ms" -v n=$burst_size \
+		'BEGIN { printf "%.3f", (c - d) / n }')" ms
+}
+
+case_static() {
+	echo "static: the normal build vs. a static build with NO_DLOPEN"
+	setup_app
+	mv "$app/YourGameWrapper" "$app/YourGameWrapper.dynamic"
+	# shellcheck disable=SC2086
+	if ! $CC -std=gnu99 -O2 $CFLAGS -static-pie -DNO_DLOPEN -o "$app/YourGameWrapper.static" \
+		"$repo_dir/wrapper.c" > "$work/static.log" 2>&1; then
+		echo "  (skipped, couldn't build a static wrapper - is the static libc installed?)"
+		return 0
+	fi
+
+	for build in dynamic static; do
+		wrapper="$app/YourGameWrapper.$build"
+		rm -rf "$XDG_CACHE_HOME"
+		"$wrapper" > /dev/null 2>&1 || die "the app didn't start through $wrapper"
+		eval "cached_$build=\$(time_runs \"\$runs\" \"\$wrapper\")"
+		eval "nocache_$build=\$(time_runs \"\$runs\" env WRAPPER_NO_CACHE=1 \"\$wrapper\")"
+		eval "calls_$build=\$(count_syscalls \"\$wrapper\")"
+	done
+	# shellcheck disable=SC2154
+	{
+		metric dynamic_cached_ms "$cached_dynamic" ms
+		metric static_cached_ms "$cached_static" ms
+		# should be negative: no dynamic linking of the wrapper itself
+		metric static_extra_cached_ms "$(diff_ms "$cached_static" "$cached_dynamic")" ms
+		metric dynamic_nocache_ms "$nocache_dynamic" ms
+		metric static_nocache_ms "$nocache_static" ms
+		metric dynamic_syscalls_cached "$calls_dynamic" calls
+		metric static_syscalls_cached "$calls_static" calls
+		metric static_extra_syscalls "$(diff_int "$calls_static" "$calls_dynamic")" calls
+	}
+}
+
+# make_gcc_libs <dir> <GLIBCXX version> <GCC version> - stand-ins for libstdc++ and libgcc
+# that define the given versions
+make_gcc_libs() {
+	make_lib "$1/libstdc++.so.6" libstdc++.so.6 \
+		"GLIBCXX_3.4 { global: f; local: *; };\nGLIBCXX_$2 { global: g; } GLIBCXX_3.4;\n" \
+		'void f(void){} void g(void){}'
+	make_lib "$1/libgcc_s.so.1" libgcc_s.so.1 \
+		"GCC_3.0 { global: __mulvsi3; local: *; };\nGCC_$3 { global: __truncdfbf2; } GCC_3.0;\n" \
+		'void __mulvsi3(void){} void __truncdfbf2(void){}'
+}
+
+case_newer() {
+	echo "newer: system and bundled libstdc++/libgcc both newer than the wrapper's version tables"
+	setup_app
+	wrapper="$app/YourGameWrapper"
+	wrong=0
+	# "<system GLIBCXX> <system GCC> <bundled GLIBCXX> <bundled GCC> <use_bundled expected>"
+	for combo in "3.4.98 98.0.0 3.4.99 99.0.0 1" "3.4.99 99.0.0 3.4.98 98.0.0 0" \
+		"3.4.99 99.0.0 3.4.99 99.0.0 0" "3.4.99 99.0.0 3.4.100 99.1.0 1"; do
+		set -- $combo
+		rm -rf "$work/syslibs"
+		make_gcc_libs "$work/syslibs" "$1" "$2"
+		make_gcc_libs "$app/libs" "$3" "$4"
+		mv "$app/libs/libstdc++.so.6" "$app/libs/stdcpp/"
+		mv "$app/libs/libgcc_s.so.1" "$app/libs/gcc/"
+		LD_LIBRARY_PATH="$work/syslibs" WRAPPER_NO_CACHE=1 WRAPPER_TRACE="$work/trace.json" "$wrapper" \
+			> /dev/null 2>&1 || die "the wrapper failed"
+		for lib in libstdc++.so.6 libgcc_s.so.1; do
+			if ! grep '^{"name":"decision"' "$work/trace.json" | grep -q "\"lib\":\"$lib\".*\"use_bundled\":$5"; then
+				echo "  wrong decision for $lib (system $1/$2, bundled $3/$4), see $work/trace.json"
+				wrong=$((wrong + 1))
+			fi
+		done
+	done
+	metric newer_wrong_decisions "$wrong" decisions
+}
+
+echo "Benchmarking $repo_dir/wrapper.c ($runs launches per timing)"
+for c in $cases; do
+	case $c in
+		basic) case_basic ;;
+		audit) case_audit ;;
+		daemon) case_daemon ;;
+		static) case_static ;;
+		newer) case_newer ;;
+		*) die "unknown case $c" ;;
+	esac
+done
+
+if [ -n "$json_out" ]; then
+	awk -v date="$(date -u +%Y-%m-%dT%H:%M:%SZ)" -v runs="$runs" -v host="$(uname -srm)" '
+		BEGIN { printf "{\"date\":\"%s\",\"host\":\"%s\",\"runs\":%d,\"metrics\":{", date, host, runs }
+		{ printf "%s\n\"%s\":{\"value\":%s,\"unit\":\"%s\"}", (NR > 1) ? "," : "", $1, ($2 == "-") ? "null" : $2, $3 }
+		END { printf "}}\n" }' "$results" > "$json_out"
+	echo "Wrote $json_out"
+fi
+if [ -n "$csv_out" ]; then
+	{
+		echo "metric,value,unit"
+		awk '{ printf "%s,%s,%s\n", $1, ($2 == "-") ? "" : $2, $3 }' "$results"
+	} > "$csv_out"
+	echo "Wrote $csv_out"
+fi
+
+[ "$thresholds" != "-" ] || exit 0
+[ -r "$thresholds" ] || die "can't read $thresholds"
+# "<metric> <max>" per line; metrics that weren't measured (or aren't listed) aren't compared
+awk 'NR == FNR { if($0 !~ /^#/ && NF >= 2) max[$1] = $2; next }
+	($1 in max) && $2 != "-" {
+		if($2 + 0 > max[$1] + 0) { printf "FAIL %s: %s %s > %s\n", $1, $2, $3, max[$1]; failed = 1 }
+		else { checked++ }
+	}
+	END {
+		if(failed)  exit 1
+		printf "All %d compared metrics are within %s\n", checked, FILENAME_T
+	}' FILENAME_T="$thresholds" "$thresholds" "$results"
@@ -3,6 +3,7 @@
  * !! depend on new libgcc_s.so.1 features!                            !!
  *
  * => on debian 7 "wheezy" you could do: "gcc-4.7 -std=gnu99 -o YourGameWrapper wrapper.c -ldl"
+ *    (or see NO_DLOPEN below for a static build that works with any GCC)
  *
  * This is a simple wrapper for your Linux x86 or x86_64 application that
  * checks the versions of some system libs and compares it with the versions
@@ -25,6 +26,9 @@
  * LD_LIBRARY_PATH will be printed. This is helpful to debug problems,
  * especially when your users are having them.
  * e.g. $ WRAPPER_DEBUG=1 ./YourGameWrapper
+ * Setting WRAPPER_TRACE to a filename writes the timings of the wrapper's phases
+ * and its decisions to that file (Chrome trace event JSON, e.g. for ui.perfetto.dev)
+ * e.g. $ WRAPPER_TRACE=/tmp/wrapper_trace.json ./YourGameWrapper
  *
  * (C) 2017-2023 Daniel Gibson
  *
@@ -57,12 +61,200 @@
 #define CHECK_LIBSDL2
 #define CHECK_LIBCURL4
 
+// uncomment (and adjust) the following line to preload a bundled malloc replacement
+// (like mimalloc or jemalloc) from FALLBACK_DIR_ALLOC into your app. It's only used if
+// the system's libc (and libstdc++, or the bundled one if that's used) provide all
+// symbol versions it needs and a test process with it preloaded works.
+// The environment variable WRAPPER_ALLOCATOR=system disables it, WRAPPER_ALLOCATOR=bundled
+// skips the checks and always uses it.
+//#define PRELOAD_ALLOCATOR "libmimalloc.so.2"
+
 // change these defines to the directories you put your fallback libs in
 // (relative to the directory this wrapper is in)
 #define FALLBACK_DIR_STDCPP "libs/stdcpp"
 #define FALLBACK_DIR_GCC    "libs/gcc"
 #define FALLBACK_DIR_SDL2   "libs/sdl2"
 #define FALLBACK_DIR_CURL   "libs/curl" // only used if no libcurl.so.4 is found on system at all
+#define FALLBACK_DIR_ALLOC  "libs/alloc" // for PRELOAD_ALLOCATOR
+
+// the versions of the bundled libs can be written to this file (relative to the directory
+// this wrapper is in) when packaging your app, by running the wrapper with the environment
+// variable WRAPPER_WRITE_MANIFEST=1 (it then exits without running your app).
+// If the file exists, only the system's libs are checked at runtime; bundled libs whose size
+// or modification time doesn't match the manifest are checked as usual.
+// Comment out the following line to disable this.
+#define BUNDLED_LIBS_MANIFEST "bundled_libs.manifest"
+
+// uncomment the following line to run the checks for the different libs in parallel,
+// each in its own child process. A check that takes longer than PROBE_TIMEOUT_MS
+// milliseconds (can be overridden with the environment variable WRAPPER_PROBE_TIMEOUT_MS)
+// is killed and the system's version of that lib is used.
+// (The timeout is also used for testing PRELOAD_ALLOCATOR and for VERIFY_LOAD_GRAPH)
+//#define PARALLEL_PROBES
+#define PROBE_TIMEOUT_MS 3000
+
+// comment out the following line if the wrapper shouldn't put its decisions (and the
+// original LD_LIBRARY_PATH) into the environment variables WRAPPER_STATE and
+// WRAPPER_ORIG_LD_LIBRARY_PATH. They make restarts of your app through the wrapper
+// (e.g. after changing settings) faster, because the wrapper then only needs to
+// stat() a few files to know that its decisions are still valid.
+#define PASS_DECISIONS_TO_RELAUNCHES
+
+// uncomment the following line to launch your app through the system's dynamic linker
+// (from its PT_INTERP, e.g. /lib64/ld-linux-x86-64.so.2) with --library-path instead of
+// setting LD_LIBRARY_PATH, so the overrides only apply to your app and not to other
+// processes started by it (browsers, crash reporters, xdg-open, ...).
+// NOTE: /proc/self/exe of your app will then point to the dynamic linker, so don't enable
+//       this if your app uses it to find its files!
+// If the dynamic linker is too old to support --argv0 (glibc < 2.33), LD_LIBRARY_PATH is used.
+// Setting the environment variable WRAPPER_LAUNCH_VIA_LDSO=0 disables it at runtime.
+//#define LAUNCH_VIA_LDSO
+
+// uncomment the following line to redirect only the overridden libs (by their soname)
+// to the bundled files with a tiny LD_AUDIT module instead of prepending their directories
+// to LD_LIBRARY_PATH, which makes the dynamic linker search those for *every* lib your app
+// loads. Build the module from wrapper_audit.c and put it next to the wrapper.
+// NOTE: only the lib itself is redirected, so if it depends on other libs in its directory,
+//       give it a RUNPATH of $ORIGIN (e.g. patchelf --set-rpath '$ORIGIN' libfoo.so.1)
+// If the module is missing or can't be used, LD_LIBRARY_PATH is used.
+//#define AUDIT_MODULE "wrapper_audit.so"
+
+// uncomment the following line to have a helper process read your app's executable
+// and all the libs it will load into the page cache (with posix_fadvise(WILLNEED))
+// while the dynamic linker is starting it, which speeds up cold starts from slow disks.
+// Setting the environment variable WRAPPER_PREFETCH=0 disables it at runtime.
+//#define PREFETCH_LIBS
+
+// uncomment the following line to only use a bundled lib if the system's version of it
+// lacks a symbol version (like GLIBCXX_3.4.30) that your app, the (non-system) libs it
+// loads from its RPATH/RUNPATH or another used bundled lib needs, instead of whenever
+// the bundled lib is newer. This keeps the system libs (that e.g. Mesa also uses) if
+// they're good enough and works for versions newer than the tables in this file know.
+// Libs without versioned symbols (like SDL2) are still checked by their version.
+//#define OVERRIDE_ONLY_IF_REQUIRED
+
+// uncomment the following line to verify the decisions before starting your app: a child
+// process resolves all libs your app and the listed (GL/Vulkan driver) libs would load, with
+// the bundled libs that will be used, and checks that each symbol version one of them needs
+// (like GLIBCXX_3.4.30 for Mesa's LLVM) is provided by the one copy of that lib that gets loaded.
+// If not, it changes which version of the affected lib (bundled or system) is used, if that helps.
+// The libs can be sonames or absolute paths with wildcards (for the dlopen()ed drivers), like
+// "libGL.so.1:libvulkan.so.1:/usr/lib/x86_64-linux-gnu/dri/*_dri.so"
+// The result is stored in the launch cache, which then also checks all those libs for changes.
+// Setting the environment variable WRAPPER_VERIFY=0 disables it at runtime.
+//#define VERIFY_LOAD_GRAPH "libGL.so.1:libEGL.so.1:libvulkan.so.1"
+
+// uncomment the following line to launch a build of your app that's optimized for the
+// CPU's x86-64 microarchitecture level, if you ship one: for x86-64-v3 (AVX2, FMA, ...)
+// the wrapper uses APP_EXECUTABLE ".x86-64-v3" (e.g. "bin/YourGame.x86-64-v3") if it exists,
+// falling back to v2 and then the baseline APP_EXECUTABLE. Likewise bundled libs are taken
+// from a "glibc-hwcaps/x86-64-v3/" subdirectory of their directory, if they're there.
+// Setting the environment variable WRAPPER_FORCE_ISA to a level (like "x86-64-v2",
+// or "baseline") overrides the detected level, for testing.
+//#define SELECT_ISA_VARIANTS
+
+// uncomment the following line to start your app as a child process of the wrapper instead
+// of replacing the wrapper with it. The wrapper then forwards signals to it, exits with its
+// exit status, and appends how it ran (exit status, wall and CPU time, max RSS, page faults,
+// context switches) together with the wrapper's decisions as a line of JSON to
+// $XDG_CACHE_HOME/linux-app-wrapper/<hash>-runs.jsonl (or ~/.cache/...), or to the file
+// in the environment variable WRAPPER_SUPERVISOR_LOG (relative to the directory the
+// wrapper was started in).
+// Setting the environment variable WRAPPER_SUPERVISE=0 disables it at runtime.
+//#define SUPERVISE_APP
+
+// uncomment the following line to set GLIBC_TUNABLES for glibc's malloc based on the
+// number of CPUs, the (cgroup) memory limit and whether transparent hugepages are enabled
+// (like fewer malloc arenas in small containers, glibc.malloc.hugetlb if THP is "madvise").
+// Tunables that are already set in GLIBC_TUNABLES are kept, and it's not done if a bundled
+// allocator (PRELOAD_ALLOCATOR) is used. WRAPPER_DEBUG=1 shows what was chosen and why.
+//#define SET_MALLOC_TUNABLES
+
+// uncomment the following line to set these (":"-separated) environment variables to the
+// number of CPUs your app can actually use, unless they're already set. In containers,
+// sysconf(_SC_NPROCESSORS_ONLN) and std::thread::hardware_concurrency() return the host's
+// number of CPUs, so OpenMP, job systems etc start far too many threads that are then
+// throttled by the container's CPU quota. The budget is the number of CPUs in the affinity
+// mask and the cgroup cpusets, limited by the cgroup CPU bandwidth (cpu.max in cgroup v2,
+// cpu.cfs_quota_us / cpu.cfs_period_us in v1), rounded up. Replace YOURGAME_NUM_THREADS
+// with the variable your app reads (if any). WRAPPER_DEBUG=1 shows the budget.
+// (It's also used for SET_MALLOC_TUNABLES)
+//#define SET_CPU_BUDGET_VARS "OMP_NUM_THREADS:YOURGAME_NUM_THREADS"
+
+// uncomment the following line to apply a CPU/scheduling/resource policy to your app,
+// read from this file next to the wrapper (if it exists), with lines like "key = value".
+// Each key can also be set with an environment variable WRAPPER_<KEY> (like WRAPPER_NICE=5)
+// which overrides the file. Supported keys:
+//   cpus = 0-3,8            CPU affinity (like taskset)
+//   core_per_instance = 3   pin to all hardware threads of the 4th physical core
+//                           (counting from 0, wraps around), e.g. for dedicated servers;
+//                           overrides cpus, unless only cpus is set with WRAPPER_CPUS
+//   numa_nodes = 0          bind memory allocations to these NUMA nodes
+//   numa_policy = bind      or "preferred" or "interleave"
+//   sched = batch           scheduling class: other, batch, idle, fifo:PRIO or rr:PRIO (like chrt)
+//   nice = 5                (like nice)
+//   ioprio = be:4           I/O priority: rt:LEVEL, be:LEVEL or idle (like ionice)
+//   rlimit_nofile = max     resource limits (like ulimit): a number, "unlimited" or "max" (the hard limit)
+//                           for rlimit_nofile, rlimit_memlock, rlimit_core, rlimit_stack,
+//                           rlimit_nproc, rlimit_as, rlimit_rtprio, rlimit_nice
+// The policy is applied right before your app is started, so it inherits it.
+// If something can't be applied (e.g. missing permissions), an error is printed and
+// your app is started anyway.
+//#define LAUNCH_POLICY_FILE "wrapper_policy.conf"
+
+// uncomment the following line to support a launcher daemon for starting many instances
+// of your app (e.g. dedicated servers) quickly: `WRAPPER_DAEMON=/path/to/socket ./YourGameWrapper`
+// does all the checks once and then listens on that UNIX socket, and
+// `WRAPPER_CONNECT=/path/to/socket ./YourGameWrapper args...` makes it start a new instance
+// with the client's arguments, working directory, environment and stdin/stdout/stderr
+// (but the LD_LIBRARY_PATH etc the daemon set up). If the client's environment has
+// WRAPPER_CPUS or WRAPPER_CORE_PER_INSTANCE (see LAUNCH_POLICY_FILE), the instance is
+// pinned to those CPUs; if the daemon was started with WRAPPER_DAEMON_PIN_CORES=1, each
+// other instance gets the next physical core. Only the daemon's user can connect.
+//#define LAUNCHER_DAEMON
+
+// uncomment the following line to support shipping the bundled libs compressed (as LZ4):
+// run `WRAPPER_COMPRESS_LIBS=1 ./YourGameWrapper` when packaging your app to write a
+// compressed copy (with its version in a small header) next to each bundled lib, then
+// remove the uncompressed ones. The wrapper gets the bundled versions from the headers
+// and only extracts the libs it will use, once, to $XDG_CACHE_HOME/linux-app-wrapper/libs/
+// (or $XDG_RUNTIME_DIR/linux-app-wrapper/libs/ if that's not writable).
+// NOTE: with OVERRIDE_ONLY_IF_REQUIRED or PRELOAD_ALLOCATOR, the libs need to be extracted
+//       to be checked, so there this only saves disk space and download size.
+//#define COMPRESSED_LIBS
+
+// uncomment the following line to preload a small shim (build it from wrapper_hugetext.c
+// and put it next to the wrapper) that copies the code of your app's executable to huge
+// pages (from hugetlbfs if some are reserved, otherwise transparent hugepages) when it
+// starts, which reduces iTLB misses for big executables. It does nothing if neither is
+// available, and it removes itself from LD_PRELOAD so processes started by your app don't
+// get it. Setting the environment variable WRAPPER_HUGETEXT=0 disables it at runtime,
+// WRAPPER_HUGETEXT=2 remaps the used bundled libs as well; WRAPPER_DEBUG=1 shows how much
+// was remapped.
+//#define HUGETEXT_SHIM "wrapper_hugetext.so"
+
+// uncomment the following line to be able to profile how long the dynamic linker takes to load
+// each lib of your app: if the environment variable WRAPPER_LDPROFILE is set (to 1 for stderr,
+// or to the path of a file the report is appended to), the wrapper adds this LD_AUDIT module
+// (built from wrapper_ldprofile.c, next to the wrapper) which prints, right before your app's
+// constructors run, how long each lib took to find and map, how many paths were tried for it,
+// how many symbols were bound from and to it, and whether it's bundled or from the system.
+//#define LDPROFILE_MODULE "wrapper_ldprofile.so"
+
+// comment out the following line to disable the launch cache: the results of the
+// checks are stored in $XDG_CACHE_HOME/linux-app-wrapper/ (or ~/.cache/linux-app-wrapper/)
+// and reused until the wrapper, the checked libs, /etc/ld.so.cache or LD_LIBRARY_PATH change.
+// Setting the environment variable WRAPPER_NO_CACHE=1 also makes the wrapper ignore the cache.
+#define USE_LAUNCH_CACHE
+
+// uncomment the following line to never dlopen() any libs (the versions are then only read
+// from the files), so the wrapper doesn't need libdl and can be linked statically, like
+// "gcc -std=gnu99 -O2 -static-pie -o YourGameWrapper wrapper.c"
+// which makes it start faster (no dynamic linker and libc to load before main()) and lets you
+// build it with any GCC and glibc, because it doesn't depend on the system's libs at all.
+// NOTE: libs without symbol versions and SDL2 versions that can't be read from the file name
+//       or the code of SDL_GetVersion() are then treated as not found.
+//#define NO_DLOPEN
 
 
 //
@@ -72,555 +264,6322 @@
 //
 
 #define _GNU_SOURCE
+#ifndef NO_DLOPEN
 #include <dlfcn.h>
+#endif
 #include <errno.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <limits.h>
+#include <stdint.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <link.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sched.h>
+#include <ctype.h>
+#include <glob.h>
+
+#if defined(SELECT_ISA_VARIANTS) && defined(__x86_64__)
+#include <cpuid.h>
+#endif
 
 enum { HAVE_64_BIT = (sizeof(void*) == 8) };
 
+// whether the 64bit libs might be in /lib64 and /usr/lib64 (e.g. Fedora, openSUSE)
+#if defined(__x86_64__) && !defined(__ILP32__) || defined(__aarch64__) || defined(__powerpc64__)
+	#define HAVE_64_BIT_LIBDIRS 1
+#else
+	#define HAVE_64_BIT_LIBDIRS 0
+#endif
+
 static int debugOutput = 0;
 #define dprintf(...) do { if(debugOutput){ printf(__VA_ARGS__); } } while(0)
 
 #define eprintf(...) fprintf(stderr, __VA_ARGS__)
 
-#if defined(CHECK_LIBSTDCPP) || defined(CHECK_LIBGCC)
-struct gcc_version_check
+// When the environment variable WRAPPER_TRACE is set to a filename, the duration of the
+// different phases of the wrapper and the decisions it made are recorded in memory and
+// written to that file right before the app is executed, in the Chrome trace event format
+// (JSON), which can be loaded in https://ui.perfetto.dev or chrome://tracing
+static const char* trace_file = NULL;
+
+struct trace_event
 {
-	const char* gcc_ver_name;
-	const char* fn_version;
-	const char* fn_name;
+	const char* name;
+	char ph; // 'X' for complete events (with duration), 'i' for instant events
+	int pid, tid;
+	int64_t ts, dur; // in microseconds
+	char args[512]; // JSON object members (without braces), see trace_arg_*()
 };
 
-static int get_gcc_version(const char* libpath, const struct gcc_version_check checks[], const int num_checks)
+#define MAX_TRACE_EVENTS 64
+static struct trace_event trace_events[MAX_TRACE_EVENTS];
+static int num_trace_events = 0;
+
+static int64_t trace_now(void)
 {
-	void* handle = dlopen(libpath, RTLD_LAZY);
-	int i, ret = -1;
-	if(handle == NULL)
-	{
-		eprintf("couldn't dlopen() %s : %s\n", libpath, dlerror());
-		return ret;
-	}
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
 
-	for(i=0; i < num_checks; ++i)
+// adds an event, returns NULL if tracing is disabled (or too many events were recorded)
+// for 'X' events, start is the value trace_now() returned at the start of the phase,
+// for 'i' events it's ignored
+static struct trace_event* trace_add(const char* name, char ph, int64_t start)
+{
+	if(trace_file == NULL || num_trace_events >= MAX_TRACE_EVENTS)  return NULL;
+
+	struct trace_event* ev = &trace_events[num_trace_events++];
+	int64_t now = trace_now();
+	ev->name = name;
+	ev->ph = ph;
+	ev->pid = ev->tid = getpid();
+	ev->ts = (ph == 'X') ? start : now;
+	ev->dur = (ph == 'X') ? now - start : 0;
+	ev->args[0] = '\0';
+	return ev;
+}
+
+// appends val as a quoted and escaped JSON string to buf (which contains len chars)
+// returns the new length, or size if it didn't fit
+static size_t json_append_str(char* buf, size_t size, size_t len, const char* val)
+{
+	if(len + 3 > size)  return size; // both quotes and the terminating zero
+	buf[len++] = '"';
+	for(const char* c = val; *c != '\0'; ++c)
 	{
-		const char* fn_name = checks[i].fn_name;
-		if(fn_name != NULL)
+		if(len + 8 >= size)  return size;
+
+		if(*c == '"' || *c == '\\')
 		{
-			void* fn = dlvsym(handle, fn_name, checks[i].fn_version);
-			if(fn == NULL)
-			{
-				dlerror(); // clear it
-				break;
-			}
-			ret = i;
+			buf[len++] = '\\';
+			buf[len++] = *c;
+		}
+		else if((unsigned char)*c < 0x20)
+		{
+			len += snprintf(buf + len, size - len, "\\u%04x", (unsigned)*c);
+		}
+		else
+		{
+			buf[len++] = *c;
 		}
 	}
+	buf[len++] = '"';
+	buf[len] = '\0';
+	return len;
+}
 
-	dlclose(handle);
+static void trace_arg_str(struct trace_event* ev, const char* key, const char* val)
+{
+	if(ev == NULL)  return;
 
-	// if ret == num_checks-1, the real version could potentially be even newer
-	return ret;
+	size_t len = strlen(ev->args);
+	len += snprintf(ev->args + len, sizeof(ev->args) - len, "%s\"%s\":", (len > 0) ? "," : "", key);
+	if(len >= sizeof(ev->args) || json_append_str(ev->args, sizeof(ev->args), len, val) >= sizeof(ev->args))
+	{
+		ev->args[0] = '\0'; // too long, better no args than broken JSON
+	}
 }
 
-static const char* get_gcc_version_name(const struct gcc_version_check checks[], int idx)
+static void trace_arg_int(struct trace_event* ev, const char* key, long long val)
 {
-	if(idx < 0) return "Not found";
-	return checks[idx].gcc_ver_name;
+	if(ev == NULL)  return;
+
+	size_t len = strlen(ev->args);
+	int n = snprintf(ev->args + len, sizeof(ev->args) - len, "%s\"%s\":%lld", (len > 0) ? "," : "", key, val);
+	if(n < 0 || (size_t)n >= sizeof(ev->args) - len)  ev->args[len] = '\0';
 }
-#endif // defined(CHECK_LIBSTDCPP) || defined(CHECK_LIBGCC)
 
-#ifdef CHECK_LIBSTDCPP
-enum stdcpp_gcc_version {
-	STDCPP_GCC_OLDER = -1,
-	// see https://gcc.gnu.org/onlinedocs/libstdc++/manual/abi.html#abi.versioning
-	// Note that this does not list all released GCC versions, but only
-	// the ones that bumped the libstdc++ ABI version (GLIBCXX_3.4.x)
-	// BTW, the value of MY_GCC_* corresponds with x in GLIBCXX_3.4.x
-	STDCPP_GCC_3_4_0 = 0, // GLIBCXX_3.4, CXXABI_1.3
-	STDCPP_GCC_3_4_1, // GLIBCXX_3.4.1, CXXABI_1.3
-	STDCPP_GCC_3_4_2, // GLIBCXX_3.4.2
-	STDCPP_GCC_3_4_3, // GLIBCXX_3.4.3 - unfortunately there's no function with that version in libstdc++
-	STDCPP_GCC_4_0_0, // GLIBCXX_3.4.4, CXXABI_1.3.1
-	STDCPP_GCC_4_0_1, // GLIBCXX_3.4.5
-	STDCPP_GCC_4_0_2, // GLIBCXX_3.4.6
-	STDCPP_GCC_4_0_3, // GLIBCXX_3.4.7
-	STDCPP_GCC_4_1_1, // GLIBCXX_3.4.8 - no function for x86?!
-	STDCPP_GCC_4_2_0, // GLIBCXX_3.4.9,
-	STDCPP_GCC_4_3_0, // GLIBCXX_3.4.10, CXXABI_1.3.2
-	STDCPP_GCC_4_4_0, // GLIBCXX_3.4.11, CXXABI_1.3.3
-	STDCPP_GCC_4_4_1, // GLIBCXX_3.4.12, CXXABI_1.3.3 - no function with that version
-	STDCPP_GCC_4_4_2, // GLIBCXX_3.4.13, CXXABI_1.3.3
-	STDCPP_GCC_4_5_0, // GLIBCXX_3.4.14, CXXABI_1.3.4
-	STDCPP_GCC_4_6_0, // GLIBCXX_3.4.15, CXXABI_1.3.5
-	STDCPP_GCC_4_6_1, // GLIBCXX_3.4.16, CXXABI_1.3.5
-	STDCPP_GCC_4_7_0, // GLIBCXX_3.4.17, CXXABI_1.3.6
-	STDCPP_GCC_4_8_0, // GLIBCXX_3.4.18, CXXABI_1.3.7
-	STDCPP_GCC_4_8_3, // GLIBCXX_3.4.19, CXXABI_1.3.7
-	STDCPP_GCC_4_9_0, // GLIBCXX_3.4.20, CXXABI_1.3.8
-	STDCPP_GCC_5_1_0, // GLIBCXX_3.4.21, CXXABI_1.3.9
-	STDCPP_GCC_6_1_0, // GLIBCXX_3.4.22, CXXABI_1.3.10
-	STDCPP_GCC_7_1_0, // GLIBCXX_3.4.23, CXXABI_1.3.11
-	STDCPP_GCC_7_2_0, // GLIBCXX_3.4.24, CXXABI_1.3.11 - no function for x86_64
-	STDCPP_GCC_8_1_0, // GLIBCXX_3.4.25, CXXABI_1.3.11
-	STDCPP_GCC_9_1_0, // GLIBCXX_3.4.26, CXXABI_1.3.12
-	STDCPP_GCC_9_2_0, // GLIBCXX_3.4.27, CXXABI_1.3.12
-	STDCPP_GCC_9_3_0, // GLIBCXX_3.4.28, CXXABI_1.3.12
-	//STDCPP_GCC_10_1_0,// GLIBCXX_3.4.28, CXXABI_1.3.12 - same as 9.3.0 ?!
-	STDCPP_GCC_11_1_0, // GLIBCXX_3.4.29, CXXABI_1.3.13
-	STDCPP_GCC_12_1_0, // GLIBCXX_3.4.30, CXXABI_1.3.13
-	STDCPP_GCC_13_1_0, // GLIBCXX_3.4.31, CXXABI_1.3.14
-	STDCPP_GCC_13_2_0, // GLIBCXX_3.4.32, CXXABI_1.3.14
-	// TODO: add newer versions, once available (also in libstdcpp_version_checks below)
-	_NUM_STDCPP_GCC_VERSIONS
-};
+// writes all recorded events to trace_file
+static void trace_write(void)
+{
+	if(trace_file == NULL)  return;
 
+	FILE* f = fopen(trace_file, "w");
+	if(f == NULL)
+	{
+		int e = errno;
+		eprintf("Couldn't open trace file %s : errno %d (%s)\n", trace_file, e, strerror(e));
+		return;
+	}
+	fprintf(f, "{\"traceEvents\":[\n");
+	for(int i=0; i < num_trace_events; ++i)
+	{
+		const struct trace_event* ev = &trace_events[i];
+		fprintf(f, "{\"name\":\"%s\",\"cat\":\"wrapper\",\"ph\":\"%c\",\"pid\":%d,\"tid\":%d,\"ts\":%lld",
+		        ev->name, ev->ph, ev->pid, ev->tid, (long long)ev->ts);
+		if(ev->ph == 'X')  fprintf(f, ",\"dur\":%lld", (long long)ev->dur);
+		else  fprintf(f, ",\"s\":\"p\"");
+		fprintf(f, ",\"args\":{%s}}%s\n", ev->args, (i+1 < num_trace_events) ? "," : "");
+	}
+	fprintf(f, "],\"displayTimeUnit\":\"ms\"}\n");
+	if(fclose(f) != 0)
+	{
+		eprintf("Couldn't write trace file %s\n", trace_file);
+	}
+}
 
-// I found the entries for this table with: objdump -T /path/to/libstdc++.so.6 | grep " DF .text" | less
-// (and then searched for GLIBCXX_3.4.5 or whatever)
-// Note that readelf does truncate the function names in output and thus is not suitable for this!
-static const struct gcc_version_check
-libstdcpp_version_checks[_NUM_STDCPP_GCC_VERSIONS] =
+// sets trace_file to the value of WRAPPER_TRACE, made absolute if it's relative, because
+// the wrapper may change the working directory before the trace is written
+static void trace_init(void)
 {
-	{ "3.4.0", "GLIBCXX_3.4",   "_ZNSt5ctypeIwED2Ev" },
-	{ "3.4.1", "GLIBCXX_3.4.1", "_ZNSt12__basic_fileIcE4fileEv" },
-	{ "3.4.2", "GLIBCXX_3.4.2", "_ZN9__gnu_cxx17__pool_alloc_base12_M_get_mutexEv" },
-	{ "3.4.3", "GLIBCXX_3.4.3", NULL }, // FIXME: couldn't find a function with that version in libstdc++.so.6
-	{ "4.0.0", "GLIBCXX_3.4.4", "_ZN9__gnu_cxx6__poolILb0EE10_M_destroyEv" },
-	{ "4.0.1", "GLIBCXX_3.4.5", "_ZNKSs11_M_disjunctEPKc" },
-	{ "4.0.2", "GLIBCXX_3.4.6", "_ZNSt6locale5facet13_S_get_c_nameEv" },
-	// the following has a different signature for 32bit vs 64bit
-	{ "4.0.3", "GLIBCXX_3.4.7", HAVE_64_BIT ? "_ZNSt6locale5_Impl16_M_install_cacheEPKNS_5facetEm"
-	                                        : "_ZNSt6locale5_Impl16_M_install_cacheEPKNS_5facetEj" },
-	{ "4.1.1", "GLIBCXX_3.4.8", HAVE_64_BIT ? "_ZSt17__copy_streambufsIcSt11char_traitsIcEElPSt15basic_streambufIT_T0_ES6_"
-	                                        : NULL }, // FIXME: couldn't find a function for i686 ?!
-	{ "4.2.0", "GLIBCXX_3.4.9",  "_ZNSo9_M_insertIdEERSoT_" },
-	{ "4.3.0", "GLIBCXX_3.4.10", "_ZNKSt4hashISbIwSt11char_traitsIwESaIwEEEclES3_" },
-	{ "4.4.0", "GLIBCXX_3.4.11", "_ZSt16generic_categoryv" },
-	{ "4.4.1", "GLIBCXX_3.4.12", NULL }, // FIXME: couldn't find a function with that version in libstdc++.so.6
-	{ "4.4.2", "GLIBCXX_3.4.13", "_ZNSt14basic_ofstreamIcSt11char_traitsIcEEC2ERKSsSt13_Ios_Openmode" },
-	{ "4.5.0", "GLIBCXX_3.4.14", "_ZNSs13shrink_to_fitEv" },
-	{ "4.6.0", "GLIBCXX_3.4.15", "_ZNSt17bad_function_callD2Ev" },
-	{ "4.6.1", "GLIBCXX_3.4.16", HAVE_64_BIT ? "_ZNSs10_S_compareEmm" : "_ZNSs10_S_compareEjj" },
-	{ "4.7.0", "GLIBCXX_3.4.17", "_ZNSt6thread20hardware_concurrencyEv" },
-	{ "4.8.0", "GLIBCXX_3.4.18", "_ZNSt13random_device9_M_getvalEv" },
-	{ "4.8.3", "GLIBCXX_3.4.19", "_ZNSt6chrono3_V212steady_clock3nowEv" },
-	{ "4.9.0", "GLIBCXX_3.4.20", "_ZSt14get_unexpectedv" },
-	{ "5.1.0", "GLIBCXX_3.4.21", "_ZNSt13runtime_errorC1EPKc" },
-	{ "6.1.0", "GLIBCXX_3.4.22", "_ZNSt6thread6_StateD1Ev" },
-	{ "7.1.0", "GLIBCXX_3.4.23", HAVE_64_BIT ? "_ZNSsC1ERKSsmRKSaIcE" : "_ZNSsC1ERKSsjRKSaIcE" },
-	{ "7.2.0", "GLIBCXX_3.4.24", HAVE_64_BIT ? NULL // couldn't find a 64bit function with this version
-	                                         : "_ZNSbIwSt11char_traitsIwESaIwEEC2ERKS2_jRKS1_" },
-	{ "8.1.0", "GLIBCXX_3.4.25", "_ZNKSt13random_device13_M_getentropyEv" },
-	{ "9.1.0", "GLIBCXX_3.4.26", "_ZNSs4dataEv" },
-	{ "9.2.0", "GLIBCXX_3.4.27", "_ZNSt10filesystem28recursive_directory_iteratoraSERKS0_" },
-	{ "9.3.0", "GLIBCXX_3.4.28", "_ZNSt3pmr15memory_resourceD0Ev" },
-	// { "10.1.0" "GLIBCXX_3.4.28", "" }, - has same symbol version as 9.3.0
-	{ "11.1.0", "GLIBCXX_3.4.29", "_ZNSs7reserveEv" },
-	{ "12.1.0", "GLIBCXX_3.4.30", "_ZSt21__glibcxx_assert_failPKciS0_S0_" },
-	{ "13.1.0", "GLIBCXX_3.4.31", "_ZSt8to_charsPcS_DF128_" },
-	{ "13.2.0", "GLIBCXX_3.4.32", "_ZSt21ios_base_library_initv" },
-	// TODO: add new versions once available
-};
+	static char abs_path[PATH_MAX];
+	const char* var = getenv("WRAPPER_TRACE");
+	if(var == NULL || var[0] == '\0')  return;
+
+	trace_file = var;
+	if(var[0] != '/' && getcwd(abs_path, sizeof(abs_path)) != NULL)
+	{
+		size_t len = strlen(abs_path);
+		if(len + 1 + strlen(var) < sizeof(abs_path))
+		{
+			snprintf(abs_path + len, sizeof(abs_path) - len, "/%s", var);
+			trace_file = abs_path;
+		}
+	}
+}
 
-static enum stdcpp_gcc_version get_libstdcpp_version(const char* path)
+// 64bit FNV-1a hash, start with hash = FNV1A_64_INIT
+static uint64_t fnv1a_64(uint64_t hash, const void* data, size_t len)
 {
-	return get_gcc_version(path, libstdcpp_version_checks, _NUM_STDCPP_GCC_VERSIONS);
+	const unsigned char* bytes = data;
+	for(size_t i=0; i < len; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
 }
-#endif // CHECK_LIBSTDCPP
 
-#ifdef CHECK_LIBGCC
-enum libgcc_version {
-	LIBGCC_OLDER = -1,
-	LIBGCC_3_0_0 = 0, // GCC_3.0
-	LIBGCC_3_3_0, // GCC_3.3
-	LIBGCC_3_3_1, // GCC_3.3.1
-	LIBGCC_3_3_2, // GCC_3.3.2 - no function with that version
-	LIBGCC_3_3_4, // GCC_3.3.4 - ditto
-	LIBGCC_3_4_0, // GCC_3.4
-	LIBGCC_3_4_2, // GCC_3.4.2
-	LIBGCC_3_4_4, // GCC_3.4.4 - no x86 function with that version
-	LIBGCC_4_0_0, // GCC_4.0.0
-	LIBGCC_4_1_0, // GCC_4.1.0 - no function with that version
-	LIBGCC_4_2_0, // GCC_4.2.0
-	LIBGCC_4_3_0, // GCC_4.3.0
-	LIBGCC_4_4_0, // GCC_4.4.0 - no x86_64 function with that version
-	LIBGCC_4_5_0, // GCC_4.5.0 - ditto
-	LIBGCC_4_6_0, // GCC_4.6.0 - no function with that version
-	LIBGCC_4_7_0, // GCC_4.7.0
-	LIBGCC_4_8_0, // GCC_4.8.0
-	// apparently no new functions were added (in x86/amd64) until 7.0.0
-	LIBGCC_7_0_0, // GCC_7.0.0
-	// apparently no new functions were added (in x86/amd64) until 12.0.0
-	LIBGCC_12_1_0, // GCC_12.0.0
-	LIBGCC_13_1_0, // GCC_13.0.0
-	// TODO: add new versions, if any
-	_NUM_LIBGCC_VERSIONS
-};
+#define FNV1A_64_INIT 0xcbf29ce484222325ULL
 
-static const struct gcc_version_check
-libgcc_version_checks[_NUM_LIBGCC_VERSIONS] =
+// A minimal read-only ELF reader that works on mmap()ed files.
+// It's used to get version information from libs without dlopen()ing them,
+// which would map and relocate them (and all their dependencies) and run their constructors.
+// Only the program headers and the dynamic section are used (not the section headers),
+// so it also works with stripped libs.
+struct elf_file
 {
-	{ "3.0.0", "GCC_3.0", "__mulvsi3" },
-	{ "3.3.0", "GCC_3.3", "_Unwind_Backtrace" },
-	{ "3.3.1", "GCC_3.3.1", "__gcc_personality_v0" },
-	{ "3.3.2", "GCC_3.3.2", NULL }, // no function with this version in i686 and amd64 libgcc
-	{ "3.3.4", "GCC_3.3.4", NULL }, // ditto
-	{ "3.4.0", "GCC_3.4",   "__paritydi2" },
-	{ "3.4.2", "GCC_3.4.2", "__enable_execute_stack" },
-	{ "3.4.4", "GCC_3.4.4", HAVE_64_BIT ? "__addvti3" : NULL }, // no x86 function with that version
-	{ "4.0.0", "GCC_4.0.0", "__muldc3" },
-	{ "4.1.0", "GCC_4.1.0", NULL }, // no function for this version
-	{ "4.2.0", "GCC_4.2.0", "_Unwind_GetIPInfo" },
-	{ "4.3.0", "GCC_4.3.0", "__bswapdi2" },
-	{ "4.4.0", "GCC_4.4.0", HAVE_64_BIT ? NULL : "__letf2" }, // no 64bit function for this version
-	{ "4.5.0", "GCC_4.5.0", HAVE_64_BIT ? NULL : "__extendxftf2" }, // ditto
-	{ "4.6.0", "GCC_4.6.0", NULL }, // no function for that version at all
-	{ "4.7.0", "GCC_4.7.0", "__clrsbdi2" },
-	{ "4.8.0", "GCC_4.8.0", "__cpu_indicator_init" },
-	{ "7.0.0", "GCC_7.0.0", HAVE_64_BIT ? "__divmodti4" : "__divmoddi4" },
-	{ "12.1.0","GCC_12.0.0", "__nehf2" },
-	{ "13.1.0","GCC_13.0.0", "__truncdfbf2" },
-	// TODO: add new versions
+	const unsigned char* data;
+	size_t size;
+	const ElfW(Ehdr)* ehdr;
+	const ElfW(Phdr)* phdrs;
+	const ElfW(Dyn)* dyn; // NULL if the file has no dynamic section
+	size_t num_dyn;
+	const char* strtab; // dynamic string table
+	size_t strsz;
 };
 
-static enum libgcc_version get_libgcc_version(const char* path)
+static void elf_close(struct elf_file* ef)
 {
-	return get_gcc_version(path, libgcc_version_checks, _NUM_LIBGCC_VERSIONS);
+	if(ef->data != NULL)
+	{
+		munmap((void*)ef->data, ef->size);
+	}
+	memset(ef, 0, sizeof(*ef));
 }
-#endif // CHECK_LIBGCC
-
-
-#ifdef CHECK_LIBSDL2
-typedef struct My_SDL2_version
-{
-    unsigned char major;
-    unsigned char minor;
-    unsigned char patch; // update version, e.g. 5 in 2.0.5
-} My_SDL2_version;
 
-static My_SDL2_version get_libsdl2_version(const char* path)
+// returns a pointer to len bytes at the given virtual address (as used in
+// the dynamic section) in the mapped file, or NULL if it's not backed by the file
+static const void* elf_vaddr_to_ptr(const struct elf_file* ef, ElfW(Addr) vaddr, size_t len)
 {
-	My_SDL2_version ret = {0};
-	void* handle = dlopen(path, RTLD_LAZY);
-	if(handle == NULL)
+	for(int i=0; i < ef->ehdr->e_phnum; ++i)
 	{
-		dprintf("couldn't dlopen() %s : %s\n", path, dlerror());
-		return ret;
+		const ElfW(Phdr)* ph = &ef->phdrs[i];
+		if(ph->p_type == PT_LOAD && vaddr >= ph->p_vaddr
+		   && vaddr - ph->p_vaddr <= ph->p_filesz && len <= ph->p_filesz - (vaddr - ph->p_vaddr))
+		{
+			size_t off = ph->p_offset + (vaddr - ph->p_vaddr);
+			if(off > ef->size || len > ef->size - off)  return NULL;
+			return ef->data + off;
+		}
 	}
+	return NULL;
+}
 
-	void (*sdl_getversion)(My_SDL2_version* ver);
+// returns 1 and sets *val if the dynamic section has an entry with the given tag, else 0
+static int elf_dyn_val(const struct elf_file* ef, ElfW(Sxword) tag, ElfW(Xword)* val)
+{
+	for(size_t i=0; i < ef->num_dyn && ef->dyn[i].d_tag != DT_NULL; ++i)
+	{
+		if(ef->dyn[i].d_tag == tag)
+		{
+			*val = ef->dyn[i].d_un.d_val;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// returns the string at the given offset of the dynamic string table or NULL if it's invalid
+static const char* elf_dyn_string(const struct elf_file* ef, ElfW(Xword) offset)
+{
+	if(ef->strtab == NULL || offset >= ef->strsz)  return NULL;
+	const char* ret = ef->strtab + offset;
+	// make sure it's terminated within the string table
+	return (memchr(ret, '\0', ef->strsz - offset) != NULL) ? ret : NULL;
+}
+
+// returns 1 if the file at path could be mapped and looks like an ELF file for
+// this architecture, 0 otherwise. on success ef must be elf_close()d
+static int elf_open(const char* path, struct elf_file* ef)
+{
+	memset(ef, 0, sizeof(*ef));
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0)  return 0;
+
+	struct stat st;
+	if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < (off_t)sizeof(ElfW(Ehdr)))
+	{
+		close(fd);
+		return 0;
+	}
+
+	void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(data == MAP_FAILED)  return 0;
+
+	ef->data = data;
+	ef->size = st.st_size;
+	ef->ehdr = data;
+
+	const ElfW(Ehdr)* eh = ef->ehdr;
+	if(memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0
+	   || eh->e_ident[EI_CLASS] != (HAVE_64_BIT ? ELFCLASS64 : ELFCLASS32)
+	   || eh->e_phentsize != sizeof(ElfW(Phdr))
+	   || eh->e_phoff > ef->size || (size_t)eh->e_phnum * sizeof(ElfW(Phdr)) > ef->size - eh->e_phoff)
+	{
+		elf_close(ef);
+		return 0;
+	}
+	ef->phdrs = (const ElfW(Phdr)*)(ef->data + eh->e_phoff);
+
+	for(int i=0; i < eh->e_phnum; ++i)
+	{
+		const ElfW(Phdr)* ph = &ef->phdrs[i];
+		if(ph->p_type == PT_DYNAMIC && ph->p_offset <= ef->size && ph->p_filesz <= ef->size - ph->p_offset)
+		{
+			ef->dyn = (const ElfW(Dyn)*)(ef->data + ph->p_offset);
+			ef->num_dyn = ph->p_filesz / sizeof(ElfW(Dyn));
+			break;
+		}
+	}
+
+	ElfW(Xword) strtab, strsz;
+	if(elf_dyn_val(ef, DT_STRTAB, &strtab) && elf_dyn_val(ef, DT_STRSZ, &strsz))
+	{
+		ef->strtab = elf_vaddr_to_ptr(ef, strtab, strsz);
+		ef->strsz = (ef->strtab != NULL) ? strsz : 0;
+	}
+
+	return 1;
+}
+
+// returns the dynamic symbol with the given name or NULL if the lib doesn't export it.
+// uses the lib's .gnu.hash or .hash table, like the dynamic linker does
+static const ElfW(Sym)* elf_lookup_symbol(const struct elf_file* ef, const char* name)
+{
+	ElfW(Xword) symtab_addr, hash_addr;
+	if(!elf_dyn_val(ef, DT_SYMTAB, &symtab_addr))  return NULL;
+
+	if(elf_dyn_val(ef, DT_GNU_HASH, &hash_addr))
+	{
+		const uint32_t* hdr = elf_vaddr_to_ptr(ef, hash_addr, 4*sizeof(uint32_t));
+		if(hdr == NULL || hdr[0] == 0)  return NULL;
+		uint32_t nbuckets = hdr[0], symoffset = hdr[1], bloom_size = hdr[2];
+		ElfW(Addr) buckets_addr = hash_addr + 4*sizeof(uint32_t) + bloom_size*sizeof(ElfW(Addr));
+		const uint32_t* buckets = elf_vaddr_to_ptr(ef, buckets_addr, nbuckets*sizeof(uint32_t));
+		if(buckets == NULL)  return NULL;
+		ElfW(Addr) chain_addr = buckets_addr + nbuckets*sizeof(uint32_t);
+
+		uint32_t h = 5381;
+		for(const unsigned char* c = (const unsigned char*)name; *c != '\0'; ++c)  h = h*33 + *c;
+
+		uint32_t idx = buckets[h % nbuckets];
+		if(idx < symoffset)  return NULL;
+		for(;; ++idx)
+		{
+			const uint32_t* h2 = elf_vaddr_to_ptr(ef, chain_addr + (idx - symoffset)*sizeof(uint32_t), sizeof(uint32_t));
+			const ElfW(Sym)* sym = elf_vaddr_to_ptr(ef, symtab_addr + idx*sizeof(ElfW(Sym)), sizeof(ElfW(Sym)));
+			if(h2 == NULL || sym == NULL)  return NULL;
+			if((h|1) == (*h2|1))
+			{
+				const char* sym_name = elf_dyn_string(ef, sym->st_name);
+				if(sym_name != NULL && strcmp(sym_name, name) == 0)  return sym->st_shndx != SHN_UNDEF ? sym : NULL;
+			}
+			if(*h2 & 1)  return NULL; // end of chain
+		}
+	}
+
+	if(elf_dyn_val(ef, DT_HASH, &hash_addr))
+	{
+		const uint32_t* hdr = elf_vaddr_to_ptr(ef, hash_addr, 2*sizeof(uint32_t));
+		if(hdr == NULL || hdr[0] == 0)  return NULL;
+		uint32_t nbucket = hdr[0], nchain = hdr[1];
+		const uint32_t* table = elf_vaddr_to_ptr(ef, hash_addr, (2 + nbucket + nchain)*sizeof(uint32_t));
+		if(table == NULL)  return NULL;
+		const uint32_t* bucket = table + 2;
+		const uint32_t* chain = bucket + nbucket;
+
+		uint32_t h = 0;
+		for(const unsigned char* c = (const unsigned char*)name; *c != '\0'; ++c)
+		{
+			h = (h << 4) + *c;
+			uint32_t g = h & 0xf0000000;
+			if(g != 0)  h ^= g >> 24;
+			h &= ~g;
+		}
+
+		for(uint32_t idx = bucket[h % nbucket], n = 0; idx != STN_UNDEF && idx < nchain && n < nchain; idx = chain[idx], ++n)
+		{
+			const ElfW(Sym)* sym = elf_vaddr_to_ptr(ef, symtab_addr + idx*sizeof(ElfW(Sym)), sizeof(ElfW(Sym)));
+			if(sym == NULL)  return NULL;
+			const char* sym_name = elf_dyn_string(ef, sym->st_name);
+			if(sym_name != NULL && strcmp(sym_name, name) == 0)  return sym->st_shndx != SHN_UNDEF ? sym : NULL;
+		}
+	}
+	return NULL;
+}
+
+// calls cb() with the name of each symbol version defined by the lib (in .gnu.version_d),
+// except for the base version (which is just the soname).
+// returns the number of versions passed to cb(), so 0 if there are none
+static int elf_foreach_verdef(const struct elf_file* ef, void (*cb)(const char* name, void* user), void* user)
+{
+	ElfW(Xword) verdef_addr, verdef_num;
+	if(!elf_dyn_val(ef, DT_VERDEF, &verdef_addr) || !elf_dyn_val(ef, DT_VERDEFNUM, &verdef_num))
+		return 0;
+
+	int ret = 0;
+	ElfW(Addr) addr = verdef_addr;
+	for(ElfW(Xword) i=0; i < verdef_num; ++i)
+	{
+		const ElfW(Verdef)* vd = elf_vaddr_to_ptr(ef, addr, sizeof(ElfW(Verdef)));
+		if(vd == NULL || vd->vd_version != VER_DEF_CURRENT)  break;
+
+		const ElfW(Verdaux)* vda = elf_vaddr_to_ptr(ef, addr + vd->vd_aux, sizeof(ElfW(Verdaux)));
+		const char* name = (vda != NULL) ? elf_dyn_string(ef, vda->vda_name) : NULL;
+		if(name != NULL && !(vd->vd_flags & VER_FLG_BASE))
+		{
+			cb(name, user);
+			++ret;
+		}
+
+		if(vd->vd_next == 0)  break;
+		addr += vd->vd_next;
+	}
+	return ret;
+}
+
+#if defined(OVERRIDE_ONLY_IF_REQUIRED) || defined(PRELOAD_ALLOCATOR) || defined(VERIFY_LOAD_GRAPH)
+// calls cb(file, name, user) for each version the ELF file needs from another
+// object (from its .gnu.version_r), returns the number of versions found
+static int elf_foreach_verneed(const struct elf_file* ef, void (*cb)(const char* file, const char* name, void* user), void* user)
+{
+	ElfW(Xword) verneed_addr, verneed_num;
+	if(!elf_dyn_val(ef, DT_VERNEED, &verneed_addr) || !elf_dyn_val(ef, DT_VERNEEDNUM, &verneed_num))
+		return 0;
+
+	int ret = 0;
+	ElfW(Addr) addr = verneed_addr;
+	for(ElfW(Xword) i=0; i < verneed_num; ++i)
+	{
+		const ElfW(Verneed)* vn = elf_vaddr_to_ptr(ef, addr, sizeof(ElfW(Verneed)));
+		if(vn == NULL || vn->vn_version != VER_NEED_CURRENT)  break;
+
+		const char* file = elf_dyn_string(ef, vn->vn_file);
+		ElfW(Addr) aux_addr = addr + vn->vn_aux;
+		for(ElfW(Half) a=0; file != NULL && a < vn->vn_cnt; ++a)
+		{
+			const ElfW(Vernaux)* vna = elf_vaddr_to_ptr(ef, aux_addr, sizeof(ElfW(Vernaux)));
+			if(vna == NULL)  break;
+
+			const char* name = elf_dyn_string(ef, vna->vna_name);
+			if(name != NULL)
+			{
+				cb(file, name, user);
+				++ret;
+			}
+
+			if(vna->vna_next == 0)  break;
+			aux_addr += vna->vna_next;
+		}
+
+		if(vn->vn_next == 0)  break;
+		addr += vn->vn_next;
+	}
+	return ret;
+}
+
+struct verdef_search
+{
+	const char* name;
+	int found;
+};
+
+static void verdef_search_cb(const char* name, void* user)
+{
+	struct verdef_search* vs = user;
+	if(strcmp(vs->name, name) == 0)  vs->found = 1;
+}
+
+// returns 1 if the ELF file defines the given symbol version
+static int elf_has_verdef(const struct elf_file* ef, const char* version)
+{
+	struct verdef_search vs = { version, 0 };
+	elf_foreach_verdef(ef, verdef_search_cb, &vs);
+	return vs.found;
+}
+#endif // OVERRIDE_ONLY_IF_REQUIRED || PRELOAD_ALLOCATOR || VERIFY_LOAD_GRAPH
+
+// compares the numeric parts of symbol versions, like "3.4.29" (from "GLIBCXX_3.4.29")
+// returns <0, 0 or >0 like strcmp(); "3.4" is considered older than "3.4.1"
+static int compare_version_numbers(const char* a, const char* b)
+{
+	while(*a != '\0' || *b != '\0')
+	{
+		char* end;
+		long na = (*a != '\0') ? strtol(a, &end, 10) : -1;
+		if(*a != '\0')  a = (*end == '.') ? end+1 : end;
+		long nb = (*b != '\0') ? strtol(b, &end, 10) : -1;
+		if(*b != '\0')  b = (*end == '.') ? end+1 : end;
+
+		if(na != nb)  return (na < nb) ? -1 : 1;
+	}
+	return 0;
+}
+
+// returns 1 if the file at path is an ELF file for the same architecture as this wrapper,
+// i.e. one the dynamic linker would accept (it skips incompatible libs while searching)
+static int is_compatible_elf(const char* path)
+{
+	static ElfW(Half) own_machine = EM_NONE;
+	ElfW(Ehdr) eh;
+
+	if(own_machine == EM_NONE)
+	{
+		int fd = open("/proc/self/exe", O_RDONLY | O_CLOEXEC);
+		if(fd >= 0)
+		{
+			if(read(fd, &eh, sizeof(eh)) == sizeof(eh))  own_machine = eh.e_machine;
+			close(fd);
+		}
+	}
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0)  return 0;
+	int ret = read(fd, &eh, sizeof(eh)) == sizeof(eh)
+	          && memcmp(eh.e_ident, ELFMAG, SELFMAG) == 0
+	          && eh.e_ident[EI_CLASS] == (HAVE_64_BIT ? ELFCLASS64 : ELFCLASS32)
+	          && (own_machine == EM_NONE || eh.e_machine == own_machine);
+	close(fd);
+	return ret;
+}
+
+// /etc/ld.so.cache maps sonames to the paths of the libs in the directories configured
+// in /etc/ld.so.conf, it's generated by ldconfig. There are two formats:
+// the old one (magic "ld.so-1.7.0", used up to glibc 2.31 by default; usually followed by
+// the new format for compatibility) and the new one (magic "glibc-ld.so.cache1.1").
+// See sysdeps/generic/dl-cache.h in glibc for details.
+#define LDSO_CACHE_PATH      "/etc/ld.so.cache"
+#define LDSO_CACHE_MAGIC_OLD "ld.so-1.7.0"
+#define LDSO_CACHE_MAGIC_NEW "glibc-ld.so.cache1.1"
+
+// the flags of entries the dynamic linker accepts on this architecture (_DL_CACHE_DEFAULT_ID)
+#if defined(__x86_64__) && defined(__ILP32__)
+	#define LDSO_CACHE_FLAGS 0x0803 // FLAG_ELF_LIBC6 | FLAG_X8664_LIBX32
+#elif defined(__x86_64__)
+	#define LDSO_CACHE_FLAGS 0x0303 // FLAG_ELF_LIBC6 | FLAG_X8664_LIB64
+#elif defined(__aarch64__)
+	#define LDSO_CACHE_FLAGS 0x0a03 // FLAG_ELF_LIBC6 | FLAG_AARCH64_LIB64
+#elif defined(__arm__) && defined(__ARM_PCS_VFP)
+	#define LDSO_CACHE_FLAGS 0x0903 // FLAG_ELF_LIBC6 | FLAG_ARM_LIBHF
+#elif defined(__powerpc64__)
+	#define LDSO_CACHE_FLAGS 0x0503 // FLAG_ELF_LIBC6 | FLAG_POWERPC_LIB64
+#else
+	#define LDSO_CACHE_FLAGS 0x0003 // FLAG_ELF_LIBC6
+#endif
+
+#define LDSO_CACHE_HWCAP_EXTENSION (1ULL << 62)
+#define LDSO_CACHE_HWCAP_ISA_LEVEL_MASK 0x3ff // ISA level bits in the upper 32 bits of hwcap
+#define LDSO_CACHE_EXTENSION_MAGIC 0xeaa42174u
+#define LDSO_CACHE_EXTENSION_TAG_GLIBC_HWCAPS 1
+
+struct ldso_cache_entry_old
+{
+	int32_t flags;
+	uint32_t key, value; // offsets of soname and path, relative to the string table after the entries
+};
+
+struct ldso_cache_entry_new
+{
+	int32_t flags;
+	uint32_t key, value; // offsets of soname and path, relative to the start of the new format cache
+	uint32_t osversion;
+	uint64_t hwcap; // if LDSO_CACHE_HWCAP_EXTENSION: the lower 32 bits are the glibc-hwcaps subdir index
+};
+
+struct ldso_cache_header_new
+{
+	char magic[sizeof(LDSO_CACHE_MAGIC_NEW) - 1];
+	uint32_t nlibs;
+	uint32_t len_strings;
+	uint8_t flags;
+	uint8_t padding[3];
+	uint32_t extension_offset;
+	uint32_t unused[3];
+	// followed by nlibs struct ldso_cache_entry_new
+};
+
+static struct
+{
+	int state; // 0: not loaded yet, 1: loaded, -1: not available
+	const unsigned char* data;
+	size_t size;
+	// only set if there's a new format cache (possibly after an old format cache)
+	const unsigned char* new_start;
+	size_t new_size;
+	const struct ldso_cache_entry_new* new_entries;
+	uint32_t new_nlibs;
+	// glibc-hwcaps subdirectory names from the extension section
+	const uint32_t* hwcaps_names;
+	uint32_t num_hwcaps_names;
+	// only set for the old format
+	const struct ldso_cache_entry_old* old_entries;
+	uint32_t old_nlibs;
+	const char* old_strings;
+	size_t old_strings_size;
+} ldso_cache;
+
+static const char* ldso_cache_string(const char* base, size_t size, uint32_t offset)
+{
+	if(offset >= size)  return NULL;
+	const char* ret = base + offset;
+	return (memchr(ret, '\0', size - offset) != NULL) ? ret : NULL;
+}
+
+static void ldso_cache_parse_new(const unsigned char* start, size_t size)
+{
+	const struct ldso_cache_header_new* hdr = (const struct ldso_cache_header_new*)start;
+	if(size < sizeof(*hdr) || memcmp(hdr->magic, LDSO_CACHE_MAGIC_NEW, sizeof(hdr->magic)) != 0
+	   || hdr->nlibs > (size - sizeof(*hdr)) / sizeof(struct ldso_cache_entry_new))
+	{
+		return;
+	}
+	ldso_cache.new_start = start;
+	ldso_cache.new_size = size;
+	ldso_cache.new_entries = (const struct ldso_cache_entry_new*)(start + sizeof(*hdr));
+	ldso_cache.new_nlibs = hdr->nlibs;
+
+	uint32_t ext_off = hdr->extension_offset;
+	if(ext_off != 0 && ext_off % 4 == 0 && ext_off < size && size - ext_off >= 2*sizeof(uint32_t))
+	{
+		const uint32_t* ext = (const uint32_t*)(start + ext_off);
+		uint32_t count = ext[1];
+		if(ext[0] != LDSO_CACHE_EXTENSION_MAGIC || count > (size - ext_off - 2*sizeof(uint32_t)) / (4*sizeof(uint32_t)))
+			return;
+
+		// each section has tag, flags, offset and size
+		for(uint32_t i=0; i < count; ++i)
+		{
+			const uint32_t* sec = ext + 2 + 4*i;
+			if(sec[0] == LDSO_CACHE_EXTENSION_TAG_GLIBC_HWCAPS && sec[2] % 4 == 0
+			   && sec[2] <= size && sec[3] <= size - sec[2])
+			{
+				ldso_cache.hwcaps_names = (const uint32_t*)(start + sec[2]);
+				ldso_cache.num_hwcaps_names = sec[3] / sizeof(uint32_t);
+			}
+		}
+	}
+}
+
+static int ldso_cache_load(void)
+{
+	if(ldso_cache.state != 0)  return ldso_cache.state > 0;
+	ldso_cache.state = -1;
+
+	int fd = open(LDSO_CACHE_PATH, O_RDONLY | O_CLOEXEC);
+	if(fd < 0)  return 0;
+	struct stat st;
+	if(fstat(fd, &st) != 0 || st.st_size < 16)
+	{
+		close(fd);
+		return 0;
+	}
+	void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(data == MAP_FAILED)  return 0;
+
+	ldso_cache.data = data;
+	ldso_cache.size = st.st_size;
+
+	const size_t old_magic_len = sizeof(LDSO_CACHE_MAGIC_OLD) - 1;
+	if(memcmp(data, LDSO_CACHE_MAGIC_OLD, old_magic_len) == 0)
+	{
+		// char magic[11]; uint32_t nlibs; (at offset 12 because of alignment), then the entries
+		uint32_t nlibs;
+		memcpy(&nlibs, ldso_cache.data + 12, sizeof(nlibs));
+		if(nlibs > (ldso_cache.size - 16) / sizeof(struct ldso_cache_entry_old))
+		{
+			munmap(data, st.st_size);
+			return 0;
+		}
+		ldso_cache.old_entries = (const struct ldso_cache_entry_old*)(ldso_cache.data + 16);
+		ldso_cache.old_nlibs = nlibs;
+		size_t strings_off = 16 + nlibs * sizeof(struct ldso_cache_entry_old);
+		ldso_cache.old_strings = (const char*)ldso_cache.data + strings_off;
+		ldso_cache.old_strings_size = ldso_cache.size - strings_off;
+
+		// the new format may follow (aligned to 8 bytes), it's preferred if it exists
+		size_t new_off = (strings_off + 7) & ~(size_t)7;
+		if(new_off < ldso_cache.size)
+		{
+			ldso_cache_parse_new(ldso_cache.data + new_off, ldso_cache.size - new_off);
+		}
+	}
+	else
+	{
+		ldso_cache_parse_new(ldso_cache.data, ldso_cache.size);
+	}
+
+	if(ldso_cache.old_entries == NULL && ldso_cache.new_entries == NULL)
+	{
+		munmap(data, st.st_size);
+		return 0;
+	}
+	ldso_cache.state = 1;
+	return 1;
+}
+
+static int ldso_cache_flags_ok(int32_t flags)
+{
+	return flags == LDSO_CACHE_FLAGS || (LDSO_CACHE_FLAGS == 0x0003 && flags == 1);
+}
+
+// looks up soname in /etc/ld.so.cache and writes the path of the lib to out (PATH_MAX bytes).
+// hwcaps_subdirs is a NULL-terminated list of supported glibc-hwcaps subdirectories
+// (like "x86-64-v3"), best first - versions of the lib in those are preferred over
+// the baseline version. It may be NULL, then only the baseline version is considered.
+// returns 0 if the lib is not in the cache (or there is no usable cache)
+static int ldso_cache_lookup(const char* soname, const char* const* hwcaps_subdirs, char* out)
+{
+	if(!ldso_cache_load())  return 0;
+
+	const char* best = NULL;
+	int best_prio = INT_MAX;
+
+	if(ldso_cache.new_entries != NULL)
+	{
+		const char* strings = (const char*)ldso_cache.new_start;
+		int num_subdirs = 0;
+		while(hwcaps_subdirs != NULL && hwcaps_subdirs[num_subdirs] != NULL)  ++num_subdirs;
+
+		for(uint32_t i=0; i < ldso_cache.new_nlibs; ++i)
+		{
+			const struct ldso_cache_entry_new* e = &ldso_cache.new_entries[i];
+			if(!ldso_cache_flags_ok(e->flags))  continue;
+			const char* key = ldso_cache_string(strings, ldso_cache.new_size, e->key);
+			if(key == NULL || strcmp(key, soname) != 0)  continue;
+
+			int prio = num_subdirs; // baseline
+			if(((e->hwcap >> 32) & ~(uint64_t)LDSO_CACHE_HWCAP_ISA_LEVEL_MASK) == (LDSO_CACHE_HWCAP_EXTENSION >> 32))
+			{
+				uint32_t idx = (uint32_t)e->hwcap;
+				const char* subdir = (idx < ldso_cache.num_hwcaps_names)
+					? ldso_cache_string(strings, ldso_cache.new_size, ldso_cache.hwcaps_names[idx]) : NULL;
+				prio = -1;
+				for(int j=0; subdir != NULL && j < num_subdirs; ++j)
+				{
+					if(strcmp(subdir, hwcaps_subdirs[j]) == 0)
+					{
+						prio = j;
+						break;
+					}
+				}
+				if(prio < 0)  continue; // not supported by this CPU (or not wanted)
+			}
+			else if(e->hwcap != 0)
+			{
+				// legacy hwcaps subdirectories (removed in glibc 2.37) - ignore them,
+				// the baseline version of the lib is always there as well
+				continue;
+			}
+
+			const char* value = ldso_cache_string(strings, ldso_cache.new_size, e->value);
+			if(value != NULL && prio < best_prio)
+			{
+				best = value;
+				best_prio = prio;
+			}
+		}
+	}
+	else
+	{
+		for(uint32_t i=0; i < ldso_cache.old_nlibs && best == NULL; ++i)
+		{
+			const struct ldso_cache_entry_old* e = &ldso_cache.old_entries[i];
+			if(!ldso_cache_flags_ok(e->flags))  continue;
+			const char* key = ldso_cache_string(ldso_cache.old_strings, ldso_cache.old_strings_size, e->key);
+			if(key != NULL && strcmp(key, soname) == 0)
+			{
+				best = ldso_cache_string(ldso_cache.old_strings, ldso_cache.old_strings_size, e->value);
+			}
+		}
+	}
+
+	return best != NULL && snprintf(out, PATH_MAX, "%s", best) < PATH_MAX;
+}
+
+// the directories the dynamic linker searches if a lib is not in ld.so.cache,
+// plus the ones commonly used by distributions with multiarch support
+static const char* const default_lib_dirs[] = {
+#if defined(__x86_64__) && !defined(__ILP32__)
+	"/lib/x86_64-linux-gnu", "/usr/lib/x86_64-linux-gnu",
+#elif defined(__i386__)
+	"/lib/i386-linux-gnu", "/usr/lib/i386-linux-gnu",
+#elif defined(__aarch64__)
+	"/lib/aarch64-linux-gnu", "/usr/lib/aarch64-linux-gnu",
+#endif
+#if HAVE_64_BIT_LIBDIRS
+	"/lib64", "/usr/lib64",
+#endif
+	"/lib", "/usr/lib",
+	NULL
+};
+
+// returns 1 if the ':'-separated list (of list_len chars) contains the entry
+static int path_list_contains(const char* list, size_t list_len, const char* entry, size_t entry_len)
+{
+	const char* end = list + list_len;
+	while(list <= end)
+	{
+		const char* colon = memchr(list, ':', end - list);
+		size_t len = (colon != NULL) ? (size_t)(colon - list) : (size_t)(end - list);
+		if(len == entry_len && memcmp(list, entry, len) == 0)  return 1;
+		if(colon == NULL)  break;
+		list = colon + 1;
+	}
+	return 0;
+}
+
+// appends the entries of the ':'-separated src to dst (which is empty or ends with ':'),
+// each followed by ':', skipping entries dst already contains.
+// dst must be big enough for strlen(dst) + strlen(src) + 2 chars
+static void append_path_list(char* dst, const char* src)
+{
+	size_t dst_len = strlen(dst);
+	while(src != NULL)
+	{
+		const char* colon = strchr(src, ':');
+		size_t len = (colon != NULL) ? (size_t)(colon - src) : strlen(src);
+		if(dst_len == 0 || !path_list_contains(dst, dst_len - 1, src, len))
+		{
+			memcpy(dst + dst_len, src, len);
+			dst_len += len;
+			dst[dst_len++] = ':';
+			dst[dst_len] = '\0';
+		}
+		src = (colon != NULL) ? colon + 1 : NULL;
+	}
+}
+
+// tries to find name in the directories of the colon-separated list dirs
+static int find_lib_in_dirs(const char* name, const char* dirs, char* out)
+{
+	while(dirs != NULL && *dirs != '\0')
+	{
+		const char* colon = strchr(dirs, ':');
+		int len = (colon != NULL) ? (int)(colon - dirs) : (int)strlen(dirs);
+		// an empty entry means the current directory
+		int path_len = (len > 0) ? snprintf(out, PATH_MAX, "%.*s/%s", len, dirs, name)
+		                         : snprintf(out, PATH_MAX, "./%s", name);
+		if(path_len > 0 && path_len < PATH_MAX && is_compatible_elf(out))  return 1;
+		dirs = (colon != NULL) ? colon+1 : NULL;
+	}
+	return 0;
+}
+
+#ifdef SELECT_ISA_VARIANTS
+static int isa_level = 1; // x86-64 microarchitecture level, set by detect_isa_level(), 1 is the baseline
+// the glibc-hwcaps subdirectories for isa_level (best first, NULL-terminated)
+static const char* isa_hwcaps[4] = { NULL };
+
+#if defined(__x86_64__)
+static uint64_t xgetbv0(void)
+{
+	uint32_t lo, hi;
+	// that's "xgetbv", as bytes for assemblers that don't know it yet
+	__asm__ volatile(".byte 0x0f, 0x01, 0xd0" : "=a"(lo), "=d"(hi) : "c"(0));
+	return ((uint64_t)hi << 32) | lo;
+}
+#endif
+
+// returns the x86-64 psABI level (1 to 4) the CPU (and OS, for the AVX register state) supports.
+// not using __builtin_cpu_supports() because old GCC versions don't know the newer features.
+static int get_cpu_isa_level(void)
+{
+#if defined(__x86_64__)
+	unsigned int eax, ebx, ecx, edx;
+	unsigned int max_leaf = __get_cpuid_max(0, NULL);
+	if(max_leaf < 1 || __get_cpuid_max(0x80000000, NULL) < 0x80000001)  return 1;
+
+	__cpuid(1, eax, ebx, ecx, edx);
+	unsigned int ecx1 = ecx;
+	__cpuid(0x80000001, eax, ebx, ecx, edx);
+	unsigned int ecx_ext = ecx;
+	unsigned int ebx7 = 0;
+	if(max_leaf >= 7)
+	{
+		__cpuid_count(7, 0, eax, ebx, ecx, edx);
+		ebx7 = ebx;
+	}
+
+	// CPUID.1:ECX: SSE3 (0), SSSE3 (9), CMPXCHG16B (13), SSE4.1 (19), SSE4.2 (20), POPCNT (23)
+	// CPUID.80000001H:ECX: LAHF/SAHF (0)
+	const unsigned int v2_ecx1 = (1u << 0) | (1u << 9) | (1u << 13) | (1u << 19) | (1u << 20) | (1u << 23);
+	if((ecx1 & v2_ecx1) != v2_ecx1 || !(ecx_ext & 1u))  return 1;
+
+	// CPUID.1:ECX: FMA (12), MOVBE (22), OSXSAVE (27), AVX (28), F16C (29)
+	// CPUID.80000001H:ECX: LZCNT (5), CPUID.7:EBX: BMI1 (3), AVX2 (5), BMI2 (8)
+	const unsigned int v3_ecx1 = (1u << 12) | (1u << 22) | (1u << 27) | (1u << 28) | (1u << 29);
+	const unsigned int v3_ebx7 = (1u << 3) | (1u << 5) | (1u << 8);
+	if((ecx1 & v3_ecx1) != v3_ecx1 || !(ecx_ext & (1u << 5)) || (ebx7 & v3_ebx7) != v3_ebx7)  return 2;
+
+	// the OS must save the SSE and AVX registers on context switches
+	uint64_t xcr0 = xgetbv0();
+	if((xcr0 & 0x6) != 0x6)  return 2;
+
+	// CPUID.7:EBX: AVX512F (16), AVX512DQ (17), AVX512CD (28), AVX512BW (30), AVX512VL (31)
+	// and the OS must save the opmask and ZMM registers
+	const unsigned int v4_ebx7 = (1u << 16) | (1u << 17) | (1u << 28) | (1u << 30) | (1u << 31);
+	if((ebx7 & v4_ebx7) != v4_ebx7 || (xcr0 & 0xe6) != 0xe6)  return 3;
+
+	return 4;
+#else
+	return 1; // the levels only exist for x86-64
+#endif
+}
+
+static void detect_isa_level(void)
+{
+	static const char* level_names[] = { "x86-64-v4", "x86-64-v3", "x86-64-v2" };
+
+	isa_level = get_cpu_isa_level();
+
+	const char* force = getenv("WRAPPER_FORCE_ISA");
+	if(force != NULL && force[0] != '\0')
+	{
+		const char* lvl = force;
+		if(strncmp(lvl, "x86-64-", 7) == 0)  lvl += 7;
+		if(*lvl == 'v')  ++lvl;
+
+		int forced = (strcmp(force, "baseline") == 0 || strcmp(force, "x86-64") == 0) ? 1 : atoi(lvl);
+		if(forced >= 1 && forced <= 4)
+		{
+			dprintf("WRAPPER_FORCE_ISA: using level %d instead of detected %d\n", forced, isa_level);
+			isa_level = forced;
+		}
+		else
+		{
+			eprintf("Ignoring invalid WRAPPER_FORCE_ISA '%s' (use e.g. x86-64-v3 or baseline)\n", force);
+		}
+	}
+
+	int n = 0;
+	for(int l = isa_level; l >= 2; --l)
+	{
+		isa_hwcaps[n++] = level_names[4 - l];
+	}
+	isa_hwcaps[n] = NULL;
+
+	dprintf("CPU microarchitecture level: %s\n", (isa_level >= 2) ? isa_hwcaps[0] : "x86-64 (baseline)");
+}
+#endif // SELECT_ISA_VARIANTS
+
+// like resolve_lib_path(), but with the given library path instead of LD_LIBRARY_PATH
+static int resolve_lib_path_from(const char* name, const char* library_path, char* out)
+{
+	if(strchr(name, '/') != NULL)
+	{
+		return snprintf(out, PATH_MAX, "%s", name) < PATH_MAX;
+	}
+
+	if(find_lib_in_dirs(name, library_path, out))  return 1;
+
+#ifdef SELECT_ISA_VARIANTS
+	if(ldso_cache_lookup(name, isa_hwcaps, out))  return 1;
+#else
+	if(ldso_cache_lookup(name, NULL, out))  return 1;
+#endif
+
+	for(int i=0; default_lib_dirs[i] != NULL; ++i)
+	{
+		if(find_lib_in_dirs(name, default_lib_dirs[i], out))  return 1;
+	}
+
+	dprintf("couldn't find %s on the system\n", name);
+	return 0;
+}
+
+// writes the path of the lib the dynamic linker would load for name to out (PATH_MAX bytes)
+// if name contains a '/' it's used as it is.
+// Like the dynamic linker, this searches LD_LIBRARY_PATH, then /etc/ld.so.cache and
+// then the default directories - without loading the lib.
+// returns 0 if the lib couldn't be found
+static int resolve_lib_path(const char* name, char* out)
+{
+	return resolve_lib_path_from(name, getenv("LD_LIBRARY_PATH"), out);
+}
+
+#if defined(PREFETCH_LIBS) || defined(OVERRIDE_ONLY_IF_REQUIRED) || defined(VERIFY_LOAD_GRAPH)
+// replaces $ORIGIN and ${ORIGIN} in a DT_RPATH or DT_RUNPATH with the directory
+// of the object it's from, like the dynamic linker does
+static void expand_origin(const char* dirs, const char* obj_path, char* out, size_t out_size)
+{
+	char origin[PATH_MAX];
+	const char* slash = strrchr(obj_path, '/');
+	int origin_len = (slash != NULL) ? (int)(slash - obj_path) : 1;
+	snprintf(origin, sizeof(origin), "%.*s", origin_len, (slash != NULL) ? obj_path : ".");
+
+	size_t pos = 0;
+	out[0] = '\0';
+	while(*dirs != '\0' && pos + 1 < out_size)
+	{
+		size_t skip = 0;
+		if(strncmp(dirs, "$ORIGIN", 7) == 0)  skip = 7;
+		else if(strncmp(dirs, "${ORIGIN}", 9) == 0)  skip = 9;
+
+		if(skip > 0)
+		{
+			int len = snprintf(out + pos, out_size - pos, "%s", origin);
+			if(len < 0 || (size_t)len >= out_size - pos)  break;
+			pos += len;
+			dirs += skip;
+		}
+		else
+		{
+			out[pos++] = *dirs++;
+			out[pos] = '\0';
+		}
+	}
+}
+#endif
+
+#if defined(CHECK_LIBSTDCPP) || defined(CHECK_LIBGCC)
+struct gcc_version_check
+{
+	const char* gcc_ver_name;
+	const char* fn_version;
+	const char* fn_name;
+};
+
+struct gcc_verdef_search
+{
+	const struct gcc_version_check* checks;
+	int num_checks;
+	size_t prefix_len; // length of "GLIBCXX_" or "GCC_", taken from checks[0].fn_version
+	int ret;
+	const char* newer_name; // the highest version node that's newer than the table, or NULL
+};
+
+// Versions that are newer than the newest one in the table are returned as
+// num_checks + GCC_NEWER_VERSION(major, minor, patch) of the highest such version node
+// (e.g. 3.4.34 for GLIBCXX_3.4.34), so libs from two GCC releases that are both newer
+// than this wrapper can still be compared.
+#define GCC_NEWER_VERSION(major, minor, patch)  ((major) * 1000000 + (minor) * 1000 + (patch))
+
+// returns the numbers of a version like "3.4.34" packed with GCC_NEWER_VERSION()
+static int pack_newer_gcc_version(const char* ver)
+{
+	long parts[3] = { 0, 0, 0 };
+	for(int i=0; i < 3 && *ver != '\0'; ++i)
+	{
+		char* end;
+		parts[i] = strtol(ver, &end, 10);
+		if(parts[i] < 0)  parts[i] = 0;
+		if(parts[i] > 999)  parts[i] = 999;
+		ver = (*end == '.') ? end+1 : end;
+		if(end == ver && *end != '\0')  break; // not a number
+	}
+	return GCC_NEWER_VERSION((int)parts[0], (int)parts[1], (int)parts[2]);
+}
+
+static void gcc_verdef_cb(const char* name, void* user)
+{
+	struct gcc_verdef_search* s = user;
+	const struct gcc_version_check* checks = s->checks;
+	if(strncmp(name, checks[0].fn_version, s->prefix_len) != 0)  return; // e.g. CXXABI_1.3
+
+	for(int i = s->ret+1; i < s->num_checks; ++i)
+	{
+		if(strcmp(checks[i].fn_version, name) == 0)
+		{
+			s->ret = i;
+			return;
+		}
+	}
+
+	// not in the table (or older than what we already found) - if it's newer than the newest
+	// version in the table, the lib is from a GCC release that's newer than this wrapper;
+	// remember the highest such version, so two of those can be compared
+	const char* newest = (s->newer_name != NULL) ? s->newer_name : checks[s->num_checks-1].fn_version;
+	if(compare_version_numbers(name + s->prefix_len, newest + s->prefix_len) > 0)
+	{
+		s->newer_name = name;
+		s->ret = s->num_checks + pack_newer_gcc_version(name + s->prefix_len);
+	}
+}
+
+// fallback for libs without .gnu.version_d (shouldn't happen with libstdc++ or libgcc_s):
+// dlopen() the lib and check which of the functions in checks[] are available
+static int get_gcc_version_dlvsym(const char* libpath, const struct gcc_version_check checks[], const int num_checks)
+{
+#ifdef NO_DLOPEN
+	(void)checks;
+	(void)num_checks;
+	eprintf("%s has no symbol versions and this wrapper can't dlopen() it\n", libpath);
+	return -1;
+#else
+	void* handle = dlopen(libpath, RTLD_LAZY);
+	int i, ret = -1;
+	if(handle == NULL)
+	{
+		eprintf("couldn't dlopen() %s : %s\n", libpath, dlerror());
+		return ret;
+	}
+
+	for(i=0; i < num_checks; ++i)
+	{
+		const char* fn_name = checks[i].fn_name;
+		if(fn_name != NULL)
+		{
+			void* fn = dlvsym(handle, fn_name, checks[i].fn_version);
+			if(fn == NULL)
+			{
+				dlerror(); // clear it
+				break;
+			}
+			ret = i;
+		}
+	}
+
+	dlclose(handle);
+
+	// if ret == num_checks-1, the real version could potentially be even newer
+	return ret;
+#endif // NO_DLOPEN
+}
+
+// returns the index of the newest entry of checks[] whose version is defined by the lib,
+// num_checks + GCC_NEWER_VERSION() of its highest version if that's newer than any in checks[]
+// or -1 if it wasn't found at all
+static int get_gcc_version(const char* libpath, const struct gcc_version_check checks[], const int num_checks)
+{
+	struct elf_file ef;
+	if(!elf_open(libpath, &ef))
+	{
+		eprintf("couldn't read ELF file %s\n", libpath);
+		return -1;
+	}
+
+	struct gcc_verdef_search search = { checks, num_checks, 0, -1, NULL };
+	const char* underscore = strchr(checks[0].fn_version, '_');
+	search.prefix_len = (underscore != NULL) ? (size_t)(underscore - checks[0].fn_version) + 1 : 0;
+
+	int num_verdefs = elf_foreach_verdef(&ef, gcc_verdef_cb, &search);
+	elf_close(&ef);
+
+	if(num_verdefs == 0)
+	{
+		dprintf("%s has no symbol versions, falling back to dlvsym()\n", libpath);
+		return get_gcc_version_dlvsym(libpath, checks, num_checks);
+	}
+	return search.ret;
+}
+
+static const char* get_gcc_version_name(const struct gcc_version_check checks[], const int num_checks, int idx)
+{
+	// (two buffers, because it's called for the system's and the bundled version in one printf())
+	static char newer_names[2][64];
+	static int next_name = 0;
+	if(idx < 0) return "Not found";
+	if(idx == num_checks) return "Newer than the newest known version";
+	if(idx > num_checks)
+	{
+		char* buf = newer_names[next_name];
+		next_name ^= 1;
+		int ver = idx - num_checks;
+		const char* underscore = strchr(checks[0].fn_version, '_');
+		int prefix_len = (underscore != NULL) ? (int)(underscore - checks[0].fn_version) + 1 : 0;
+		snprintf(buf, sizeof(newer_names[0]), "Newer than the newest known version (%.*s%d.%d.%d)", prefix_len,
+		         checks[0].fn_version, ver / 1000000, (ver / 1000) % 1000, ver % 1000);
+		return buf;
+	}
+	return checks[idx].gcc_ver_name;
+}
+#endif // defined(CHECK_LIBSTDCPP) || defined(CHECK_LIBGCC)
+
+#ifdef CHECK_LIBSTDCPP
+enum stdcpp_gcc_version {
+	STDCPP_GCC_OLDER = -1,
+	// see https://gcc.gnu.org/onlinedocs/libstdc++/manual/abi.html#abi.versioning
+	// Note that this does not list all released GCC versions, but only
+	// the ones that bumped the libstdc++ ABI version (GLIBCXX_3.4.x)
+	// BTW, the value of MY_GCC_* corresponds with x in GLIBCXX_3.4.x
+	STDCPP_GCC_3_4_0 = 0, // GLIBCXX_3.4, CXXABI_1.3
+	STDCPP_GCC_3_4_1, // GLIBCXX_3.4.1, CXXABI_1.3
+	STDCPP_GCC_3_4_2, // GLIBCXX_3.4.2
+	STDCPP_GCC_3_4_3, // GLIBCXX_3.4.3 - unfortunately there's no function with that version in libstdc++
+	STDCPP_GCC_4_0_0, // GLIBCXX_3.4.4, CXXABI_1.3.1
+	STDCPP_GCC_4_0_1, // GLIBCXX_3.4.5
+	STDCPP_GCC_4_0_2, // GLIBCXX_3.4.6
+	STDCPP_GCC_4_0_3, // GLIBCXX_3.4.7
+	STDCPP_GCC_4_1_1, // GLIBCXX_3.4.8 - no function for x86?!
+	STDCPP_GCC_4_2_0, // GLIBCXX_3.4.9,
+	STDCPP_GCC_4_3_0, // GLIBCXX_3.4.10, CXXABI_1.3.2
+	STDCPP_GCC_4_4_0, // GLIBCXX_3.4.11, CXXABI_1.3.3
+	STDCPP_GCC_4_4_1, // GLIBCXX_3.4.12, CXXABI_1.3.3 - no function with that version
+	STDCPP_GCC_4_4_2, // GLIBCXX_3.4.13, CXXABI_1.3.3
+	STDCPP_GCC_4_5_0, // GLIBCXX_3.4.14, CXXABI_1.3.4
+	STDCPP_GCC_4_6_0, // GLIBCXX_3.4.15, CXXABI_1.3.5
+	STDCPP_GCC_4_6_1, // GLIBCXX_3.4.16, CXXABI_1.3.5
+	STDCPP_GCC_4_7_0, // GLIBCXX_3.4.17, CXXABI_1.3.6
+	STDCPP_GCC_4_8_0, // GLIBCXX_3.4.18, CXXABI_1.3.7
+	STDCPP_GCC_4_8_3, // GLIBCXX_3.4.19, CXXABI_1.3.7
+	STDCPP_GCC_4_9_0, // GLIBCXX_3.4.20, CXXABI_1.3.8
+	STDCPP_GCC_5_1_0, // GLIBCXX_3.4.21, CXXABI_1.3.9
+	STDCPP_GCC_6_1_0, // GLIBCXX_3.4.22, CXXABI_1.3.10
+	STDCPP_GCC_7_1_0, // GLIBCXX_3.4.23, CXXABI_1.3.11
+	STDCPP_GCC_7_2_0, // GLIBCXX_3.4.24, CXXABI_1.3.11 - no function for x86_64
+	STDCPP_GCC_8_1_0, // GLIBCXX_3.4.25, CXXABI_1.3.11
+	STDCPP_GCC_9_1_0, // GLIBCXX_3.4.26, CXXABI_1.3.12
+	STDCPP_GCC_9_2_0, // GLIBCXX_3.4.27, CXXABI_1.3.12
+	STDCPP_GCC_9_3_0, // GLIBCXX_3.4.28, CXXABI_1.3.12
+	//STDCPP_GCC_10_1_0,// GLIBCXX_3.4.28, CXXABI_1.3.12 - same as 9.3.0 ?!
+	STDCPP_GCC_11_1_0, // GLIBCXX_3.4.29, CXXABI_1.3.13
+	STDCPP_GCC_12_1_0, // GLIBCXX_3.4.30, CXXABI_1.3.13
+	STDCPP_GCC_13_1_0, // GLIBCXX_3.4.31, CXXABI_1.3.14
+	STDCPP_GCC_13_2_0, // GLIBCXX_3.4.32, CXXABI_1.3.14
+	// TODO: add newer versions, once available (also in libstdcpp_version_checks below)
+	_NUM_STDCPP_GCC_VERSIONS
+};
+
+
+// Usually only the version names (2nd column) are used; they're matched against the
+// versions defined in the lib's .gnu.version_d. The function names are only used as
+// a fallback (with dlvsym()) if the lib has no version definitions for some reason.
+// I found the entries for this table with: objdump -T /path/to/libstdc++.so.6 | grep " DF .text" | less
+// (and then searched for GLIBCXX_3.4.5 or whatever)
+// Note that readelf does truncate the function names in output and thus is not suitable for this!
+static const struct gcc_version_check
+libstdcpp_version_checks[_NUM_STDCPP_GCC_VERSIONS] =
+{
+	{ "3.4.0", "GLIBCXX_3.4",   "_ZNSt5ctypeIwED2Ev" },
+	{ "3.4.1", "GLIBCXX_3.4.1", "_ZNSt12__basic_fileIcE4fileEv" },
+	{ "3.4.2", "GLIBCXX_3.4.2", "_ZN9__gnu_cxx17__pool_alloc_base12_M_get_mutexEv" },
+	{ "3.4.3", "GLIBCXX_3.4.3", NULL }, // FIXME: couldn't find a function with that version in libstdc++.so.6
+	{ "4.0.0", "GLIBCXX_3.4.4", "_ZN9__gnu_cxx6__poolILb0EE10_M_destroyEv" },
+	{ "4.0.1", "GLIBCXX_3.4.5", "_ZNKSs11_M_disjunctEPKc" },
+	{ "4.0.2", "GLIBCXX_3.4.6", "_ZNSt6locale5facet13_S_get_c_nameEv" },
+	// the following has a different signature for 32bit vs 64bit
+	{ "4.0.3", "GLIBCXX_3.4.7", HAVE_64_BIT ? "_ZNSt6locale5_Impl16_M_install_cacheEPKNS_5facetEm"
+	                                        : "_ZNSt6locale5_Impl16_M_install_cacheEPKNS_5facetEj" },
+	{ "4.1.1", "GLIBCXX_3.4.8", HAVE_64_BIT ? "_ZSt17__copy_streambufsIcSt11char_traitsIcEElPSt15basic_streambufIT_T0_ES6_"
+	                                        : NULL }, // FIXME: couldn't find a function for i686 ?!
+	{ "4.2.0", "GLIBCXX_3.4.9",  "_ZNSo9_M_insertIdEERSoT_" },
+	{ "4.3.0", "GLIBCXX_3.4.10", "_ZNKSt4hashISbIwSt11char_traitsIwESaIwEEEclES3_" },
+	{ "4.4.0", "GLIBCXX_3.4.11", "_ZSt16generic_categoryv" },
+	{ "4.4.1", "GLIBCXX_3.4.12", NULL }, // FIXME: couldn't find a function with that version in libstdc++.so.6
+	{ "4.4.2", "GLIBCXX_3.4.13", "_ZNSt14basic_ofstreamIcSt11char_traitsIcEEC2ERKSsSt13_Ios_Openmode" },
+	{ "4.5.0", "GLIBCXX_3.4.14", "_ZNSs13shrink_to_fitEv" },
+	{ "4.6.0", "GLIBCXX_3.4.15", "_ZNSt17bad_function_callD2Ev" },
+	{ "4.6.1", "GLIBCXX_3.4.16", HAVE_64_BIT ? "_ZNSs10_S_compareEmm" : "_ZNSs10_S_compareEjj" },
+	{ "4.7.0", "GLIBCXX_3.4.17", "_ZNSt6thread20hardware_concurrencyEv" },
+	{ "4.8.0", "GLIBCXX_3.4.18", "_ZNSt13random_device9_M_getvalEv" },
+	{ "4.8.3", "GLIBCXX_3.4.19", "_ZNSt6chrono3_V212steady_clock3nowEv" },
+	{ "4.9.0", "GLIBCXX_3.4.20", "_ZSt14get_unexpectedv" },
+	{ "5.1.0", "GLIBCXX_3.4.21", "_ZNSt13runtime_errorC1EPKc" },
+	{ "6.1.0", "GLIBCXX_3.4.22", "_ZNSt6thread6_StateD1Ev" },
+	{ "7.1.0", "GLIBCXX_3.4.23", HAVE_64_BIT ? "_ZNSsC1ERKSsmRKSaIcE" : "_ZNSsC1ERKSsjRKSaIcE" },
+	{ "7.2.0", "GLIBCXX_3.4.24", HAVE_64_BIT ? NULL // couldn't find a 64bit function with this version
+	                                         : "_ZNSbIwSt11char_traitsIwESaIwEEC2ERKS2_jRKS1_" },
+	{ "8.1.0", "GLIBCXX_3.4.25", "_ZNKSt13random_device13_M_getentropyEv" },
+	{ "9.1.0", "GLIBCXX_3.4.26", "_ZNSs4dataEv" },
+	{ "9.2.0", "GLIBCXX_3.4.27", "_ZNSt10filesystem28recursive_directory_iteratoraSERKS0_" },
+	{ "9.3.0", "GLIBCXX_3.4.28", "_ZNSt3pmr15memory_resourceD0Ev" },
+	// { "10.1.0" "GLIBCXX_3.4.28", "" }, - has same symbol version as 9.3.0
+	{ "11.1.0", "GLIBCXX_3.4.29", "_ZNSs7reserveEv" },
+	{ "12.1.0", "GLIBCXX_3.4.30", "_ZSt21__glibcxx_assert_failPKciS0_S0_" },
+	{ "13.1.0", "GLIBCXX_3.4.31", "_ZSt8to_charsPcS_DF128_" },
+	{ "13.2.0", "GLIBCXX_3.4.32", "_ZSt21ios_base_library_initv" },
+	// TODO: add new versions once available
+};
+
+// returns an enum stdcpp_gcc_version
+static int get_libstdcpp_version(const char* path)
+{
+	return get_gcc_version(path, libstdcpp_version_checks, _NUM_STDCPP_GCC_VERSIONS);
+}
+#endif // CHECK_LIBSTDCPP
+
+#ifdef CHECK_LIBGCC
+enum libgcc_version {
+	LIBGCC_OLDER = -1,
+	LIBGCC_3_0_0 = 0, // GCC_3.0
+	LIBGCC_3_3_0, // GCC_3.3
+	LIBGCC_3_3_1, // GCC_3.3.1
+	LIBGCC_3_3_2, // GCC_3.3.2 - no function with that version
+	LIBGCC_3_3_4, // GCC_3.3.4 - ditto
+	LIBGCC_3_4_0, // GCC_3.4
+	LIBGCC_3_4_2, // GCC_3.4.2
+	LIBGCC_3_4_4, // GCC_3.4.4 - no x86 function with that version
+	LIBGCC_4_0_0, // GCC_4.0.0
+	LIBGCC_4_1_0, // GCC_4.1.0 - no function with that version
+	LIBGCC_4_2_0, // GCC_4.2.0
+	LIBGCC_4_3_0, // GCC_4.3.0
+	LIBGCC_4_4_0, // GCC_4.4.0 - no x86_64 function with that version
+	LIBGCC_4_5_0, // GCC_4.5.0 - ditto
+	LIBGCC_4_6_0, // GCC_4.6.0 - no function with that version
+	LIBGCC_4_7_0, // GCC_4.7.0
+	LIBGCC_4_8_0, // GCC_4.8.0
+	// apparently no new functions were added (in x86/amd64) until 7.0.0
+	LIBGCC_7_0_0, // GCC_7.0.0
+	// apparently no new functions were added (in x86/amd64) until 12.0.0
+	LIBGCC_12_1_0, // GCC_12.0.0
+	LIBGCC_13_1_0, // GCC_13.0.0
+	// TODO: add new versions, if any
+	_NUM_LIBGCC_VERSIONS
+};
+
+static const struct gcc_version_check
+libgcc_version_checks[_NUM_LIBGCC_VERSIONS] =
+{
+	{ "3.0.0", "GCC_3.0", "__mulvsi3" },
+	{ "3.3.0", "GCC_3.3", "_Unwind_Backtrace" },
+	{ "3.3.1", "GCC_3.3.1", "__gcc_personality_v0" },
+	{ "3.3.2", "GCC_3.3.2", NULL }, // no function with this version in i686 and amd64 libgcc
+	{ "3.3.4", "GCC_3.3.4", NULL }, // ditto
+	{ "3.4.0", "GCC_3.4",   "__paritydi2" },
+	{ "3.4.2", "GCC_3.4.2", "__enable_execute_stack" },
+	{ "3.4.4", "GCC_3.4.4", HAVE_64_BIT ? "__addvti3" : NULL }, // no x86 function with that version
+	{ "4.0.0", "GCC_4.0.0", "__muldc3" },
+	{ "4.1.0", "GCC_4.1.0", NULL }, // no function for this version
+	{ "4.2.0", "GCC_4.2.0", "_Unwind_GetIPInfo" },
+	{ "4.3.0", "GCC_4.3.0", "__bswapdi2" },
+	{ "4.4.0", "GCC_4.4.0", HAVE_64_BIT ? NULL : "__letf2" }, // no 64bit function for this version
+	{ "4.5.0", "GCC_4.5.0", HAVE_64_BIT ? NULL : "__extendxftf2" }, // ditto
+	{ "4.6.0", "GCC_4.6.0", NULL }, // no function for that version at all
+	{ "4.7.0", "GCC_4.7.0", "__clrsbdi2" },
+	{ "4.8.0", "GCC_4.8.0", "__cpu_indicator_init" },
+	{ "7.0.0", "GCC_7.0.0", HAVE_64_BIT ? "__divmodti4" : "__divmoddi4" },
+	{ "12.1.0","GCC_12.0.0", "__nehf2" },
+	{ "13.1.0","GCC_13.0.0", "__truncdfbf2" },
+	// TODO: add new versions
+};
+
+// returns an enum libgcc_version
+static int get_libgcc_version(const char* path)
+{
+	return get_gcc_version(path, libgcc_version_checks, _NUM_LIBGCC_VERSIONS);
+}
+#endif // CHECK_LIBGCC
+
+
+#ifdef CHECK_LIBSDL2
+typedef struct My_SDL2_version
+{
+    unsigned char major;
+    unsigned char minor;
+    unsigned char patch; // update version, e.g. 5 in 2.0.5
+} My_SDL2_version;
+
+// SDL2 uses libtool-style versioning, so the soname symlink points to a file whose name
+// contains the version: libSDL2-2.0.so.0.A.B where A+B is the "binary age",
+// which is minor*100 + patch since 2.24.0 (e.g. libSDL2-2.0.so.0.2800.5 for 2.28.5)
+// and just the patch version before (e.g. libSDL2-2.0.so.0.18.2 for 2.0.20)
+// returns 1 if the version could be determined like this
+static int get_libsdl2_version_from_filename(const char* path, My_SDL2_version* ver)
+{
+	char real_path[PATH_MAX];
+	if(realpath(path, real_path) == NULL)  return 0;
+
+	const char* prefix = "libSDL2-2.0.so.0.";
+	const char* name = strrchr(real_path, '/');
+	name = (name != NULL) ? name+1 : real_path;
+	if(strncmp(name, prefix, strlen(prefix)) != 0)  return 0;
+
+	char* end;
+	const char* age_str = name + strlen(prefix);
+	unsigned long age = strtoul(age_str, &end, 10);
+	if(end == age_str || *end != '.')  return 0;
+	const char* rev_str = end+1;
+	unsigned long revision = strtoul(rev_str, &end, 10);
+	if(end == rev_str || *end != '\0')  return 0;
+
+	unsigned long binary_age = age + revision;
+	ver->major = 2;
+	ver->minor = (binary_age >= 100) ? binary_age / 100 : 0;
+	ver->patch = binary_age % 100;
+	return 1;
+}
+
+// SDL_GetVersion() just stores constants into the passed struct, so on x86 and x86_64
+// the version can be read from the instructions at the start of the function:
+// it's either stored bytewise with "movb $imm, N(reg)", major and minor together
+// with "movw $imm, (reg)" or (x86_64) major and minor are loaded from .rodata with
+// "movzwl disp(%rip), %eXX" and then stored with "movw %XX, (reg)"; the patch version
+// is always stored with "movb $patch, 2(reg)".
+// returns 1 if the version could be determined like this
+static int get_libsdl2_version_from_code(const char* path, My_SDL2_version* ver)
+{
+#if defined(__i386__) || defined(__x86_64__)
+	struct elf_file ef;
+	if(!elf_open(path, &ef))  return 0;
+
+	const ElfW(Sym)* sym = elf_lookup_symbol(&ef, "SDL_GetVersion");
+	// only look at the first few instructions (copied to a zero-padded buffer, so
+	// decoding can't read past the end)
+	unsigned char code_buf[96 + 8] = {0};
+	size_t code_len = (sym != NULL && sym->st_size > 0 && sym->st_size < 96) ? sym->st_size : 96;
+	const unsigned char* code = (sym != NULL) ? elf_vaddr_to_ptr(&ef, sym->st_value, code_len) : NULL;
+	if(code != NULL)
+	{
+		memcpy(code_buf, code, code_len);
+		code = code_buf;
+	}
+
+	int base_reg = -1; // the register holding the SDL_version* argument
+	int bytes[3] = { -1, -1, -1 }; // major, minor, patch
+	int rodata_val = -1; // loaded with movzwl from .rodata
+	for(size_t i=0; code != NULL && i < code_len; ++i)
+	{
+		const unsigned char* c = code + i;
+		int mod = c[1] >> 6, rm = c[1] & 7;
+		if(c[0] == 0x0f && c[1] == 0xb7 && (c[2] & 0xc7) == 0x05 && HAVE_64_BIT)
+		{
+			// movzwl disp32(%rip), %eXX - disp32 is relative to the next instruction
+			int32_t disp;
+			memcpy(&disp, c+3, sizeof(disp));
+			const unsigned char* val = elf_vaddr_to_ptr(&ef, sym->st_value + i + 7 + disp, 2);
+			if(val != NULL)  rodata_val = val[0] | (val[1] << 8);
+			i += 6;
+			continue;
+		}
+		if(c[0] == 0x66 && (c[1] == 0xc7 || c[1] == 0x89))
+		{
+			// movw $imm16, (reg) or movw %XX, (reg)
+			int mod16 = c[2] >> 6, rm16 = c[2] & 7;
+			if(mod16 == 0 && rm16 != 4 && rm16 != 5 && (base_reg < 0 || base_reg == rm16))
+			{
+				int val = (c[1] == 0xc7) ? (c[3] | (c[4] << 8)) : rodata_val;
+				if(val >= 0)
+				{
+					base_reg = rm16;
+					bytes[0] = val & 0xff;
+					bytes[1] = val >> 8;
+				}
+				i += (c[1] == 0xc7) ? 4 : 2;
+			}
+			continue;
+		}
+		if(c[0] == 0xc6 && rm != 4 && (base_reg < 0 || base_reg == rm))
+		{
+			// movb $imm8, (reg) or movb $imm8, disp8(reg)
+			if(mod == 0 && rm != 5)
+			{
+				base_reg = rm;
+				bytes[0] = c[2];
+				i += 2;
+			}
+			else if(mod == 1 && c[2] <= 2)
+			{
+				base_reg = rm;
+				bytes[c[2]] = c[3];
+				i += 3;
+			}
+		}
+		if(bytes[0] >= 0 && bytes[1] >= 0 && bytes[2] >= 0)  break;
+	}
+	elf_close(&ef);
+
+	if(bytes[0] != 2 || bytes[1] < 0 || bytes[2] < 0)  return 0;
+	ver->major = bytes[0];
+	ver->minor = bytes[1];
+	ver->patch = bytes[2];
+	return 1;
+#else
+	(void)path;
+	(void)ver;
+	return 0;
+#endif
+}
+
+static My_SDL2_version get_libsdl2_version(const char* path)
+{
+	My_SDL2_version ret = {0};
+
+	// try to avoid loading SDL2, as that loads all its dependencies and runs their constructors
+	if(get_libsdl2_version_from_filename(path, &ret))
+	{
+		dprintf("Got SDL2 version of %s from its file name\n", path);
+		return ret;
+	}
+	if(get_libsdl2_version_from_code(path, &ret))
+	{
+		dprintf("Got SDL2 version of %s from SDL_GetVersion() code\n", path);
+		return ret;
+	}
+
+#ifdef NO_DLOPEN
+	eprintf("Couldn't get the SDL2 version of %s without dlopen()ing it\n", path);
+#else
+	void* handle = dlopen(path, RTLD_LAZY);
+	if(handle == NULL)
+	{
+		dprintf("couldn't dlopen() %s : %s\n", path, dlerror());
+		return ret;
+	}
+
+	void (*sdl_getversion)(My_SDL2_version* ver);
+
+	sdl_getversion = dlsym(handle, "SDL_GetVersion");
+	if(sdl_getversion == NULL)
+	{
+		eprintf("Couldn't find SDL_GetVersion() in %s !\n", path);
+	}
+	else
+	{
+		sdl_getversion(&ret);
+		dprintf("Got SDL2 version of %s by calling SDL_GetVersion()\n", path);
+	}
+
+	dlclose(handle);
+#endif // NO_DLOPEN
+	return ret;
+}
+
+#define SDL2_VERSION_PACK(v) (((int)(v).major << 16) | ((int)(v).minor << 8) | (int)(v).patch)
+#define SDL2_VERSION_MAJOR(packed) (((packed) >> 16) & 0xff)
+#define SDL2_VERSION_MINOR(packed) (((packed) >> 8) & 0xff)
+#define SDL2_VERSION_PATCH(packed) ((packed) & 0xff)
+
+// returns the version packed into an int (see SDL2_VERSION_PACK()), -1 if it wasn't found
+static int get_libsdl2_version_packed(const char* path)
+{
+	My_SDL2_version ver = get_libsdl2_version(path);
+	return (ver.major != 0) ? SDL2_VERSION_PACK(ver) : -1;
+}
+#endif // CHECK_LIBSDL2
+
+
+
+// directory the wrapper executable is in, *without* trailing slash
+static char wrapper_exe_dir[PATH_MAX] = {0};
+
+// returns 1 after successfully setting wrapper_exe_dir to the directory this wrapper is in,
+// otherwise it returns 0
+static int set_wrapper_dir(void)
+{
+	{
+		// taken from https://github.com/DanielGibson/Snippets/blob/master/DG_misc.h
+	#if defined(__linux)
+		// readlink() doesn't null-terminate!
+		int len = readlink("/proc/self/exe", wrapper_exe_dir, PATH_MAX-1);
+		if (len <= 0)
+		{
+			// an error occured, clear exe path
+			wrapper_exe_dir[0] = '\0';
+		}
+		else
+		{
+			wrapper_exe_dir[len] = '\0';
+		}
+	#elif defined(__FreeBSD__) // TODO: really keep this?
+		// the sysctl should also work when /proc/ is not mounted (which seems to
+		// be common on FreeBSD), so use it..
+		int name[4] = {CTL_KERN, KERN_PROC, KERN_PROC_PATHNAME, -1};
+		size_t len = PATH_MAX-1;
+		int ret = sysctl(name, sizeof(name)/sizeof(name[0]), wrapper_exe_dir, &len, NULL, 0);
+		if(ret != 0)
+		{
+			// an error occured, clear exe path
+			wrapper_exe_dir[0] = '\0';
+		}
+	#else
+		error "Unsupported Platform!" // not sure how useful this even is on other platforms
+	#endif
+	}
+
+	if(wrapper_exe_dir[0] != '\0')
+	{
+		// find the last slash before the executable name and set it to '\0'
+		// so wrapper_exe_dir contains the full path of the directory the executable is in
+		// then change to that directory
+		char* lastSlash = strrchr(wrapper_exe_dir, '/');
+		if(lastSlash != NULL)
+		{
+			*lastSlash = '\0';
+
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// returns 1 after successfully changing to the directory this executable is in,
+// otherwise it returns 0
+static int change_to_wrapper_dir(void)
+{
+	return chdir(wrapper_exe_dir) == 0;
+}
+
+// appended to APP_EXECUTABLE, e.g. ".x86-64-v3" if select_isa_variants() chose that build
+static char app_exe_suffix[16] = {0};
+
+// writes the full path of APP_EXECUTABLE to out (PATH_MAX bytes)
+static int get_app_exe_path(char* out)
+{
+	int len = snprintf(out, PATH_MAX, "%s/%s%s", wrapper_exe_dir, APP_EXECUTABLE, app_exe_suffix);
+	if(len <= 0 || len >= PATH_MAX)
+	{
+		eprintf("ERROR: Couldn't create full path to executable, snprintf() returned %d\n", len);
+		return 0;
+	}
+	return 1;
+}
+
+struct fallback_lib {
+	const char* name;
+	const char* dir;
+	// returns the version of the lib at the given path or -1 if it's not found;
+	// NULL if only the existence of the lib on the system matters
+	int (*get_version)(const char* path);
+	int use; // set by check_fallback_libs()
+	const char* hwcaps; // glibc-hwcaps subdir of dir to use (e.g. "x86-64-v3"), set by select_isa_variants()
+	int preload; // if set, the lib is preloaded (LD_PRELOAD) instead of being added to LD_LIBRARY_PATH
+	char* extracted_path; // where the compressed bundled lib was extracted to, set by extract_used_compressed_libs()
+};
+
+static struct fallback_lib fallback_libs[] = {
+#ifdef CHECK_LIBSTDCPP
+	{ "libstdc++.so.6", FALLBACK_DIR_STDCPP, get_libstdcpp_version, 0, NULL, 0, NULL },
+#endif
+#ifdef CHECK_LIBGCC
+	{ "libgcc_s.so.1", FALLBACK_DIR_GCC, get_libgcc_version, 0, NULL, 0, NULL },
+#endif
+#ifdef CHECK_LIBSDL2
+	{ "libSDL2-2.0.so.0", FALLBACK_DIR_SDL2, get_libsdl2_version_packed, 0, NULL, 0, NULL },
+#endif
+#ifdef CHECK_LIBCURL4
+	{ "libcurl.so.4", FALLBACK_DIR_CURL, NULL, 0, NULL, 0, NULL },
+#endif
+#ifdef PRELOAD_ALLOCATOR
+	{ PRELOAD_ALLOCATOR, FALLBACK_DIR_ALLOC, NULL, 0, NULL, 1, NULL },
+#endif
+};
+
+enum { NUM_FALLBACK_LIBS = sizeof(fallback_libs)/sizeof(fallback_libs[0]) };
+
+#ifdef USE_LAUNCH_CACHE
+// all files (and directories) whose identity influenced the decisions of check_fallback_libs(),
+// see record_probed_file()
+#ifdef VERIFY_LOAD_GRAPH
+#define MAX_PROBED_FILES 512 // all libs of the verified load graph are recorded as well
+#else
+#define MAX_PROBED_FILES 64
+#endif
+static char* probed_files[MAX_PROBED_FILES];
+static int num_probed_files = 0;
+static int probed_files_incomplete = 0; // if set, the launch cache can't be written
+#endif
+
+// remembers path so the launch cache gets invalidated if that file is changed,
+// replaced, created or deleted
+static void record_probed_file(const char* path)
+{
+#ifdef USE_LAUNCH_CACHE
+	if(num_probed_files < MAX_PROBED_FILES && (probed_files[num_probed_files] = strdup(path)) != NULL)
+	{
+		++num_probed_files;
+	}
+	else
+	{
+		probed_files_incomplete = 1;
+	}
+#else
+	(void)path;
+#endif
+}
+
+// results of probing the system's and the bundled version of a fallback lib
+struct lib_probe
+{
+	int done; // 0 if the probe timed out or crashed (only with PARALLEL_PROBES), see probe_failed()
+	int sys_found;
+	int sys_ver;
+	int our_ver;
+	char sys_path[PATH_MAX]; // "" if not found on the system
+	char local_path[PATH_MAX]; // absolute path to the bundled version
+#ifdef COMPRESSED_LIBS
+	char compressed_path[PATH_MAX]; // path of the compressed bundled version, "" if it's not compressed
+#endif
+};
+
+// writes the absolute path of the bundled version of lib to out (PATH_MAX bytes)
+static int get_bundled_lib_path(const struct fallback_lib* lib, char* out)
+{
+	int len;
+	if(lib->extracted_path != NULL)
+		len = snprintf(out, PATH_MAX, "%s", lib->extracted_path);
+	else if(lib->hwcaps != NULL)
+		len = snprintf(out, PATH_MAX, "%s/%s/glibc-hwcaps/%s/%s", wrapper_exe_dir, lib->dir, lib->hwcaps, lib->name);
+	else
+		len = snprintf(out, PATH_MAX, "%s/%s/%s", wrapper_exe_dir, lib->dir, lib->name);
+	return len > 0 && len < PATH_MAX;
+}
+
+#if defined(BUNDLED_LIBS_MANIFEST) || defined(COMPRESSED_LIBS)
+// the glibc-hwcaps subdirectories in which the packaging helpers (WRAPPER_WRITE_MANIFEST and
+// WRAPPER_COMPRESS_LIBS) look for builds of each bundled lib, NULL is the baseline build
+static const char* const bundled_lib_hwcaps[] = {
+	NULL,
+#ifdef SELECT_ISA_VARIANTS
+	"x86-64-v2", "x86-64-v3", "x86-64-v4",
+#endif
+};
+
+enum { NUM_BUNDLED_LIB_HWCAPS = sizeof(bundled_lib_hwcaps)/sizeof(bundled_lib_hwcaps[0]) };
+#endif
+
+#ifdef COMPRESSED_LIBS
+#define COMPRESSED_LIB_SUFFIX ".lz4"
+
+// writes the path of the compressed version of lib (see COMPRESSED_LIBS) to out (PATH_MAX bytes)
+static int get_compressed_lib_path(const struct fallback_lib* lib, char* out)
+{
+	struct fallback_lib not_extracted = *lib;
+	not_extracted.extracted_path = NULL;
+	char path[PATH_MAX];
+	if(!get_bundled_lib_path(&not_extracted, path))  return 0;
+	int len = snprintf(out, PATH_MAX, "%s%s", path, COMPRESSED_LIB_SUFFIX);
+	return len > 0 && len < PATH_MAX;
+}
+#endif
+
+#ifdef SELECT_ISA_VARIANTS
+// picks the best builds of the app and the bundled libs for isa_level (if there are any)
+static void select_isa_variants(void)
+{
+	char path[PATH_MAX];
+	for(int i=0; isa_hwcaps[i] != NULL; ++i)
+	{
+		int len = snprintf(path, sizeof(path), "%s/%s.%s", wrapper_exe_dir, APP_EXECUTABLE, isa_hwcaps[i]);
+		if(len > 0 && len < sizeof(path) && access(path, X_OK) == 0)
+		{
+			snprintf(app_exe_suffix, sizeof(app_exe_suffix), ".%s", isa_hwcaps[i]);
+			break;
+		}
+	}
+	dprintf("Will launch %s%s\n", APP_EXECUTABLE, app_exe_suffix);
+
+	for(int l=0; l < NUM_FALLBACK_LIBS; ++l)
+	{
+		struct fallback_lib* lib = &fallback_libs[l];
+		for(int i=0; isa_hwcaps[i] != NULL; ++i)
+		{
+			lib->hwcaps = isa_hwcaps[i];
+			int found = get_bundled_lib_path(lib, path) && is_compatible_elf(path);
+		#ifdef COMPRESSED_LIBS
+			if(!found && get_compressed_lib_path(lib, path))  found = (access(path, R_OK) == 0);
+		#endif
+			if(found)
+			{
+				dprintf("Using bundled %s from %s\n", lib->name, path);
+				break;
+			}
+			lib->hwcaps = NULL;
+		}
+	}
+}
+#endif // SELECT_ISA_VARIANTS
+
+#if defined(USE_LAUNCH_CACHE) || defined(SUPERVISE_APP) || defined(COMPRESSED_LIBS)
+// writes $XDG_CACHE_HOME/linux-app-wrapper (or ~/.cache/linux-app-wrapper) to dir (PATH_MAX bytes)
+static int get_wrapper_cache_dir(char* dir, int create_dir)
+{
+	const char* xdg_cache = getenv("XDG_CACHE_HOME");
+	const char* home = getenv("HOME");
+	int len;
+	if(xdg_cache != NULL && xdg_cache[0] == '/')
+		len = snprintf(dir, PATH_MAX, "%s", xdg_cache);
+	else if(home != NULL && home[0] == '/')
+		len = snprintf(dir, PATH_MAX, "%s/.cache", home);
+	else
+		return 0;
+
+	if(len <= 0 || len >= PATH_MAX - 64)  return 0;
+
+	if(create_dir)  mkdir(dir, 0700); // ~/.cache may not exist yet
+	strcat(dir, "/linux-app-wrapper");
+	if(create_dir && mkdir(dir, 0700) != 0 && errno != EEXIST)  return 0;
+	return 1;
+}
+#endif
+
+#if defined(BUNDLED_LIBS_MANIFEST) || defined(COMPRESSED_LIBS)
+// the versions of libstdc++ and libgcc are indices into the version tables, so the manifest
+// (and the versions in compressed libs) are only valid for a wrapper with the same tables
+// (and the same encoding of versions newer than them, see GCC_NEWER_VERSION());
+// this identifies them
+static uint64_t get_manifest_tables_id(void)
+{
+	uint64_t hash = FNV1A_64_INIT;
+	hash = fnv1a_64(hash, "newer:packed", strlen("newer:packed") + 1);
+#ifdef CHECK_LIBSTDCPP
+	for(int i=0; i < _NUM_STDCPP_GCC_VERSIONS; ++i)
+	{
+		hash = fnv1a_64(hash, libstdcpp_version_checks[i].fn_version, strlen(libstdcpp_version_checks[i].fn_version) + 1);
+	}
+#endif
+#ifdef CHECK_LIBGCC
+	for(int i=0; i < _NUM_LIBGCC_VERSIONS; ++i)
+	{
+		hash = fnv1a_64(hash, libgcc_version_checks[i].fn_version, strlen(libgcc_version_checks[i].fn_version) + 1);
+	}
+#endif
+	return hash;
+}
+#endif
+
+#ifdef BUNDLED_LIBS_MANIFEST
+// The manifest is a text file with one line per bundled lib:
+// "<path> <version> <size> <mtime> <hash>" (after a line identifying the version tables,
+// see get_manifest_tables_id()), the path is relative to the wrapper's directory, so with
+// SELECT_ISA_VARIANTS there's a line for each glibc-hwcaps build (if they're bundled)
+// and the wrapper uses the one of the build it selected. The version is the one returned by
+// fallback_libs[].get_version() (or 0 for libs that are only checked for existence),
+// the hash is a 64bit FNV-1a hash of the lib's content (in hex), so installers or
+// support scripts can verify the bundled libs; the wrapper itself only compares
+// size and mtime to decide whether an entry is still valid.
+struct manifest_entry
+{
+	int valid; // set if the entry exists and size and mtime still match
+	int version;
+};
+
+static struct manifest_entry bundled_manifest[NUM_FALLBACK_LIBS];
+
+static int get_manifest_path(char* out)
+{
+	int len = snprintf(out, PATH_MAX, "%s/%s", wrapper_exe_dir, BUNDLED_LIBS_MANIFEST);
+	return len > 0 && len < PATH_MAX;
+}
+
+// writes the path of the bundled version of lib relative to the wrapper's directory to out
+// (PATH_MAX bytes), that's how it's identified in the manifest
+static int get_manifest_lib_key(const struct fallback_lib* lib, char* out)
+{
+	int len;
+	if(lib->hwcaps != NULL)
+		len = snprintf(out, PATH_MAX, "%s/glibc-hwcaps/%s/%s", lib->dir, lib->hwcaps, lib->name);
+	else
+		len = snprintf(out, PATH_MAX, "%s/%s", lib->dir, lib->name);
+	return len > 0 && len < PATH_MAX;
+}
+
+static uint64_t hash_file(const char* path, int* ok)
+{
+	uint64_t hash = FNV1A_64_INIT;
+	*ok = 0;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0)  return hash;
+
+	char buf[65536];
+	ssize_t r;
+	while((r = read(fd, buf, sizeof(buf))) > 0 || (r < 0 && errno == EINTR))
+	{
+		if(r > 0)  hash = fnv1a_64(hash, buf, r);
+	}
+	*ok = (r == 0);
+	close(fd);
+	return hash;
+}
+
+static void read_bundled_manifest(void)
+{
+	char path[PATH_MAX];
+	FILE* f = get_manifest_path(path) ? fopen(path, "r") : NULL;
+	if(f == NULL)  return;
+
+	char line[1280];
+	int tables_ok = 0;
+	while(fgets(line, sizeof(line), f) != NULL)
+	{
+		char name[1024];
+		int version;
+		unsigned long long size, hash;
+		long long mtime;
+		if(sscanf(line, "tables %llx", &hash) == 1)
+		{
+			tables_ok = (hash == get_manifest_tables_id());
+			if(!tables_ok)  dprintf("%s was written by a different version of the wrapper, ignoring it\n", path);
+			continue;
+		}
+		if(!tables_ok || line[0] == '#' || sscanf(line, "%1023s %d %llu %lld %llx", name, &version, &size, &mtime, &hash) != 5)
+			continue;
+
+		for(int i=0; i < NUM_FALLBACK_LIBS; ++i)
+		{
+			char key[PATH_MAX], lib_path[PATH_MAX];
+			struct stat st;
+			if(!get_manifest_lib_key(&fallback_libs[i], key) || strcmp(key, name) != 0
+			   || !get_bundled_lib_path(&fallback_libs[i], lib_path))
+				continue;
+
+			if(version < 0) // the lib wasn't bundled when the manifest was written
+			{
+				bundled_manifest[i].valid = (stat(lib_path, &st) != 0);
+			}
+			else
+			{
+				bundled_manifest[i].valid = stat(lib_path, &st) == 0 && (unsigned long long)st.st_size == size
+				                            && (long long)st.st_mtime == mtime;
+			}
+			bundled_manifest[i].version = version;
+			if(!bundled_manifest[i].valid)
+			{
+				dprintf("Manifest entry for bundled %s is outdated, will check it\n", name);
+			}
+		}
+	}
+	fclose(f);
+}
+
+// writes the manifest for the bundled libs, returns 1 on success
+static int write_bundled_manifest(void)
+{
+	char path[PATH_MAX], tmp_path[PATH_MAX + 16];
+	if(!get_manifest_path(path))  return 0;
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	FILE* f = fopen(tmp_path, "w");
+	if(f == NULL)
+	{
+		int e = errno;
+		eprintf("Couldn't create %s : errno %d (%s)\n", tmp_path, e, strerror(e));
+		return 0;
+	}
+
+	fprintf(f, "# versions of the bundled libs, generated by running the wrapper with WRAPPER_WRITE_MANIFEST=1\n");
+	fprintf(f, "tables %016llx\n", (unsigned long long)get_manifest_tables_id());
+	fprintf(f, "# path version size mtime hash\n");
+	for(int i=0; i < NUM_FALLBACK_LIBS * NUM_BUNDLED_LIB_HWCAPS; ++i)
+	{
+		struct fallback_lib lib = fallback_libs[i / NUM_BUNDLED_LIB_HWCAPS];
+		lib.hwcaps = bundled_lib_hwcaps[i % NUM_BUNDLED_LIB_HWCAPS];
+		lib.extracted_path = NULL;
+		char key[PATH_MAX], lib_path[PATH_MAX];
+		struct stat st;
+		int version = -1, hash_ok = 0;
+		uint64_t hash = 0;
+		if(!get_manifest_lib_key(&lib, key))  continue;
+		if(get_bundled_lib_path(&lib, lib_path) && stat(lib_path, &st) == 0)
+		{
+			version = (lib.get_version != NULL) ? lib.get_version(lib_path) : 0;
+			hash = hash_file(lib_path, &hash_ok);
+		}
+		if(version < 0 || !hash_ok)
+		{
+			// the glibc-hwcaps builds are optional, only the baseline one is recorded as missing
+			if(lib.hwcaps != NULL)  continue;
+			printf("Bundled %s not found\n", key);
+			memset(&st, 0, sizeof(st));
+			version = -1;
+		}
+		else
+		{
+			printf("Bundled %s: version %d, hash %016llx\n", key, version, (unsigned long long)hash);
+		}
+		fprintf(f, "%s %d %llu %lld %016llx\n", key, version, (unsigned long long)st.st_size,
+		        (long long)st.st_mtime, (unsigned long long)hash);
+	}
+
+	if(fclose(f) != 0 || rename(tmp_path, path) != 0)
+	{
+		int e = errno;
+		eprintf("Couldn't write %s : errno %d (%s)\n", path, e, strerror(e));
+		unlink(tmp_path);
+		return 0;
+	}
+	printf("Wrote %s\n", path);
+	return 1;
+}
+#endif // BUNDLED_LIBS_MANIFEST
+
+#ifdef COMPRESSED_LIBS
+// A compressed bundled lib is "<name>.lz4" (e.g. "libs/stdcpp/libstdc++.so.6.lz4"),
+// written by running the wrapper with WRAPPER_COMPRESS_LIBS=1: this header followed by the
+// lib as a single LZ4 block. The header has the version, so the bundled side of the check
+// doesn't need to decompress it; only libs that will be used are extracted (once) to
+// $XDG_CACHE_HOME/linux-app-wrapper/libs/<hash>/<name> (or $XDG_RUNTIME_DIR/linux-app-wrapper/...)
+#define COMPRESSED_LIB_MAGIC "WRPLZ4\x00\x01"
+
+struct compressed_lib_header
+{
+	char magic[8];
+	char name[64];            // soname of the lib, like fallback_libs[].name
+	int32_t version;          // what fallback_libs[].get_version() returned for it (0 if not checked)
+	uint32_t reserved;
+	uint64_t tables_id;       // see get_manifest_tables_id()
+	uint64_t size;            // of the uncompressed lib
+	uint64_t compressed_size; // of the LZ4 block after the header
+	uint64_t hash;            // FNV-1a hash of the uncompressed lib, also names the extraction dir
+};
+
+// decompresses an LZ4 block of src_len bytes to dst, returns 1 if it was valid
+// and decompressed to exactly dst_len bytes
+static int lz4_decompress(const uint8_t* src, size_t src_len, uint8_t* dst, size_t dst_len)
+{
+	const uint8_t* ip = src;
+	const uint8_t* const iend = src + src_len;
+	uint8_t* op = dst;
+	uint8_t* const oend = dst + dst_len;
+
+	while(ip < iend)
+	{
+		unsigned token = *ip++;
+		size_t len = token >> 4;
+		if(len == 15)
+		{
+			unsigned b;
+			do {
+				if(ip >= iend)  return 0;
+				b = *ip++;
+				len += b;
+			} while(b == 255);
+		}
+		if(len > (size_t)(iend - ip) || len > (size_t)(oend - op))  return 0;
+		memcpy(op, ip, len);
+		op += len;
+		ip += len;
+		if(ip == iend)  break; // the last sequence only has literals
+
+		if(iend - ip < 2)  return 0;
+		size_t offset = ip[0] | ((size_t)ip[1] << 8);
+		ip += 2;
+		if(offset == 0 || offset > (size_t)(op - dst))  return 0;
+
+		len = token & 15;
+		if(len == 15)
+		{
+			unsigned b;
+			do {
+				if(ip >= iend)  return 0;
+				b = *ip++;
+				len += b;
+			} while(b == 255);
+		}
+		len += 4; // minimum match length
+		if(len > (size_t)(oend - op))  return 0;
+
+		// the match can overlap the output, so copy byte by byte
+		const uint8_t* match = op - offset;
+		while(len-- > 0)  *op++ = *match++;
+	}
+	return op == oend;
+}
+
+static uint8_t* lz4_put_length(uint8_t* op, size_t len)
+{
+	for(; len >= 255; len -= 255)  *op++ = 255;
+	*op++ = (uint8_t)len;
+	return op;
+}
+
+// appends a sequence of literals and a match (of match_len bytes at offset, no match if match_len is 0)
+static uint8_t* lz4_put_sequence(uint8_t* op, const uint8_t* literals, size_t num_literals, size_t offset, size_t match_len)
+{
+	size_t ml = (match_len > 0) ? match_len - 4 : 0;
+	*op++ = (uint8_t)(((num_literals < 15) ? num_literals : 15) << 4 | ((ml < 15) ? ml : 15));
+	if(num_literals >= 15)  op = lz4_put_length(op, num_literals - 15);
+	memcpy(op, literals, num_literals);
+	op += num_literals;
+	if(match_len > 0)
+	{
+		*op++ = (uint8_t)(offset & 0xff);
+		*op++ = (uint8_t)(offset >> 8);
+		if(ml >= 15)  op = lz4_put_length(op, ml - 15);
+	}
+	return op;
+}
+
+// compresses src to an LZ4 block in dst, which must have room for lz4_compress_bound(src_len) bytes.
+// returns the compressed size or 0 if malloc() failed. This is a simple greedy compressor
+// (it only runs when packaging), the format is what matters for the decompressor.
+static size_t lz4_compress_bound(size_t src_len)
+{
+	return src_len + src_len / 255 + 16;
+}
+
+static size_t lz4_compress(const uint8_t* src, size_t src_len, uint8_t* dst)
+{
+	enum { HASH_BITS = 16, MIN_MATCH = 4, LAST_LITERALS = 5, MATCH_LIMIT = 12, MAX_OFFSET = 65535 };
+	uint32_t* table = calloc(1 << HASH_BITS, sizeof(uint32_t)); // positions + 1, 0 means none
+	if(table == NULL)  return 0;
+
+	uint8_t* op = dst;
+	size_t pos = 0, anchor = 0;
+	// the format requires the last match to start at least MATCH_LIMIT bytes
+	// before the end and the last LAST_LITERALS bytes to be literals
+	while(src_len > MATCH_LIMIT && pos < src_len - MATCH_LIMIT)
+	{
+		uint32_t seq;
+		memcpy(&seq, src + pos, sizeof(seq));
+		uint32_t h = (seq * 2654435761u) >> (32 - HASH_BITS);
+		size_t ref = table[h];
+		table[h] = (uint32_t)(pos + 1);
+		if(ref == 0 || pos - (ref - 1) > MAX_OFFSET || memcmp(src + ref - 1, src + pos, MIN_MATCH) != 0)
+		{
+			++pos;
+			continue;
+		}
+		--ref;
+
+		size_t len = MIN_MATCH;
+		while(pos + len < src_len - LAST_LITERALS && src[ref + len] == src[pos + len])  ++len;
+
+		op = lz4_put_sequence(op, src + anchor, pos - anchor, pos - ref, len);
+		pos += len;
+		anchor = pos;
+	}
+	op = lz4_put_sequence(op, src + anchor, src_len - anchor, 0, 0);
+
+	free(table);
+	return op - dst;
+}
+
+// returns 1 if path is a compressed version of lib with a usable header
+static int read_compressed_lib_header(const char* path, const struct fallback_lib* lib, struct compressed_lib_header* hdr)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0)  return 0;
+	int ok = read(fd, hdr, sizeof(*hdr)) == sizeof(*hdr);
+	close(fd);
+	if(!ok || memcmp(hdr->magic, COMPRESSED_LIB_MAGIC, sizeof(hdr->magic)) != 0
+	   || memchr(hdr->name, '\0', sizeof(hdr->name)) == NULL || strcmp(hdr->name, lib->name) != 0
+	   || hdr->size == 0 || hdr->size > (1ULL << 31) || hdr->compressed_size > lz4_compress_bound(hdr->size))
+	{
+		dprintf("%s is not a valid compressed %s\n", path, lib->name);
+		return 0;
+	}
+	return 1;
+}
+
+// creates the directory the lib with the given hash is extracted to, returns 1 on success
+static int get_extraction_dir(uint64_t hash, char* dir)
+{
+	int have_dir = get_wrapper_cache_dir(dir, 1);
+	if(!have_dir)
+	{
+		// e.g. a read-only home, then use the (tmpfs) runtime dir, which is only for this user
+		const char* runtime_dir = getenv("XDG_RUNTIME_DIR");
+		int len = (runtime_dir != NULL && runtime_dir[0] == '/')
+		          ? snprintf(dir, PATH_MAX, "%s/linux-app-wrapper", runtime_dir) : 0;
+		have_dir = len > 0 && len < PATH_MAX - 64 && (mkdir(dir, 0700) == 0 || errno == EEXIST);
+	}
+	if(!have_dir)  return 0;
+
+	size_t len = strlen(dir);
+	strcat(dir, "/libs");
+	if(mkdir(dir, 0700) != 0 && errno != EEXIST)  return 0;
+	snprintf(dir + len + 5, PATH_MAX - len - 5, "/%016llx", (unsigned long long)hash);
+	return mkdir(dir, 0700) == 0 || errno == EEXIST;
+}
+
+// extracts the compressed lib at path (unless that was already done), writes the path
+// of the extracted lib to out (PATH_MAX bytes). returns 1 on success
+static int extract_compressed_lib(const char* path, const struct compressed_lib_header* hdr, char* out)
+{
+	char dir[PATH_MAX];
+	struct stat st;
+	if(!get_extraction_dir(hdr->hash, dir))  return 0;
+	int len = snprintf(out, PATH_MAX, "%s/%s", dir, hdr->name);
+	if(len <= 0 || len >= PATH_MAX)  return 0;
+	// it's written to a temporary file and then renamed, so if it exists, it's complete
+	if(stat(out, &st) == 0 && (uint64_t)st.st_size == hdr->size)  return 1;
+
+	int64_t start = trace_now();
+	int ok = 0;
+	uint8_t* data = malloc(hdr->size);
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	void* map = (fd >= 0 && fstat(fd, &st) == 0 && (uint64_t)st.st_size == sizeof(*hdr) + hdr->compressed_size)
+	            ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	if(fd >= 0)  close(fd);
+	if(data != NULL && map != MAP_FAILED
+	   && lz4_decompress((const uint8_t*)map + sizeof(*hdr), hdr->compressed_size, data, hdr->size)
+	   && fnv1a_64(FNV1A_64_INIT, data, hdr->size) == hdr->hash)
+	{
+		char tmp_path[PATH_MAX + 32];
+		snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", out, (int)getpid());
+		int out_fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0755);
+		if(out_fd >= 0)
+		{
+			ok = (write(out_fd, data, hdr->size) == (ssize_t)hdr->size);
+			ok = (close(out_fd) == 0) && ok;
+			ok = ok && rename(tmp_path, out) == 0;
+			if(!ok)  unlink(tmp_path);
+		}
+	}
+	else
+	{
+		eprintf("Couldn't decompress %s (it's corrupted or we're out of memory)\n", path);
+	}
+	if(map != MAP_FAILED)  munmap(map, st.st_size);
+	free(data);
+
+	if(ok)
+	{
+		dprintf("Extracted %s to %s\n", path, out);
+		trace_arg_str(trace_add("extract_compressed_lib", 'X', start), "lib", hdr->name);
+	}
+	return ok;
+}
+
+// if the bundled lib is compressed, sets probe->compressed_path and probe->our_ver (from
+// the header, if possible; otherwise it's extracted to probe->local_path and checked)
+// and returns 1, returns 0 if it isn't compressed
+static int probe_compressed_lib(const struct fallback_lib* lib, struct lib_probe* probe)
+{
+	struct compressed_lib_header hdr;
+	probe->compressed_path[0] = '\0';
+	if(access(probe->local_path, F_OK) == 0 || !get_compressed_lib_path(lib, probe->compressed_path)
+	   || access(probe->compressed_path, F_OK) != 0)
+	{
+		probe->compressed_path[0] = '\0';
+		return 0;
+	}
+	if(!read_compressed_lib_header(probe->compressed_path, lib, &hdr))
+	{
+		probe->our_ver = -1;
+		return 1;
+	}
+
+	// the file itself is needed to check which symbol versions the bundled lib needs
+	// or if the allocator works, and if the version is an index into different tables
+	int need_file = lib->preload || (lib->get_version != NULL && hdr.tables_id != get_manifest_tables_id());
+#ifdef OVERRIDE_ONLY_IF_REQUIRED
+	need_file = 1;
+#endif
+	if(!need_file)
+	{
+		probe->our_ver = hdr.version;
+	}
+	else if(extract_compressed_lib(probe->compressed_path, &hdr, probe->local_path))
+	{
+		probe->our_ver = (lib->get_version != NULL) ? lib->get_version(probe->local_path) : 0;
+	}
+	else
+	{
+		probe->our_ver = -1;
+	}
+	return 1;
+}
+
+// extracts the compressed bundled libs that will be used and sets their extracted_path,
+// if that fails, the system's version of the lib is used
+static void extract_used_compressed_libs(void)
+{
+	for(int i=0; i < NUM_FALLBACK_LIBS; ++i)
+	{
+		struct fallback_lib* lib = &fallback_libs[i];
+		char path[PATH_MAX], compressed_path[PATH_MAX], extracted_path[PATH_MAX];
+		struct compressed_lib_header hdr;
+		if(!lib->use || lib->extracted_path != NULL || !get_bundled_lib_path(lib, path) || access(path, F_OK) == 0
+		   || !get_compressed_lib_path(lib, compressed_path) || !read_compressed_lib_header(compressed_path, lib, &hdr))
+		{
+			continue;
+		}
+		if(extract_compressed_lib(compressed_path, &hdr, extracted_path)
+		   && (lib->extracted_path = strdup(extracted_path)) != NULL)
+		{
+			continue;
+		}
+		eprintf("Couldn't extract %s, will use System's version\n", compressed_path);
+		lib->use = 0;
+	}
+}
+
+// writes a compressed version of each (uncompressed) bundled lib next to it, including the
+// builds in the glibc-hwcaps subdirectories, returns 1 on success
+static int compress_bundled_libs(void)
+{
+	int ret = 1;
+	for(int i=0; i < NUM_FALLBACK_LIBS * NUM_BUNDLED_LIB_HWCAPS; ++i)
+	{
+		struct fallback_lib variant = fallback_libs[i / NUM_BUNDLED_LIB_HWCAPS];
+		variant.hwcaps = bundled_lib_hwcaps[i % NUM_BUNDLED_LIB_HWCAPS];
+		variant.extracted_path = NULL;
+		const struct fallback_lib* lib = &variant;
+		char path[PATH_MAX], compressed_path[PATH_MAX], tmp_path[PATH_MAX + 16];
+		struct stat st;
+		if(!get_bundled_lib_path(lib, path) || !get_compressed_lib_path(lib, compressed_path) || stat(path, &st) != 0)
+		{
+			// the glibc-hwcaps builds are optional
+			if(lib->hwcaps == NULL)  printf("Bundled %s not found\n", lib->name);
+			continue;
+		}
+
+		struct compressed_lib_header hdr;
+		memset(&hdr, 0, sizeof(hdr));
+		memcpy(hdr.magic, COMPRESSED_LIB_MAGIC, sizeof(hdr.magic));
+		snprintf(hdr.name, sizeof(hdr.name), "%s", lib->name);
+		hdr.version = (lib->get_version != NULL) ? lib->get_version(path) : 0;
+		hdr.tables_id = get_manifest_tables_id();
+		hdr.size = st.st_size;
+
+		uint8_t* data = malloc(hdr.size);
+		uint8_t* compressed = malloc(lz4_compress_bound(hdr.size));
+		FILE* in = fopen(path, "r");
+		int ok = data != NULL && compressed != NULL && in != NULL && fread(data, 1, hdr.size, in) == hdr.size;
+		if(in != NULL)  fclose(in);
+		if(ok)
+		{
+			hdr.hash = fnv1a_64(FNV1A_64_INIT, data, hdr.size);
+			hdr.compressed_size = lz4_compress(data, hdr.size, compressed);
+			snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", compressed_path);
+			FILE* out = (hdr.compressed_size > 0) ? fopen(tmp_path, "w") : NULL;
+			ok = out != NULL && fwrite(&hdr, sizeof(hdr), 1, out) == 1
+			     && fwrite(compressed, 1, hdr.compressed_size, out) == hdr.compressed_size;
+			ok = (out != NULL && fclose(out) == 0) && ok;
+			ok = ok && rename(tmp_path, compressed_path) == 0;
+			if(!ok)  unlink(tmp_path);
+		}
+		free(compressed);
+		free(data);
+
+		if(ok)
+		{
+			printf("Wrote %s: version %d, %llu -> %llu bytes\n", compressed_path, (int)hdr.version,
+			       (unsigned long long)hdr.size, (unsigned long long)(sizeof(hdr) + hdr.compressed_size));
+		}
+		else
+		{
+			int e = errno;
+			eprintf("Couldn't compress %s to %s : errno %d (%s)\n", path, compressed_path, e, strerror(e));
+			ret = 0;
+		}
+	}
+	if(ret)  printf("Remove the uncompressed libs from your package to use the compressed ones\n");
+	return ret;
+}
+#endif // COMPRESSED_LIBS
+
+// probes the system's and the bundled version of fallback_libs[idx]
+static void probe_lib(int idx, struct lib_probe* probe)
+{
+	const struct fallback_lib* lib = &fallback_libs[idx];
+	if(!get_bundled_lib_path(lib, probe->local_path))
+	{
+		probe->local_path[0] = '\0'; // can't be opened, so it's treated as not found
+	}
+
+	probe->sys_found = resolve_lib_path(lib->name, probe->sys_path);
+	if(!probe->sys_found)  probe->sys_path[0] = '\0';
+
+	if(lib->get_version != NULL)
+	{
+		probe->sys_ver = probe->sys_found ? lib->get_version(probe->sys_path) : -1;
+	}
+	else
+	{
+		probe->sys_ver = probe->sys_found ? 0 : -1;
+	}
+
+#ifdef COMPRESSED_LIBS
+	if(probe_compressed_lib(lib, probe))
+	{
+		// the version is from its header (or it was extracted and checked)
+	}
+	else
+#endif
+#ifdef BUNDLED_LIBS_MANIFEST
+	if(bundled_manifest[idx].valid)
+	{
+		probe->our_ver = bundled_manifest[idx].version;
+	}
+	else
+#endif
+	if(lib->get_version != NULL)
+	{
+		probe->our_ver = lib->get_version(probe->local_path);
+	}
+	else
+	{
+		probe->our_ver = (access(probe->local_path, R_OK) == 0) ? 0 : -1;
+	}
+	probe->done = 1;
+}
+
+#if defined(PARALLEL_PROBES) || defined(PRELOAD_ALLOCATOR) || defined(VERIFY_LOAD_GRAPH)
+// returns PROBE_TIMEOUT_MS or WRAPPER_PROBE_TIMEOUT_MS from the environment, if it's set
+static int get_probe_timeout_ms(void)
+{
+	const char* timeout_var = getenv("WRAPPER_PROBE_TIMEOUT_MS");
+	if(timeout_var != NULL && atoi(timeout_var) > 0)  return atoi(timeout_var);
+	return PROBE_TIMEOUT_MS;
+}
+#endif
+
+#ifdef PARALLEL_PROBES
+static void probe_failed(struct lib_probe* probe)
+{
+	memset(probe, 0, sizeof(*probe));
+	probe->sys_ver = probe->our_ver = -1;
+}
+
+// Runs probe_lib() for all fallback libs in parallel, each in its own child process.
+// This way the total time is bounded by the slowest probe (instead of the sum of all),
+// and a lib whose constructor hangs or crashes can't take down the wrapper.
+// Probes that don't finish within PROBE_TIMEOUT_MS (or WRAPPER_PROBE_TIMEOUT_MS from
+// the environment) are killed and their results are left at done = 0.
+static void run_probes(struct lib_probe probes[NUM_FALLBACK_LIBS])
+{
+	pid_t pids[NUM_FALLBACK_LIBS];
+	int fds[NUM_FALLBACK_LIBS];
+	size_t received[NUM_FALLBACK_LIBS];
+	int64_t start_times[NUM_FALLBACK_LIBS];
+	int num_running = 0;
+	int timeout_ms = get_probe_timeout_ms();
+
+	fflush(stdout); // otherwise the children would print buffered output again
+
+	for(int i=0; i < NUM_FALLBACK_LIBS; ++i)
+	{
+		int pipe_fds[2];
+		memset(&probes[i], 0, sizeof(probes[i]));
+		fds[i] = -1;
+		pids[i] = -1;
+		received[i] = 0;
+		start_times[i] = trace_now();
+		if(pipe2(pipe_fds, O_CLOEXEC) != 0)
+		{
+			probe_lib(i, &probes[i]); // just do it in this process
+			continue;
+		}
+
+		pids[i] = fork();
+		if(pids[i] == 0)
+		{
+			close(pipe_fds[0]);
+			struct lib_probe probe;
+			memset(&probe, 0, sizeof(probe));
+			probe_lib(i, &probe);
+			fflush(stdout);
+			size_t written = 0;
+			while(written < sizeof(probe))
+			{
+				ssize_t w = write(pipe_fds[1], (char*)&probe + written, sizeof(probe) - written);
+				if(w <= 0 && errno != EINTR)  break;
+				if(w > 0)  written += w;
+			}
+			_exit(0);
+		}
+
+		close(pipe_fds[1]);
+		if(pids[i] < 0)
+		{
+			close(pipe_fds[0]);
+			probe_lib(i, &probes[i]);
+			continue;
+		}
+		fds[i] = pipe_fds[0];
+		++num_running;
+	}
+
+	struct timespec now, deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+	if(deadline.tv_nsec >= 1000000000L)
+	{
+		deadline.tv_sec += 1;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	while(num_running > 0)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		long remaining_ms = (deadline.tv_sec - now.tv_sec) * 1000L + (deadline.tv_nsec - now.tv_nsec) / 1000000L;
+		if(remaining_ms <= 0)  break;
+
+		struct pollfd pfds[NUM_FALLBACK_LIBS];
+		int idx[NUM_FALLBACK_LIBS];
+		int n = 0;
+		for(int i=0; i < NUM_FALLBACK_LIBS; ++i)
+		{
+			if(fds[i] >= 0)
+			{
+				pfds[n].fd = fds[i];
+				pfds[n].events = POLLIN;
+				pfds[n].revents = 0;
+				idx[n++] = i;
+			}
+		}
+
+		if(poll(pfds, n, remaining_ms) < 0 && errno != EINTR)  break;
+
+		for(int j=0; j < n; ++j)
+		{
+			if(pfds[j].revents == 0)  continue;
+			int i = idx[j];
+			ssize_t r = read(fds[i], (char*)&probes[i] + received[i], sizeof(probes[i]) - received[i]);
+			if(r > 0)
+			{
+				received[i] += r;
+				if(received[i] < sizeof(probes[i]))  continue;
+			}
+			else if(r < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			// done, crashed (EOF before all data was received) or error
+			if(received[i] < sizeof(probes[i]))
+			{
+				probe_failed(&probes[i]);
+				eprintf("Probing %s failed!\n", fallback_libs[i].name);
+			}
+			close(fds[i]);
+			fds[i] = -1;
+			--num_running;
+			struct trace_event* ev = trace_add("probe", 'X', start_times[i]);
+			if(ev != NULL)  ev->tid = pids[i]; // so each worker gets its own track
+			trace_arg_str(ev, "lib", fallback_libs[i].name);
+			trace_arg_int(ev, "ok", probes[i].done);
+		}
+	}
+
+	for(int i=0; i < NUM_FALLBACK_LIBS; ++i)
+	{
+		if(fds[i] >= 0) // still running => timed out
+		{
+			eprintf("Probing %s timed out after %d ms!\n", fallback_libs[i].name, timeout_ms);
+			struct trace_event* ev = trace_add("probe", 'X', start_times[i]);
+			if(ev != NULL)  ev->tid = pids[i];
+			trace_arg_str(ev, "lib", fallback_libs[i].name);
+			trace_arg_int(ev, "timed_out", 1);
+			kill(pids[i], SIGKILL);
+			close(fds[i]);
+			probe_failed(&probes[i]);
+		}
+		if(pids[i] > 0)
+		{
+			while(waitpid(pids[i], NULL, 0) < 0 && errno == EINTR) {}
+		}
+	}
+}
+#else // !PARALLEL_PROBES
+static void run_probes(struct lib_probe probes[NUM_FALLBACK_LIBS])
+{
+	for(int i=0; i < NUM_FALLBACK_LIBS; ++i)
+	{
+		int64_t start = trace_now();
+		memset(&probes[i], 0, sizeof(probes[i]));
+		probe_lib(i, &probes[i]);
+		trace_arg_str(trace_add("probe", 'X', start), "lib", fallback_libs[i].name);
+	}
+}
+#endif // PARALLEL_PROBES
+
+// records the versions found for fallback_libs[idx] and whether the bundled version will be used
+static void trace_decision(int idx, const struct lib_probe* probe, const char* sys_version, const char* our_version)
+{
+	struct trace_event* ev = trace_add("decision", 'i', 0);
+	trace_arg_str(ev, "lib", fallback_libs[idx].name);
+	trace_arg_str(ev, "system_path", probe->sys_path);
+	trace_arg_str(ev, "system_version", sys_version);
+	trace_arg_str(ev, "bundled_version", our_version);
+	trace_arg_int(ev, "use_bundled", fallback_libs[idx].use);
+}
+
+#ifdef OVERRIDE_ONLY_IF_REQUIRED
+enum { MAX_REQUIRED_VERSIONS = 512 };
+
+struct required_version
+{
+	char* lib; // soname, e.g. "libstdc++.so.6"
+	char* version; // e.g. "GLIBCXX_3.4.30"
+	int needed_by; // index in fallback_libs of the bundled lib that needs it, -1 for the app
+};
+
+static struct required_version required_versions[MAX_REQUIRED_VERSIONS];
+static int num_required_versions = 0;
+
+struct verneed_collector
+{
+	int needed_by;
+};
+
+static void collect_required_version(const char* file, const char* name, void* user)
+{
+	const struct verneed_collector* c = user;
+	// only versions from the libs this wrapper checks are interesting
+	int i;
+	for(i=0; i < NUM_FALLBACK_LIBS; ++i)
+	{
+		if(strcmp(fallback_libs[i].name, file) == 0)  break;
+	}
+	if(i == NUM_FALLBACK_LIBS || num_required_versions == MAX_REQUIRED_VERSIONS)  return;
+
+	for(i=0; i < num_required_versions; ++i)
+	{
+		const struct required_version* rv = &required_versions[i];
+		if(rv->needed_by == c->needed_by && strcmp(rv->lib, file) == 0 && strcmp(rv->version, name) == 0)
+			return;
+	}
+
+	struct required_version* rv = &required_versions[num_required_versions];
+	rv->lib = strdup(file);
+	rv->version = strdup(name);
+	rv->needed_by = c->needed_by;
+	if(rv->lib != NULL && rv->version != NULL)  ++num_required_versions;
+}
+
+// collects the versions needed from the checked libs by the app, the libs it loads
+// from its DT_RPATH/DT_RUNPATH (that usually come with the app) and the bundled libs
+static void collect_required_versions(const struct lib_probe probes[NUM_FALLBACK_LIBS])
+{
+	enum { MAX_APP_FILES = 64 };
+	char* app_files[MAX_APP_FILES];
+	int num_app_files = 0;
+	char path[PATH_MAX];
+
+	if(get_app_exe_path(path) && (app_files[0] = strdup(path)) != NULL)  num_app_files = 1;
+
+	struct verneed_collector c = { -1 };
+	for(int i=0; i < num_app_files; ++i)
+	{
+		record_probed_file(app_files[i]); // if the app changes, so might its requirements
+
+		struct elf_file ef;
+		if(!elf_open(app_files[i], &ef))  continue;
+
+		elf_foreach_verneed(&ef, collect_required_version, &c);
+
+		char dirs[4096] = {0};
+		ElfW(Xword) val;
+		const char* str;
+		if((elf_dyn_val(&ef, DT_RUNPATH, &val) || elf_dyn_val(&ef, DT_RPATH, &val))
+		   && (str = elf_dyn_string(&ef, val)) != NULL)
+		{
+			expand_origin(str, app_files[i], dirs, sizeof(dirs));
+		}
+
+		for(size_t d=0; dirs[0] != '\0' && d < ef.num_dyn && ef.dyn[d].d_tag != DT_NULL; ++d)
+		{
+			if(ef.dyn[d].d_tag != DT_NEEDED)  continue;
+			const char* name = elf_dyn_string(&ef, ef.dyn[d].d_un.d_val);
+			if(name == NULL || !find_lib_in_dirs(name, dirs, path))  continue;
+
+			int known = 0;
+			for(int k=0; k < num_app_files && !known; ++k)  known = (strcmp(app_files[k], path) == 0);
+			// the bundled versions of the checked libs are handled below
+			for(int k=0; k < NUM_FALLBACK_LIBS && !known; ++k)  known = (strcmp(fallback_libs[k].name, name) == 0);
+
+			if(!known && num_app_files < MAX_APP_FILES && (app_files[num_app_files] = strdup(path)) != NULL)
+				++num_app_files;
+		}
+		elf_close(&ef);
+	}
+	for(int i=0; i < num_app_files; ++i)  free(app_files[i]);
+
+	for(int i=0; i < NUM_FALLBACK_LIBS; ++i)
+	{
+		struct elf_file ef;
+		if(probes[i].done && probes[i].our_ver >= 0 && elf_open(probes[i].local_path, &ef))
+		{
+			c.needed_by = i;
+			elf_foreach_verneed(&ef, collect_required_version, &c);
+			elf_close(&ef);
+		}
+	}
+
+	dprintf("Found %d required versions of the checked libs\n", num_required_versions);
+}
+
+// returns 1 if the bundled lib must be used because the system's version lacks a
+// needed symbol version, 0 if the system's version has all of them and -1 if the
+// requirements don't decide it (nothing needs a version of it, or it's not on the system)
+static int required_override(int idx, const struct lib_probe* probe)
+{
+	if(!probe->done || !probe->sys_found)  return -1;
+
+	struct elf_file ef;
+	int sys_opened = 0;
+	int num_checked = 0;
+	int ret = -1;
+	for(int i=0; i < num_required_versions && ret != 1; ++i)
+	{
+		const struct required_version* rv = &required_versions[i];
+		// requirements of bundled libs only count if they're used
+		if(strcmp(rv->lib, fallback_libs[idx].name) != 0
+		   || (rv->needed_by >= 0 && !fallback_libs[rv->needed_by].use))
+			continue;
+
+		if(!sys_opened)
+		{
+			if(!elf_open(probe->sys_path, &ef))  return -1;
+			sys_opened = 1;
+		}
+
+		++num_checked;
+		if(!elf_has_verdef(&ef, rv->version))
+		{
+			const char* needed_by = (rv->needed_by >= 0) ? fallback_libs[rv->needed_by].name : "the app";
+			dprintf("System's %s lacks %s needed by %s\n", rv->lib, rv->version, needed_by);
+			struct trace_event* ev = trace_add("missing_version", 'i', 0);
+			trace_arg_str(ev, "lib", rv->lib);
+			trace_arg_str(ev, "version", rv->version);
+			trace_arg_str(ev, "needed_by", needed_by);
+			ret = 1;
+		}
+	}
+	if(sys_opened)  elf_close(&ef);
+
+	if(ret < 0 && num_checked > 0)
+	{
+		dprintf("System's %s provides all %d needed versions\n", fallback_libs[idx].name, num_checked);
+		ret = 0;
+	}
+	return ret;
+}
+#else
+static int required_override(int idx, const struct lib_probe* probe)
+{
+	(void)idx; (void)probe;
+	return -1; // decide by comparing versions
+}
+#endif // OVERRIDE_ONLY_IF_REQUIRED
+
+#ifdef PRELOAD_ALLOCATOR
+static int set_ld_library_path(void); // (it's further below)
+
+// the path of the lib the app will get for soname: the bundled one if it's used, otherwise the system's
+static int get_chosen_lib_path(const char* soname, char* out)
+{
+	for(int i=0; i < NUM_FALLBACK_LIBS; ++i)
+	{
+		if(fallback_libs[i].use && strcmp(fallback_libs[i].name, soname) == 0)
+			return get_bundled_lib_path(&fallback_libs[i], out);
+	}
+	return resolve_lib_path(soname, out);
+}
+
+enum { MAX_ALLOCATOR_VERSIONS = 64 };
+
+struct needed_versions
+{
+	int num;
+	struct { char file[64]; char version[64]; } v[MAX_ALLOCATOR_VERSIONS];
+};
+
+static void collect_needed_version(const char* file, const char* name, void* user)
+{
+	struct needed_versions* nv = user;
+	if(nv->num < MAX_ALLOCATOR_VERSIONS && strlen(file) < sizeof(nv->v[0].file) && strlen(name) < sizeof(nv->v[0].version))
+	{
+		strcpy(nv->v[nv->num].file, file);
+		strcpy(nv->v[nv->num].version, name);
+		++nv->num;
+	}
+}
+
+// checks that the libs the allocator needs versioned symbols from (usually libc, maybe
+// libstdc++ and libgcc_s) provide them, in the versions the app will use
+static int allocator_versions_ok(const char* path)
+{
+	static struct needed_versions needed;
+	struct elf_file ef;
+	if(!elf_open(path, &ef))  return 0;
+	needed.num = 0;
+	elf_foreach_verneed(&ef, collect_needed_version, &needed);
+	elf_close(&ef);
+
+	for(int i=0; i < needed.num; ++i)
+	{
+		char lib_path[PATH_MAX];
+		if(!get_chosen_lib_path(needed.v[i].file, lib_path) || !elf_open(lib_path, &ef))
+		{
+			dprintf("%s needs %s which wasn't found\n", path, needed.v[i].file);
+			return 0;
+		}
+		record_probed_file(lib_path);
+		int ok = elf_has_verdef(&ef, needed.v[i].version);
+		elf_close(&ef);
+		if(!ok)
+		{
+			dprintf("%s needs %s from %s, which %s doesn't have\n", path, needed.v[i].version, needed.v[i].file, lib_path);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// runs in a copy of the wrapper started by allocator_trial_load() with the allocator preloaded,
+// returns the exit code: 0 if everything worked
+static int allocator_self_test(void)
+{
+	// allocations of different sizes and alignments, to make sure the allocator works at all
+	void* ptrs[64];
+	for(int i=0; i < 64; ++i)
+	{
+		size_t size = (size_t)16 << (i % 16);
+		ptrs[i] = (i & 1) ? calloc(1, size) : malloc(size);
+		if(ptrs[i] == NULL)  return 1;
+		memset(ptrs[i], i, size);
+	}
+	for(int i=0; i < 64; ++i)
+	{
+		ptrs[i] = realloc(ptrs[i], (size_t)24 << ((i + 5) % 16));
+		if(ptrs[i] == NULL)  return 1;
+	}
+	for(int i=0; i < 64; ++i)  free(ptrs[i]);
+
+	void* aligned = NULL;
+	if(posix_memalign(&aligned, 4096, 12345) != 0 || ((uintptr_t)aligned & 4095) != 0)  return 1;
+	free(aligned);
+
+#if defined(CHECK_LIBSTDCPP) && !defined(NO_DLOPEN)
+	// the libstdc++ the app will use must work with it (operator new/delete)
+	void* handle = dlopen("libstdc++.so.6", RTLD_NOW);
+	if(handle == NULL)
+	{
+		eprintf("Allocator test: loading libstdc++.so.6 failed: %s\n", dlerror());
+		return 1;
+	}
+	dlclose(handle);
+#endif
+	return 0;
+}
+
+#ifdef NO_DLOPEN
+// a statically linked wrapper ignores LD_PRELOAD, so this (dynamically linked) program
+// is started instead, with the allocator and the libstdc++ the app will use preloaded
+#define ALLOCATOR_TEST_PROGRAM "/bin/true"
+#endif
+
+// starts the wrapper itself with the allocator preloaded and the library path (from the
+// decisions for the other libs) set, to see if the dynamic linker and libc accept it
+static int allocator_trial_load(const char* path)
+{
+#ifdef NO_DLOPEN
+	if(!is_compatible_elf(ALLOCATOR_TEST_PROGRAM))
+	{
+		dprintf("Can't test %s without a compatible %s\n", path, ALLOCATOR_TEST_PROGRAM);
+		return 0;
+	}
+#endif
+	// the test process inherits the write end, so the read end gets EOF when it exits
+	int pipe_fds[2];
+	if(pipe2(pipe_fds, O_CLOEXEC) != 0)  return 0;
+	fflush(stdout);
+	pid_t pid = fork();
+	if(pid == 0)
+	{
+		close(pipe_fds[0]);
+		fcntl(pipe_fds[1], F_SETFD, 0);
+		if(!debugOutput)
+		{
+			// the user doesn't need to see the errors of a failing test
+			int fd = open("/dev/null", O_WRONLY);
+			if(fd >= 0)
+			{
+				dup2(fd, STDOUT_FILENO);
+				dup2(fd, STDERR_FILENO);
+				close(fd);
+			}
+		}
+		unsetenv("WRAPPER_TRACE");
+		set_ld_library_path();
+	#ifdef NO_DLOPEN
+		char preload[PATH_MAX + 32];
+		#ifdef CHECK_LIBSTDCPP
+		snprintf(preload, sizeof(preload), "%s:libstdc++.so.6", path);
+		#else
+		snprintf(preload, sizeof(preload), "%s", path);
+		#endif
+		setenv("LD_PRELOAD", preload, 1);
+		char* args[] = { "true", NULL };
+		execv(ALLOCATOR_TEST_PROGRAM, args);
+	#else
+		setenv("LD_PRELOAD", path, 1);
+		setenv("WRAPPER_ALLOCATOR_TEST", "1", 1);
+		char* args[] = { "wrapper-allocator-test", NULL };
+		execv("/proc/self/exe", args);
+	#endif
+		_exit(127);
+	}
+	close(pipe_fds[1]);
+	if(pid < 0)
+	{
+		close(pipe_fds[0]);
+		return 0;
+	}
+
+	int timeout_ms = get_probe_timeout_ms();
+	int64_t deadline = trace_now() + (int64_t)timeout_ms * 1000;
+	for(;;)
+	{
+		int64_t remaining_ms = (deadline - trace_now()) / 1000;
+		struct pollfd pfd = { pipe_fds[0], POLLIN, 0 };
+		int ret = (remaining_ms > 0) ? poll(&pfd, 1, (int)remaining_ms) : 0;
+		if(ret < 0 && errno == EINTR)  continue;
+		if(ret > 0)
+		{
+			char c;
+			if(read(pipe_fds[0], &c, 1) < 0 && errno == EINTR)  continue;
+			break; // EOF: it exited
+		}
+		if(ret == 0)
+			eprintf("Testing the bundled allocator timed out after %d ms!\n", timeout_ms);
+		kill(pid, SIGKILL);
+		break;
+	}
+	close(pipe_fds[0]);
+	int status = 0;
+	while(waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+
+	if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	{
+		dprintf("Test process with %s preloaded failed (status %d)\n", path, status);
+		return 0;
+	}
+	return 1;
+}
+#endif // PRELOAD_ALLOCATOR
+
+#ifdef VERIFY_LOAD_GRAPH
+enum { MAX_GRAPH_OBJECTS = 512, MAX_LOAD_CONFLICTS = 64 };
+
+// an object (executable or lib) the dynamic linker would load for the app
+struct graph_object
+{
+	char* path;
+	char* name; // the name it's loaded as (from DT_NEEDED or VERIFY_LOAD_GRAPH)
+	const char* soname; // its DT_SONAME (in ef), or NULL
+	dev_t dev;
+	ino_t ino;
+	struct elf_file ef;
+	int bundled; // index in fallback_libs if this is the bundled version of that lib, otherwise -1
+};
+
+static struct graph_object load_graph[MAX_GRAPH_OBJECTS];
+static int num_graph_objects = 0;
+static int num_graph_objects_done = 0; // the ones whose DT_NEEDED were already added
+static int load_graph_has_exe = 0; // if load_graph[0] is the app's executable (and not e.g. a script)
+
+// a version some object needs that the loaded copy of the lib doesn't provide
+struct load_conflict
+{
+	int requirer; // index in load_graph
+	int provider; // index in load_graph, -1 if the lib isn't found at all
+	const char* file; // soname of the lib the version is needed from
+	const char* version;
+};
+
+static struct load_conflict load_conflicts[MAX_LOAD_CONFLICTS];
+static int num_load_conflicts = 0;
+
+// dirs the dynamic linker searches in addition to LD_LIBRARY_PATH: those of the used bundled libs
+static char bundled_lib_dirs[NUM_FALLBACK_LIBS * PATH_MAX];
+
+static void clear_load_graph(void)
+{
+	for(int i=0; i < num_graph_objects; ++i)
+	{
+		elf_close(&load_graph[i].ef);
+		free(load_graph[i].path);
+		free(load_graph[i].name);
+	}
+	num_graph_objects = num_graph_objects_done = load_graph_has_exe = 0;
+}
+
+static struct graph_object* find_loaded_object(const char* name)
+{
+	for(int i=0; i < num_graph_objects; ++i)
+	{
+		const struct graph_object* o = &load_graph[i];
+		if(strcmp(o->name, name) == 0 || (o->soname != NULL && strcmp(o->soname, name) == 0))
+			return &load_graph[i];
+	}
+	return NULL;
+}
+
+// adds the file at path to the graph (unless it's already in it), returns 0 if it can't be read
+static int add_graph_object(const char* name, const char* path, int bundled)
+{
+	struct stat st;
+	if(num_graph_objects == MAX_GRAPH_OBJECTS || stat(path, &st) != 0)  return 0;
+
+	for(int i=0; i < num_graph_objects; ++i)
+	{
+		// the dynamic linker recognizes an already loaded file by its identity
+		if(load_graph[i].dev == st.st_dev && load_graph[i].ino == st.st_ino)  return 1;
+	}
+
+	struct graph_object* o = &load_graph[num_graph_objects];
+	memset(o, 0, sizeof(*o));
+	if(!elf_open(path, &o->ef))  return 0;
+	o->path = strdup(path);
+	o->name = strdup(name);
+	if(o->path == NULL || o->name == NULL)
+	{
+		free(o->path);
+		free(o->name);
+		elf_close(&o->ef);
+		return 0;
+	}
+	ElfW(Xword) val;
+	o->soname = elf_dyn_val(&o->ef, DT_SONAME, &val) ? elf_dyn_string(&o->ef, val) : NULL;
+	o->dev = st.st_dev;
+	o->ino = st.st_ino;
+	o->bundled = bundled;
+	++num_graph_objects;
+	return 1;
+}
+
+// writes the path of the lib the dynamic linker would load for name (from DT_NEEDED of
+// the object at index from, or dlopen()ed by the app if from is -1) to out
+static int resolve_graph_lib(const char* name, int from, char* out, int* bundled)
+{
+	*bundled = -1;
+	for(int i=0; i < NUM_FALLBACK_LIBS; ++i)
+	{
+		if(fallback_libs[i].use && strcmp(fallback_libs[i].name, name) == 0)
+		{
+			*bundled = i;
+			return get_bundled_lib_path(&fallback_libs[i], out);
+		}
+	}
+	if(strchr(name, '/') != NULL)  return snprintf(out, PATH_MAX, "%s", name) < PATH_MAX;
+
+	// DT_RPATH of the object (if it has no DT_RUNPATH) and of the executable, LD_LIBRARY_PATH
+	// (with the dirs of the bundled libs), DT_RUNPATH, ld.so.cache and the default dirs
+	char rpath[4096] = {0}, exe_rpath[4096] = {0}, runpath[4096] = {0};
+	if(from < 0 && load_graph_has_exe)  from = 0; // dlopen() uses the RUNPATH of the caller
+	const struct elf_file* ef = (from >= 0) ? &load_graph[from].ef : NULL;
+	ElfW(Xword) val;
+	const char* str;
+	if(ef != NULL && elf_dyn_val(ef, DT_RUNPATH, &val) && (str = elf_dyn_string(ef, val)) != NULL)
+	{
+		expand_origin(str, load_graph[from].path, runpath, sizeof(runpath));
+	}
+	else if(ef != NULL)
+	{
+		if(elf_dyn_val(ef, DT_RPATH, &val) && (str = elf_dyn_string(ef, val)) != NULL)
+			expand_origin(str, load_graph[from].path, rpath, sizeof(rpath));
+		ef = &load_graph[0].ef;
+		if(from != 0 && load_graph_has_exe && !elf_dyn_val(ef, DT_RUNPATH, &val) && elf_dyn_val(ef, DT_RPATH, &val)
+		   && (str = elf_dyn_string(ef, val)) != NULL)
+			expand_origin(str, load_graph[0].path, exe_rpath, sizeof(exe_rpath));
+	}
+
+	return find_lib_in_dirs(name, rpath, out) || find_lib_in_dirs(name, exe_rpath, out)
+	       || find_lib_in_dirs(name, bundled_lib_dirs, out) || find_lib_in_dirs(name, getenv("LD_LIBRARY_PATH"), out)
+	       || find_lib_in_dirs(name, runpath, out) || resolve_lib_path_from(name, NULL, out);
+}
+
+// adds the DT_NEEDED libs of all objects that were added since the last call, and theirs
+static void add_needed_graph_objects(void)
+{
+	for(; num_graph_objects_done < num_graph_objects; ++num_graph_objects_done)
+	{
+		int idx = num_graph_objects_done;
+		const struct elf_file* ef = &load_graph[idx].ef;
+		for(size_t d=0; d < ef->num_dyn && ef->dyn[d].d_tag != DT_NULL; ++d)
+		{
+			if(ef->dyn[d].d_tag != DT_NEEDED)  continue;
+			const char* name = elf_dyn_string(ef, ef->dyn[d].d_un.d_val);
+			char path[PATH_MAX];
+			int bundled;
+			if(name == NULL || find_loaded_object(name) != NULL)  continue;
+			if(resolve_graph_lib(name, idx, path, &bundled))  add_graph_object(name, path, bundled);
+			// else: the dynamic linker would fail, that's reported by check_load_graph()
+		}
+	}
+}
+
+// resolves all objects the app loads at startup (with the current decisions),
+// followed by the libs from VERIFY_LOAD_GRAPH it might dlopen() later
+static int build_load_graph(void)
+{
+	char path[PATH_MAX];
+	clear_load_graph();
+
+	bundled_lib_dirs[0] = '\0';
+	size_t dirs_len = 0;
+	for(int i=0; i < NUM_FALLBACK_LIBS; ++i)
+	{
+		if(fallback_libs[i].use && !fallback_libs[i].preload && get_bundled_lib_path(&fallback_libs[i], path))
+		{
+			*strrchr(path, '/') = '\0';
+			dirs_len += snprintf(bundled_lib_dirs + dirs_len, sizeof(bundled_lib_dirs) - dirs_len, "%s%s", (dirs_len > 0) ? ":" : "", path);
+		}
+	}
+
+	if(!get_app_exe_path(path))  return 0;
+	load_graph_has_exe = add_graph_object(APP_EXECUTABLE, path, -1);
+	if(!load_graph_has_exe)
+	{
+		dprintf("%s isn't an ELF executable, will only verify the libs from VERIFY_LOAD_GRAPH\n", path);
+	}
+	// preloaded libs are loaded right after the executable
+	for(int i=0; i < NUM_FALLBACK_LIBS; ++i)
+	{
+		if(fallback_libs[i].use && fallback_libs[i].preload && get_bundled_lib_path(&fallback_libs[i], path))
+			add_graph_object(fallback_libs[i].name, path, i);
+	}
+	add_needed_graph_objects();
+
+	char libs[sizeof(VERIFY_LOAD_GRAPH)];
+	strcpy(libs, VERIFY_LOAD_GRAPH);
+	for(char* name = strtok(libs, ":"); name != NULL; name = strtok(NULL, ":"))
+	{
+		int bundled;
+		if(strchr(name, '/') != NULL)
+		{
+			glob_t g;
+			if(glob(name, 0, NULL, &g) != 0)  continue;
+			for(size_t i=0; i < g.gl_pathc; ++i)
+			{
+				if(is_compatible_elf(g.gl_pathv[i]))  add_graph_object(g.gl_pathv[i], g.gl_pathv[i], -1);
+			}
+			globfree(&g);
+		}
+		else if(find_loaded_object(name) == NULL && resolve_graph_lib(name, -1, path, &bundled))
+		{
+			add_graph_object(name, path, bundled);
+		}
+		add_needed_graph_objects();
+	}
+	return 1;
+}
+
+static struct graph_object* conflict_requirer = NULL; // for check_needed_version_cb()
+
+static void check_needed_version_cb(const char* file, const char* version, void* user)
+{
+	(void)user;
+	struct graph_object* provider = find_loaded_object(file);
+	if(provider != NULL && elf_has_verdef(&provider->ef, version))  return;
+	// the dynamic linker reports each missing lib once
+	for(int i=0; i < num_load_conflicts && provider == NULL; ++i)
+	{
+		if(load_conflicts[i].provider < 0 && strcmp(load_conflicts[i].file, file) == 0)  return;
+	}
+	if(num_load_conflicts == MAX_LOAD_CONFLICTS)  return;
+
+	struct load_conflict* c = &load_conflicts[num_load_conflicts++];
+	c->requirer = conflict_requirer - load_graph;
+	c->provider = (provider != NULL) ? provider - load_graph : -1;
+	c->file = file;
+	c->version = version;
+}
+
+// collects the versions needed by an object in the graph that aren't provided by the loaded
+// copy of that lib in load_conflicts, returns their number
+static int check_load_graph(void)
+{
+	num_load_conflicts = 0;
+	for(int i=0; i < num_graph_objects; ++i)
+	{
+		conflict_requirer = &load_graph[i];
+		elf_foreach_verneed(&load_graph[i].ef, check_needed_version_cb, NULL);
+	}
+	return num_load_conflicts;
+}
+
+// returns 1 if the lib at path defines the symbol version
+static int lib_has_version(const char* path, const char* version)
+{
+	struct elf_file ef;
+	if(!elf_open(path, &ef))  return 0;
+	int ret = elf_has_verdef(&ef, version);
+	elf_close(&ef);
+	return ret;
+}
+
+// changes which version of a lib is used if that could fix the conflict, returns 1 if it did.
+// Each lib is only changed once (flipped), so this can't go back and forth between two conflicts
+static int fix_load_conflict(const struct load_conflict* c, unsigned char flipped[NUM_FALLBACK_LIBS])
+{
+	const struct graph_object* requirer = &load_graph[c->requirer];
+	const struct graph_object* provider = (c->provider >= 0) ? &load_graph[c->provider] : NULL;
+	char path[PATH_MAX];
+
+	if(provider != NULL && provider->bundled >= 0)
+	{
+		// the bundled lib lacks the version, maybe the system's has it
+		int idx = provider->bundled;
+		if(!flipped[idx] && resolve_lib_path(c->file, path) && lib_has_version(path, c->version))
+		{
+			dprintf("Will use System's %s after all, the bundled one lacks %s needed by %s\n", c->file, c->version, requirer->path);
+			fallback_libs[idx].use = 0;
+			flipped[idx] = 1;
+			return 1;
+		}
+	}
+	else
+	{
+		// the system's lib lacks the version (or is missing), maybe the bundled one has it
+		for(int i=0; i < NUM_FALLBACK_LIBS; ++i)
+		{
+			if(strcmp(fallback_libs[i].name, c->file) != 0 || fallback_libs[i].use || flipped[i])  continue;
+			if(get_bundled_lib_path(&fallback_libs[i], path) && (c->version == NULL || lib_has_version(path, c->version)))
+			{
+				dprintf("Will use bundled %s after all, it provides %s needed by %s\n", c->file, c->version, requirer->path);
+				fallback_libs[i].use = 1;
+				flipped[i] = 1;
+				return 1;
+			}
+		}
+	}
+
+	if(requirer->bundled >= 0 && !flipped[requirer->bundled] && resolve_lib_path(fallback_libs[requirer->bundled].name, path))
+	{
+		// a used bundled lib needs a version nothing on this system provides, so it can't be loaded
+		dprintf("Will use System's %s after all, the bundled one needs %s from %s\n",
+		        fallback_libs[requirer->bundled].name, c->version, c->file);
+		fallback_libs[requirer->bundled].use = 0;
+		flipped[requirer->bundled] = 1;
+		return 1;
+	}
+	return 0;
+}
+
+// result of verify_load_graph_child(), followed by the paths of all objects in the graph
+struct load_graph_result
+{
+	int num_objects;
+	int num_conflicts; // the ones that couldn't be fixed
+	unsigned char use[NUM_FALLBACK_LIBS];
+};
+
+static int write_all(int fd, const void* data, size_t size)
+{
+	size_t written = 0;
+	while(written < size)
+	{
+		ssize_t w = write(fd, (const char*)data + written, size - written);
+		if(w <= 0 && errno != EINTR)  return 0;
+		if(w > 0)  written += w;
+	}
+	return 1;
+}
+
+static void verify_load_graph_child(int fd)
+{
+	unsigned char flipped[NUM_FALLBACK_LIBS] = {0};
+	struct load_graph_result res = {0};
+
+	// a fix can cause another conflict (e.g. the system's libstdc++ lacking a version the
+	// bundled libgcc_s needs), so this is repeated until nothing changes
+	for(int round=0; round <= NUM_FALLBACK_LIBS; ++round)
+	{
+		if(!build_load_graph())  _exit(1);
+		check_load_graph();
+
+		int changed = 0;
+		for(int i=0; i < num_load_conflicts; ++i)
+		{
+			changed |= fix_load_conflict(&load_conflicts[i], flipped);
+		}
+		if(!changed)  break;
+	}
+
+	for(int i=0; i < num_load_conflicts; ++i)
+	{
+		const struct load_conflict* c = &load_conflicts[i];
+		const char* requirer = load_graph[c->requirer].path;
+		int ours = 0;
+		for(int l=0; l < NUM_FALLBACK_LIBS; ++l)  ours |= (strcmp(fallback_libs[l].name, c->file) == 0);
+		if(c->provider < 0 && ours)
+			eprintf("Loading %s will fail: %s is missing\n", requirer, c->file);
+		else if(ours)
+			eprintf("Loading %s will fail: no available %s provides %s\n", requirer, c->file, c->version);
+		else if(c->provider < 0)
+			dprintf("Loading %s will fail: %s is missing\n", requirer, c->file);
+		else
+			dprintf("Loading %s will fail: %s lacks %s\n", requirer, load_graph[c->provider].path, c->version);
+	}
+
+	res.num_objects = num_graph_objects;
+	res.num_conflicts = num_load_conflicts;
+	for(int i=0; i < NUM_FALLBACK_LIBS; ++i)  res.use[i] = fallback_libs[i].use;
+	fflush(stdout);
+	if(!write_all(fd, &res, sizeof(res)))  _exit(1);
+	for(int i=0; i < num_graph_objects; ++i)
+	{
+		if(!write_all(fd, load_graph[i].path, strlen(load_graph[i].path) + 1))  _exit(1);
+	}
+	_exit(0);
+}
+
+// checks in a child process (so a broken lib or slow filesystem can't hang or crash the
+// wrapper) that all libs the app and the VERIFY_LOAD_GRAPH libs load with the current
+// decisions get the symbol versions they need, and applies the decisions it changed to fix that.
+// All the libs are recorded for the launch cache, so this only runs again if one of them changes
+static void verify_load_graph(void)
+{
+	const char* var = getenv("WRAPPER_VERIFY");
+	if(var != NULL && var[0] != '\0' && atoi(var) == 0)  return;
+
+	int64_t start = trace_now();
+#ifdef COMPRESSED_LIBS
+	extract_used_compressed_libs(); // the child must be able to read them
+#endif
+
+	int pipe_fds[2];
+	if(pipe2(pipe_fds, O_CLOEXEC) != 0)  return;
+	fflush(stdout);
+	pid_t pid = fork();
+	if(pid == 0)
+	{
+		close(pipe_fds[0]);
+		verify_load_graph_child(pipe_fds[1]);
+	}
+	close(pipe_fds[1]);
+	if(pid < 0)
+	{
+		close(pipe_fds[0]);
+		return;
+	}
+
+	int timeout_ms = get_probe_timeout_ms();
+	int64_t deadline = trace_now() + (int64_t)timeout_ms * 1000;
+
+	size_t size = 0, capacity = 4096;
+	char* data = malloc(capacity);
+	int ok = (data != NULL);
+	while(ok)
+	{
+		int64_t remaining_ms = (deadline - trace_now()) / 1000;
+		struct pollfd pfd = { pipe_fds[0], POLLIN, 0 };
+		int ret = (remaining_ms > 0) ? poll(&pfd, 1, (int)remaining_ms) : 0;
+		if(ret < 0 && errno == EINTR)  continue;
+		if(ret <= 0)
+		{
+			if(ret == 0)
+				eprintf("Verifying the libs the app will load timed out after %d ms!\n", timeout_ms);
+			kill(pid, SIGKILL);
+			ok = 0;
+			break;
+		}
+		if(pfd.revents == 0)  continue;
+		if(size == capacity)
+		{
+			char* new_data = realloc(data, capacity * 2);
+			if(new_data == NULL)
+			{
+				kill(pid, SIGKILL);
+				ok = 0;
+				break;
+			}
+			data = new_data;
+			capacity *= 2;
+		}
+		ssize_t r = read(pipe_fds[0], data + size, capacity - size);
+		if(r > 0)  size += r;
+		else if(r == 0)  break;
+		else if(errno != EINTR)
+		{
+			kill(pid, SIGKILL);
+			ok = 0;
+		}
+	}
+	close(pipe_fds[0]);
+	int status = 0;
+	while(waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+
+	struct load_graph_result res;
+	if(!ok || !WIFEXITED(status) || WEXITSTATUS(status) != 0 || size < sizeof(res))
+	{
+		eprintf("Couldn't verify the libs the app will load, keeping the decisions\n");
+	#ifdef USE_LAUNCH_CACHE
+		probed_files_incomplete = 1; // try again next time
+	#endif
+		free(data);
+		return;
+	}
+
+	memcpy(&res, data, sizeof(res));
+	for(int i=0; i < NUM_FALLBACK_LIBS; ++i)
+	{
+		if(fallback_libs[i].use != res.use[i])
+		{
+			fallback_libs[i].use = res.use[i];
+			struct trace_event* ev = trace_add("verify_changed_decision", 'i', 0);
+			trace_arg_str(ev, "lib", fallback_libs[i].name);
+			trace_arg_int(ev, "use_bundled", res.use[i]);
+		}
+	}
+	// the verdict depends on all these files, the glob()ed libs also on their directories
+	for(size_t off = sizeof(res); off < size; off += strlen(data + off) + 1)
+	{
+		if(memchr(data + off, '\0', size - off) == NULL)  break;
+		record_probed_file(data + off);
+	}
+	char libs[sizeof(VERIFY_LOAD_GRAPH)];
+	strcpy(libs, VERIFY_LOAD_GRAPH);
+	for(char* name = strtok(libs, ":"); name != NULL; name = strtok(NULL, ":"))
+	{
+		char* slash = strrchr(name, '/');
+		if(slash != NULL && strpbrk(name, "*?[") != NULL)
+		{
+			*slash = '\0';
+			record_probed_file(slash != name ? name : "/");
+		}
+	}
+	free(data);
+
+	dprintf("Verified the %d libs the app will load, %d conflicts left\n", res.num_objects, res.num_conflicts);
+	struct trace_event* ev = trace_add("verify_load_graph", 'X', start);
+	trace_arg_int(ev, "objects", res.num_objects);
+	trace_arg_int(ev, "conflicts", res.num_conflicts);
+}
+#endif // VERIFY_LOAD_GRAPH
+
+static int check_fallback_libs(void)
+{
+	static struct lib_probe probes[NUM_FALLBACK_LIBS];
+#ifdef BUNDLED_LIBS_MANIFEST
+	read_bundled_manifest();
+#endif
+	run_probes(probes);
+
+	for(int i=0; i < NUM_FALLBACK_LIBS; ++i)
+	{
+		if(!probes[i].done)
+		{
+			// a failed probe could be a transient problem, so don't cache the decisions;
+			// keeping the system version of the lib is the safe default
+			dprintf("Couldn't check %s, will use System's version\n", fallback_libs[i].name);
+		#ifdef USE_LAUNCH_CACHE
+			probed_files_incomplete = 1;
+		#endif
+			continue;
+		}
+		record_probed_file(probes[i].local_path);
+		if(probes[i].sys_found)  record_probed_file(probes[i].sys_path);
+	#ifdef COMPRESSED_LIBS
+		if(probes[i].compressed_path[0] != '\0')  record_probed_file(probes[i].compressed_path);
+	#endif
+	}
+
+#ifdef OVERRIDE_ONLY_IF_REQUIRED
+	collect_required_versions(probes);
+#endif
+
+	int sys_ver, our_ver, required;
+	int fb_lib_idx = 0;
+
+#ifdef CHECK_LIBSTDCPP
+	sys_ver = probes[fb_lib_idx].sys_ver;
+	our_ver = probes[fb_lib_idx].our_ver;
+	dprintf("System libstdc++ version: %s ours: %s\n", get_gcc_version_name(libstdcpp_version_checks, _NUM_STDCPP_GCC_VERSIONS, sys_ver),
+	                                                   get_gcc_version_name(libstdcpp_version_checks, _NUM_STDCPP_GCC_VERSIONS, our_ver));
+	required = required_override(fb_lib_idx, &probes[fb_lib_idx]);
+	if(probes[fb_lib_idx].done && our_ver >= 0 && (required > 0 || (required < 0 && our_ver > sys_ver)))
+	{
+		dprintf("Overwriting System libstdc++\n");
+		fallback_libs[fb_lib_idx].use = 1;
+	}
+	trace_decision(fb_lib_idx, &probes[fb_lib_idx], get_gcc_version_name(libstdcpp_version_checks, _NUM_STDCPP_GCC_VERSIONS, sys_ver),
+	               get_gcc_version_name(libstdcpp_version_checks, _NUM_STDCPP_GCC_VERSIONS, our_ver));
+
+	++fb_lib_idx;
+#endif
+
+#ifdef CHECK_LIBGCC
+	sys_ver = probes[fb_lib_idx].sys_ver;
+	our_ver = probes[fb_lib_idx].our_ver;
+	dprintf("System libgcc version: %s ours: %s\n", get_gcc_version_name(libgcc_version_checks, _NUM_LIBGCC_VERSIONS, sys_ver),
+	                                                get_gcc_version_name(libgcc_version_checks, _NUM_LIBGCC_VERSIONS, our_ver));
+	required = required_override(fb_lib_idx, &probes[fb_lib_idx]);
+	if(probes[fb_lib_idx].done && our_ver >= 0 && (required > 0 || (required < 0 && our_ver > sys_ver)))
+	{
+		dprintf("Overwriting System libgcc\n");
+		fallback_libs[fb_lib_idx].use = 1;
+	}
+	trace_decision(fb_lib_idx, &probes[fb_lib_idx], get_gcc_version_name(libgcc_version_checks, _NUM_LIBGCC_VERSIONS, sys_ver),
+	               get_gcc_version_name(libgcc_version_checks, _NUM_LIBGCC_VERSIONS, our_ver));
+
+	++fb_lib_idx;
+#endif
+
+#ifdef CHECK_LIBSDL2
+	sys_ver = probes[fb_lib_idx].sys_ver;
+	our_ver = probes[fb_lib_idx].our_ver;
+	char sdl_sys_ver_name[16], sdl_our_ver_name[16];
+	{
+		int sv = (sys_ver < 0) ? 0 : sys_ver, ov = (our_ver < 0) ? 0 : our_ver; // print "0.0.0" if not found
+		snprintf(sdl_sys_ver_name, sizeof(sdl_sys_ver_name), "%d.%d.%d", SDL2_VERSION_MAJOR(sv), SDL2_VERSION_MINOR(sv), SDL2_VERSION_PATCH(sv));
+		snprintf(sdl_our_ver_name, sizeof(sdl_our_ver_name), "%d.%d.%d", SDL2_VERSION_MAJOR(ov), SDL2_VERSION_MINOR(ov), SDL2_VERSION_PATCH(ov));
+		dprintf("System SDL2 version: %s ours: %s\n", sdl_sys_ver_name, sdl_our_ver_name);
+	}
+	required = required_override(fb_lib_idx, &probes[fb_lib_idx]);
+	if( probes[fb_lib_idx].done
+	   && our_ver >= 0 // otherwise it hasn't been found
+	   && required != 0
+	   && (required > 0 || sys_ver < 0
+	       || SDL2_VERSION_MAJOR(sys_ver) != SDL2_VERSION_MAJOR(our_ver) // changes to the major version break the API/ABI
+	       // minor versions don't break API/ABI (has been decided with 2.24.0 which followed 2.0.22)
+	       // so (with the same major version) a plain comparison of the packed versions is enough
+	       || sys_ver < our_ver ) )
+	{
+		dprintf("Overwriting System libSDL2\n");
+		fallback_libs[fb_lib_idx].use = 1;
+	}
+	trace_decision(fb_lib_idx, &probes[fb_lib_idx], sdl_sys_ver_name, sdl_our_ver_name);
+
+	++fb_lib_idx;
+#endif
+
+#ifdef CHECK_LIBCURL4
+	{
+		// only use the bundled libcurl.so.4 if none is available on the system
+		// there should be no backwards compat problems as long as it's libcurl.so.4
+		// (and you linked against a libcurl without versioned symbols)
+		// This way a (hopefully) security patched version supplied
+		// by the user's Linux distribution is used, if available
+		required = required_override(fb_lib_idx, &probes[fb_lib_idx]);
+		if(probes[fb_lib_idx].done && !probes[fb_lib_idx].sys_found)
+		{
+			dprintf("Couldn't find libcurl.so.4 on System, will use bundled version\n");
+			fallback_libs[fb_lib_idx].use = 1;
+		}
+		else if(required > 0 && probes[fb_lib_idx].our_ver >= 0)
+		{
+			dprintf("System's libcurl.so.4 is missing needed versions, will use bundled version\n");
+			fallback_libs[fb_lib_idx].use = 1;
+		}
+		else
+		{
+			dprintf("Will use System's libcurl.so.4\n");
+		}
+	}
+	trace_decision(fb_lib_idx, &probes[fb_lib_idx], probes[fb_lib_idx].sys_found ? "found" : "Not found",
+	               (probes[fb_lib_idx].our_ver >= 0) ? "found" : "Not found");
+
+	++fb_lib_idx;
+#endif
+
+#if defined(COMPRESSED_LIBS) && defined(PRELOAD_ALLOCATOR)
+	// the allocator is checked with the libs the app will get
+	extract_used_compressed_libs();
+#endif
+
+#ifdef PRELOAD_ALLOCATOR
+	{
+		const char* mode = getenv("WRAPPER_ALLOCATOR");
+		const struct lib_probe* probe = &probes[fb_lib_idx];
+		if(mode != NULL && strcmp(mode, "system") == 0)
+		{
+			dprintf("WRAPPER_ALLOCATOR=system, won't preload %s\n", PRELOAD_ALLOCATOR);
+		}
+		else if(!probe->done || probe->our_ver < 0)
+		{
+			dprintf("Bundled %s not found, will use System's allocator\n", PRELOAD_ALLOCATOR);
+		}
+		else if(mode != NULL && strcmp(mode, "bundled") == 0)
+		{
+			dprintf("WRAPPER_ALLOCATOR=bundled, will preload %s without checking it\n", PRELOAD_ALLOCATOR);
+			fallback_libs[fb_lib_idx].use = 1;
+		}
+		else if(allocator_versions_ok(probe->local_path) && allocator_trial_load(probe->local_path))
+		{
+			dprintf("Will preload bundled %s\n", PRELOAD_ALLOCATOR);
+			fallback_libs[fb_lib_idx].use = 1;
+		}
+		else
+		{
+			dprintf("Bundled %s isn't compatible with this system, will use System's allocator\n", PRELOAD_ALLOCATOR);
+		}
+		trace_decision(fb_lib_idx, probe, "-", (probe->our_ver >= 0) ? "found" : "Not found");
+	}
+
+	++fb_lib_idx;
+#endif
+
+#ifdef VERIFY_LOAD_GRAPH
+	verify_load_graph();
+#endif
+
+	return 1;
+}
+
+// hashes the things besides files that the decisions depend on, for the launch cache
+// and the relaunch token
+static uint64_t get_launch_cache_env_hash(void)
+{
+	const char* ld_path = getenv("LD_LIBRARY_PATH");
+	uint64_t hash = fnv1a_64(FNV1A_64_INIT, wrapper_exe_dir, strlen(wrapper_exe_dir) + 1);
+	if(ld_path != NULL)
+	{
+		hash = fnv1a_64(hash, ld_path, strlen(ld_path));
+	}
+#ifdef PRELOAD_ALLOCATOR
+	const char* allocator = getenv("WRAPPER_ALLOCATOR");
+	if(allocator != NULL)
+	{
+		hash = fnv1a_64(hash, allocator, strlen(allocator) + 1);
+	}
+#endif
+#ifdef SELECT_ISA_VARIANTS
+	// the checked builds of the app and libs depend on it
+	hash = fnv1a_64(hash, &isa_level, sizeof(isa_level));
+#endif
+#ifdef VERIFY_LOAD_GRAPH
+	const char* verify = getenv("WRAPPER_VERIFY");
+	if(verify != NULL)
+	{
+		hash = fnv1a_64(hash, verify, strlen(verify) + 1);
+	}
+#endif
+	return hash;
+}
+
+#ifdef USE_LAUNCH_CACHE
+// The launch cache stores the decisions of check_fallback_libs() together with the
+// identity (device, inode, size, mtime) of every file that influenced them, so if none of
+// them changed, the next launch can skip all probes and only needs a few stat() calls.
+// The cache is invalidated if the wrapper itself, /etc/ld.so.cache (updated by ldconfig
+// whenever libs are installed), the LD_LIBRARY_PATH (and its directories) or any of
+// the probed system or bundled libs change.
+
+#define LAUNCH_CACHE_MAGIC "WRPCACHE"
+#define LAUNCH_CACHE_VERSION 1
+
+struct launch_cache_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t num_libs;
+	uint32_t num_files;
+	uint32_t reserved;
+	uint64_t env_hash; // of wrapper_exe_dir and LD_LIBRARY_PATH
+	// followed by num_libs bytes with fallback_libs[].use (padded to 8 bytes),
+	// followed by num_files struct launch_cache_file
+};
+
+struct launch_cache_file
+{
+	uint64_t dev, ino, size;
+	int64_t mtime_sec, mtime_nsec;
+	uint32_t exists;
+	uint32_t path_len; // incl. terminating '\0', the path follows this struct (padded to 8 bytes)
+};
+
+#define LAUNCH_CACHE_ALIGN(x) (((x) + 7) & ~(size_t)7)
+
+static void get_file_identity(const char* path, struct launch_cache_file* f)
+{
+	struct stat st;
+	memset(f, 0, sizeof(*f));
+	if(stat(path, &st) == 0)
+	{
+		f->exists = 1;
+		f->dev = st.st_dev;
+		f->ino = st.st_ino;
+		f->size = st.st_size;
+		f->mtime_sec = st.st_mtim.tv_sec;
+		f->mtime_nsec = st.st_mtim.tv_nsec;
+	}
+}
+
+// writes the path of the launch cache file for this wrapper to out (PATH_MAX bytes)
+// if create_dir is set, the directory it's in is created if necessary
+static int get_launch_cache_path(char* out, int create_dir)
+{
+	char dir[PATH_MAX];
+	if(!get_wrapper_cache_dir(dir, create_dir))  return 0;
+
+	// several wrapped apps can share the cache dir, so the file is named after the wrapper's dir
+	uint64_t hash = fnv1a_64(FNV1A_64_INIT, wrapper_exe_dir, strlen(wrapper_exe_dir));
+	int len = snprintf(out, PATH_MAX, "%s/%016llx.cache", dir, (unsigned long long)hash);
+	return len > 0 && len < PATH_MAX;
+}
+
+// returns 1 and sets fallback_libs[].use if a valid launch cache was found, otherwise 0
+static int read_launch_cache(void)
+{
+	char* no_cache = getenv("WRAPPER_NO_CACHE");
+	if(no_cache != NULL && atoi(no_cache) != 0)  return 0;
+
+	char path[PATH_MAX];
+	if(!get_launch_cache_path(path, 0))  return 0;
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0)  return 0;
+
+	struct stat st;
+	if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct launch_cache_header))
+	{
+		close(fd);
+		return 0;
+	}
+	size_t size = st.st_size;
+	const unsigned char* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(data == MAP_FAILED)  return 0;
+
+	int ret = 0;
+	const struct launch_cache_header* hdr = (const struct launch_cache_header*)data;
+	if(memcmp(hdr->magic, LAUNCH_CACHE_MAGIC, sizeof(hdr->magic)) != 0
+	   || hdr->version != LAUNCH_CACHE_VERSION || hdr->num_libs != (uint32_t)NUM_FALLBACK_LIBS
+	   || hdr->env_hash != get_launch_cache_env_hash())
+	{
+		dprintf("Launch cache %s is outdated\n", path);
+		goto out;
+	}
+
+	const unsigned char* use = data + sizeof(*hdr);
+	size_t off = sizeof(*hdr) + LAUNCH_CACHE_ALIGN(hdr->num_libs);
+	for(uint32_t i=0; i < hdr->num_files; ++i)
+	{
+		const struct launch_cache_file* f = (const struct launch_cache_file*)(data + off);
+		if(off > size || sizeof(*f) > size - off || f->path_len == 0
+		   || f->path_len > size - off - sizeof(*f))
+		{
+			dprintf("Launch cache %s is corrupt\n", path);
+			goto out;
+		}
+		const char* file_path = (const char*)(f + 1);
+		if(file_path[f->path_len - 1] != '\0')  goto out;
+
+		struct launch_cache_file cur;
+		get_file_identity(file_path, &cur);
+		if(cur.exists != f->exists || (cur.exists && (cur.dev != f->dev || cur.ino != f->ino
+		   || cur.size != f->size || cur.mtime_sec != f->mtime_sec || cur.mtime_nsec != f->mtime_nsec)))
+		{
+			dprintf("Launch cache is outdated because %s has changed\n", file_path);
+			goto out;
+		}
+
+		off += LAUNCH_CACHE_ALIGN(sizeof(*f) + f->path_len);
+	}
+
+	for(int i=0; i < NUM_FALLBACK_LIBS; ++i)
+	{
+		fallback_libs[i].use = use[i];
+		if(use[i])  dprintf("Launch cache: Overwriting System %s\n", fallback_libs[i].name);
+	}
+	dprintf("Using decisions from launch cache %s\n", path);
+	ret = 1;
+
+out:
+	munmap((void*)data, size);
+	return ret;
+}
+
+// records the identity of all files that influence the lib lookup, apart from the probed libs
+static void record_environment_files(void)
+{
+	record_probed_file("/proc/self/exe"); // if the wrapper is updated, its config might have changed
+	record_probed_file("/etc/ld.so.cache");
+
+	// libs could be added to or removed from directories in LD_LIBRARY_PATH
+	const char* ld_path = getenv("LD_LIBRARY_PATH");
+	while(ld_path != NULL && *ld_path != '\0')
+	{
+		char dir[PATH_MAX];
+		const char* colon = strchr(ld_path, ':');
+		size_t len = (colon != NULL) ? (size_t)(colon - ld_path) : strlen(ld_path);
+		if(len < sizeof(dir))
+		{
+			memcpy(dir, ld_path, len);
+			dir[len] = '\0';
+			record_probed_file(len != 0 ? dir : "."); // an empty entry means the current dir
+		}
+		ld_path = (colon != NULL) ? colon+1 : NULL;
+	}
+}
+
+// writes the decisions of check_fallback_libs() and the identities of all probed files
+// to the launch cache. failing to do so is not fatal, so this doesn't return anything
+static void write_launch_cache(void)
+{
+	char path[PATH_MAX];
+	char tmp_path[PATH_MAX + 32];
+	record_environment_files();
+	if(probed_files_incomplete || !get_launch_cache_path(path, 1))  return;
+
+	size_t size = sizeof(struct launch_cache_header) + LAUNCH_CACHE_ALIGN(NUM_FALLBACK_LIBS);
+	for(int i=0; i < num_probed_files; ++i)
+	{
+		size += LAUNCH_CACHE_ALIGN(sizeof(struct launch_cache_file) + strlen(probed_files[i]) + 1);
+	}
+
+	unsigned char* data = calloc(1, size);
+	if(data == NULL)  return;
+
+	struct launch_cache_header* hdr = (struct launch_cache_header*)data;
+	memcpy(hdr->magic, LAUNCH_CACHE_MAGIC, sizeof(hdr->magic));
+	hdr->version = LAUNCH_CACHE_VERSION;
+	hdr->num_libs = NUM_FALLBACK_LIBS;
+	hdr->num_files = num_probed_files;
+	hdr->env_hash = get_launch_cache_env_hash();
+
+	for(int i=0; i < NUM_FALLBACK_LIBS; ++i)
+	{
+		data[sizeof(*hdr) + i] = fallback_libs[i].use ? 1 : 0;
+	}
+
+	size_t off = sizeof(*hdr) + LAUNCH_CACHE_ALIGN(NUM_FALLBACK_LIBS);
+	for(int i=0; i < num_probed_files; ++i)
+	{
+		struct launch_cache_file* f = (struct launch_cache_file*)(data + off);
+		get_file_identity(probed_files[i], f);
+		f->path_len = strlen(probed_files[i]) + 1;
+		memcpy(f + 1, probed_files[i], f->path_len);
+		off += LAUNCH_CACHE_ALIGN(sizeof(*f) + f->path_len);
+	}
+
+	// write to a temporary file and rename() it, so concurrently started instances
+	// never see a half-written cache
+	snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, (int)getpid());
+	int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if(fd >= 0)
+	{
+		int ok = (write(fd, data, size) == (ssize_t)size);
+		ok = (close(fd) == 0) && ok;
+		if(ok && rename(tmp_path, path) == 0)
+		{
+			dprintf("Wrote launch cache %s\n", path);
+		}
+		else
+		{
+			unlink(tmp_path);
+		}
+	}
+	free(data);
+}
+#endif // USE_LAUNCH_CACHE
+
+#ifdef PASS_DECISIONS_TO_RELAUNCHES
+#define RELAUNCH_TOKEN_VERSION 1
+
+static uint64_t hash_file_identity(uint64_t hash, const char* path)
+{
+	struct stat st;
+	if(stat(path, &st) != 0)
+	{
+		const int missing = -1;
+		return fnv1a_64(hash, &missing, sizeof(missing));
+	}
+	uint64_t id[5] = { st.st_dev, st.st_ino, st.st_size, st.st_mtim.tv_sec, st.st_mtim.tv_nsec };
+	return fnv1a_64(hash, id, sizeof(id));
+}
+
+// hashes the identities of the files the decisions depend on, so relaunches can cheaply check
+// if the decisions in WRAPPER_STATE are still valid. The system libs themselves aren't checked
+// (finding them would be most of the work), but installing or updating them runs ldconfig
+// which rewrites /etc/ld.so.cache
+static uint64_t get_relaunch_identity(void)
+{
+	uint64_t hash = get_launch_cache_env_hash();
+	hash = hash_file_identity(hash, "/proc/self/exe");
+	hash = hash_file_identity(hash, "/etc/ld.so.cache");
+
+	char path[PATH_MAX];
+	if(get_app_exe_path(path))  hash = hash_file_identity(hash, path);
+	for(int i=0; i < NUM_FALLBACK_LIBS; ++i)
+	{
+		if(get_bundled_lib_path(&fallback_libs[i], path))  hash = hash_file_identity(hash, path);
+	#ifdef COMPRESSED_LIBS
+		if(get_compressed_lib_path(&fallback_libs[i], path))  hash = hash_file_identity(hash, path);
+	#endif
+	}
+	return hash;
+}
+
+// get_relaunch_identity() with the original LD_LIBRARY_PATH, set by read_relaunch_token()
+static uint64_t relaunch_identity = 0;
+
+static uint64_t hash_env_var(const char* name)
+{
+	const char* val = getenv(name);
+	return (val != NULL && val[0] != '\0') ? fnv1a_64(FNV1A_64_INIT, val, strlen(val)) : 0;
+}
+
+// WRAPPER_STATE is "version:identity:ld_library_path_hash:use" with use being a '0' or '1' per lib
+static int parse_relaunch_token(unsigned long long* identity, unsigned long long* ld_path_hash, const char** use)
+{
+	const char* token = getenv("WRAPPER_STATE");
+	unsigned version = 0;
+	int use_offset = 0;
+	if(token == NULL || sscanf(token, "%u:%llx:%llx:%n", &version, identity, ld_path_hash, &use_offset) != 3
+	   || use_offset == 0 || version != RELAUNCH_TOKEN_VERSION
+	   || strlen(token + use_offset) != NUM_FALLBACK_LIBS || getenv("WRAPPER_ORIG_LD_LIBRARY_PATH") == NULL)
+	{
+		return 0;
+	}
+	*use = token + use_offset;
+	return 1;
+}
+
+#ifdef COMPRESSED_LIBS
+// returns 1 if the LD_LIBRARY_PATH entry (of len chars) is in a directory compressed libs are
+// extracted to (see get_extraction_dir()), like ~/.cache/linux-app-wrapper/libs/<hash>
+static int is_extraction_dir_entry(const char* entry, size_t len)
+{
+	char dir[PATH_MAX];
+	for(int i=0; i < 2; ++i)
+	{
+		const char* runtime_dir = getenv("XDG_RUNTIME_DIR");
+		int ok = (i == 0) ? get_wrapper_cache_dir(dir, 0)
+		         : (runtime_dir != NULL && runtime_dir[0] == '/'
+		            && snprintf(dir, PATH_MAX, "%s/linux-app-wrapper", runtime_dir) < PATH_MAX - 8);
+		if(!ok)  continue;
+
+		strcat(dir, "/libs/");
+		size_t dir_len = strlen(dir);
+		if(len > dir_len && memcmp(entry, dir, dir_len) == 0)  return 1;
+	}
+	return 0;
+}
+#endif
+
+// returns 1 if the LD_LIBRARY_PATH entry (of len chars) is (a subdirectory of) a fallback lib dir,
+// or (with COMPRESSED_LIBS) a directory a bundled lib was extracted to
+static int is_fallback_dir_entry(const char* entry, size_t len)
+{
+#ifdef COMPRESSED_LIBS
+	if(is_extraction_dir_entry(entry, len))  return 1;
+#endif
+	size_t wrapper_dir_len = strlen(wrapper_exe_dir);
+	if(len <= wrapper_dir_len || memcmp(entry, wrapper_exe_dir, wrapper_dir_len) != 0 || entry[wrapper_dir_len] != '/')
+		return 0;
+
+	entry += wrapper_dir_len + 1;
+	len -= wrapper_dir_len + 1;
+	for(int i=0; i < NUM_FALLBACK_LIBS; ++i)
+	{
+		size_t dir_len = strlen(fallback_libs[i].dir);
+		if(len >= dir_len && memcmp(entry, fallback_libs[i].dir, dir_len) == 0
+		   && (len == dir_len || entry[dir_len] == '/'))
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// removes the fallback lib dirs from LD_LIBRARY_PATH, so they're not mistaken for the system's libs
+static void remove_fallback_dirs_from_ld_library_path(void)
+{
+	const char* old_val = getenv("LD_LIBRARY_PATH");
+	char* new_val = (old_val != NULL) ? malloc(strlen(old_val) + 1) : NULL;
+	if(new_val == NULL)  return;
+
+	size_t new_len = 0;
+	for(const char* entry = old_val; entry != NULL; )
+	{
+		const char* colon = strchr(entry, ':');
+		size_t len = (colon != NULL) ? (size_t)(colon - entry) : strlen(entry);
+		if(!is_fallback_dir_entry(entry, len))
+		{
+			if(new_len > 0)  new_val[new_len++] = ':';
+			memcpy(new_val + new_len, entry, len);
+			new_len += len;
+		}
+		entry = (colon != NULL) ? colon + 1 : NULL;
+	}
+	new_val[new_len] = '\0';
+
+	if(new_len > 0)
+		setenv("LD_LIBRARY_PATH", new_val, 1);
+	else
+		unsetenv("LD_LIBRARY_PATH");
+	dprintf("Relaunched through the wrapper with a modified LD_LIBRARY_PATH, removed the fallback dirs: '%s'\n", new_val);
+	free(new_val);
+}
+
+// if the wrapper was started by the app it launched before, LD_LIBRARY_PATH contains the
+// wrapper's changes. Restore the original one (the decisions and the launch cache are
+// based on that), or if the app changed it, at least remove the wrapper's entries
+static void restore_original_ld_library_path(void)
+{
+	unsigned long long identity, ld_path_hash;
+	const char* use;
+	if(!parse_relaunch_token(&identity, &ld_path_hash, &use))
+		return;
+
+	if(hash_env_var("LD_LIBRARY_PATH") != ld_path_hash)
+	{
+		remove_fallback_dirs_from_ld_library_path();
+		return;
+	}
+
+	const char* orig = getenv("WRAPPER_ORIG_LD_LIBRARY_PATH");
+	if(orig[0] != '\0')
+		setenv("LD_LIBRARY_PATH", orig, 1);
+	else
+		unsetenv("LD_LIBRARY_PATH");
+	dprintf("Relaunched through the wrapper, restored original LD_LIBRARY_PATH '%s'\n", orig);
+}
+
+// returns 1 if WRAPPER_STATE has valid decisions (they're applied to fallback_libs then)
+static int read_relaunch_token(void)
+{
+	relaunch_identity = get_relaunch_identity();
+
+	char* no_cache = getenv("WRAPPER_NO_CACHE");
+	if(no_cache != NULL && atoi(no_cache) != 0)  return 0;
+
+	unsigned long long identity, ld_path_hash;
+	const char* use;
+	if(!parse_relaunch_token(&identity, &ld_path_hash, &use))  return 0;
+
+	if(identity != relaunch_identity)
+	{
+		dprintf("WRAPPER_STATE is outdated\n");
+		return 0;
+	}
+	for(int i=0; i < NUM_FALLBACK_LIBS; ++i)
+	{
+		fallback_libs[i].use = (use[i] == '1');
+		if(fallback_libs[i].use)  dprintf("WRAPPER_STATE: Overwriting System %s\n", fallback_libs[i].name);
+	}
+	dprintf("Using decisions from WRAPPER_STATE\n");
+	return 1;
+}
+
+// must be called after read_relaunch_token() and set_ld_library_path(),
+// orig_ld_path is LD_LIBRARY_PATH before the latter
+static void write_relaunch_token(const char* orig_ld_path)
+{
+	char token[64 + NUM_FALLBACK_LIBS];
+	int len = snprintf(token, sizeof(token), "%u:%016llx:%016llx:", RELAUNCH_TOKEN_VERSION,
+	                   (unsigned long long)relaunch_identity, (unsigned long long)hash_env_var("LD_LIBRARY_PATH"));
+	for(int i=0; i < NUM_FALLBACK_LIBS; ++i)  token[len++] = fallback_libs[i].use ? '1' : '0';
+	token[len] = '\0';
+
+	if(setenv("WRAPPER_STATE", token, 1) != 0
+	   || setenv("WRAPPER_ORIG_LD_LIBRARY_PATH", (orig_ld_path != NULL) ? orig_ld_path : "", 1) != 0)
+	{
+		unsetenv("WRAPPER_STATE");
+	}
+}
+#endif // PASS_DECISIONS_TO_RELAUNCHES
+
+#ifdef LAUNCH_VIA_LDSO
+static int ldso_launch = 0; // set by prepare_ldso_launch()
+static int ldso_supports_preload = 0;
+static char ldso_path[PATH_MAX]; // the dynamic linker from the app's PT_INTERP
+// set by set_ld_library_path() if ldso_launch is set, passed to the dynamic linker
+// with --library-path instead of setting LD_LIBRARY_PATH
+static char* ldso_library_path = NULL;
+
+// checks if the app can be launched through its dynamic linker, returns 1 if so
+static int prepare_ldso_launch(void)
+{
+	char* var = getenv("WRAPPER_LAUNCH_VIA_LDSO");
+	if(var != NULL && var[0] != '\0' && atoi(var) == 0)  return 0;
+
+	char exe_path[PATH_MAX];
+	struct elf_file ef;
+	if(!get_app_exe_path(exe_path) || !elf_open(exe_path, &ef))  return 0;
+
+	ldso_path[0] = '\0';
+	for(int i=0; i < ef.ehdr->e_phnum; ++i)
+	{
+		const ElfW(Phdr)* ph = &ef.phdrs[i];
+		if(ph->p_type == PT_INTERP && ph->p_filesz > 1 && ph->p_filesz < PATH_MAX
+		   && ph->p_offset <= ef.size && ph->p_filesz <= ef.size - ph->p_offset)
+		{
+			memcpy(ldso_path, ef.data + ph->p_offset, ph->p_filesz);
+			ldso_path[ph->p_filesz] = '\0';
+		}
+	}
+	elf_close(&ef);
+
+	if(ldso_path[0] == '\0')
+	{
+		dprintf("%s has no PT_INTERP, can't launch it through the dynamic linker\n", exe_path);
+		return 0;
+	}
+
+	// the dynamic linker's options are documented in its --help output, which is part of
+	// the binary, so looking for them there tells us if they're supported without running it
+	if(!elf_open(ldso_path, &ef))  return 0;
+	int ret = memmem(ef.data, ef.size, "--library-path", 14) != NULL
+	          && memmem(ef.data, ef.size, "--argv0", 7) != NULL;
+	ldso_supports_preload = memmem(ef.data, ef.size, "--preload", 9) != NULL;
+	elf_close(&ef);
+
+	if(!ret)
+	{
+		dprintf("%s doesn't support --argv0, will use LD_LIBRARY_PATH\n", ldso_path);
+	}
+	return ret;
+}
+#endif // LAUNCH_VIA_LDSO
+
+#if defined(AUDIT_MODULE) || defined(LDPROFILE_MODULE)
+// adds module_path to the start of LD_AUDIT, other LD_AUDIT modules (e.g. from a profiler) are kept
+static int prepend_ld_audit(const char* module_path)
+{
+	const char* old_val = getenv("LD_AUDIT");
+	char new_val[4*PATH_MAX];
+	int len;
+	if(old_val != NULL && path_list_contains(old_val, strlen(old_val), module_path, strlen(module_path)))
+		len = snprintf(new_val, sizeof(new_val), "%s", old_val); // (when relaunched through the wrapper)
+	else if(old_val != NULL && old_val[0] != '\0')
+		len = snprintf(new_val, sizeof(new_val), "%s:%s", module_path, old_val);
+	else
+		len = snprintf(new_val, sizeof(new_val), "%s", module_path);
+
+	if(len <= 0 || len >= sizeof(new_val) || setenv("LD_AUDIT", new_val, 1) != 0)  return 0;
+
+	dprintf("Set LD_AUDIT to '%s'\n", new_val);
+	return 1;
+}
+#endif // AUDIT_MODULE || LDPROFILE_MODULE
+
+#ifdef AUDIT_MODULE
+static char audit_module_path[PATH_MAX] = {0}; // set by set_audit_map() if the module is used
+
+// sets WRAPPER_AUDIT_MAP with the sonames the audit module should redirect to the
+// bundled libs, and LD_AUDIT (unless launching through ld.so, then it's passed with --audit)
+// returns 1 if the module will be used, 0 if LD_LIBRARY_PATH must be set instead
+static int set_audit_map(void)
+{
+	char module_path[PATH_MAX];
+	int len = snprintf(module_path, sizeof(module_path), "%s/%s", wrapper_exe_dir, AUDIT_MODULE);
+	if(len <= 0 || len >= sizeof(module_path))  return 0;
+
+	if(!is_compatible_elf(module_path))
+	{
+		dprintf("Audit module %s is missing or not usable, will use LD_LIBRARY_PATH\n", module_path);
+		return 0;
+	}
+
+	char map[NUM_FALLBACK_LIBS * (PATH_MAX + 64)];
+	size_t map_len = 0;
+	map[0] = '\0';
+	for(int i=0; i < NUM_FALLBACK_LIBS; ++i)
+	{
+		if(!fallback_libs[i].use || fallback_libs[i].preload)  continue;
+
+		char lib_path[PATH_MAX];
+		// ':' and '=' are the separators in the map, and no sane path contains them anyway
+		if(!get_bundled_lib_path(&fallback_libs[i], lib_path)
+		   || strchr(lib_path, ':') != NULL || strchr(lib_path, '=') != NULL
+		   || strchr(module_path, ':') != NULL)
+		{
+			dprintf("Can't pass %s to the audit module, will use LD_LIBRARY_PATH\n", lib_path);
+			return 0;
+		}
+		len = snprintf(map + map_len, sizeof(map) - map_len, "%s%s=%s",
+		               (map_len > 0) ? ":" : "", fallback_libs[i].name, lib_path);
+		if(len <= 0 || len >= sizeof(map) - map_len)  return 0;
+		map_len += len;
+	}
+
+	if(map_len == 0)  return 1; // only preloaded libs are used
+
+	if(setenv("WRAPPER_AUDIT_MAP", map, 1) != 0)  return 0;
+
+#ifdef LAUNCH_VIA_LDSO
+	if(ldso_launch)
+	{
+		strcpy(audit_module_path, module_path);
+		dprintf("Will launch through %s with --audit %s and WRAPPER_AUDIT_MAP '%s'\n", ldso_path, module_path, map);
+		return 1;
+	}
+#endif
+
+	if(!prepend_ld_audit(module_path))
+	{
+		unsetenv("WRAPPER_AUDIT_MAP");
+		return 0;
+	}
+
+	strcpy(audit_module_path, module_path);
+	dprintf("Set WRAPPER_AUDIT_MAP to '%s'\n", map);
+	return 1;
+}
+#endif // AUDIT_MODULE
+
+#ifdef LDPROFILE_MODULE
+// adds the profiler module to LD_AUDIT if WRAPPER_LDPROFILE is set, and tells it which libs
+// are bundled (WRAPPER_LDPROFILE_BUNDLED) and where the app is (WRAPPER_LDPROFILE_APP_DIR).
+// The module removes WRAPPER_LDPROFILE from the environment and itself (WRAPPER_LDPROFILE_MODULE)
+// from LD_AUDIT, so only the app itself is profiled
+static void set_ldprofile(void)
+{
+	const char* var = getenv("WRAPPER_LDPROFILE");
+	if(var == NULL || var[0] == '\0' || strcmp(var, "0") == 0)  return;
+
+	char module_path[PATH_MAX];
+	int len = snprintf(module_path, sizeof(module_path), "%s/%s", wrapper_exe_dir, LDPROFILE_MODULE);
+	if(len <= 0 || len >= sizeof(module_path) || !is_compatible_elf(module_path) || strchr(module_path, ':') != NULL)
+	{
+		eprintf("WRAPPER_LDPROFILE is set, but the profiler module %s is missing or not usable\n", module_path);
+		return;
+	}
+
+	char bundled[NUM_FALLBACK_LIBS * PATH_MAX] = {0};
+	size_t bundled_len = 0;
+	for(int i=0; i < NUM_FALLBACK_LIBS; ++i)
+	{
+		char path[PATH_MAX];
+		if(fallback_libs[i].use && get_bundled_lib_path(&fallback_libs[i], path))
+		{
+			bundled_len += snprintf(bundled + bundled_len, sizeof(bundled) - bundled_len, "%s%s", (bundled_len > 0) ? ":" : "", path);
+		}
+	}
+
+	if(setenv("WRAPPER_LDPROFILE_BUNDLED", bundled, 1) != 0 || setenv("WRAPPER_LDPROFILE_APP_DIR", wrapper_exe_dir, 1) != 0
+	   || setenv("WRAPPER_LDPROFILE_MODULE", module_path, 1) != 0 || !prepend_ld_audit(module_path))
+	{
+		eprintf("Couldn't set up the environment for the profiler module\n");
+		return;
+	}
+	dprintf("Set WRAPPER_LDPROFILE_BUNDLED to '%s'\n", bundled);
+}
+#endif // LDPROFILE_MODULE
+
+static int set_ld_library_path(void)
+{
+	char* old_val = getenv("LD_LIBRARY_PATH");
+	size_t len = 1; // 1 for terminating \0,
+	if(old_val != NULL)
+	{
+		if(old_val[0] != '\0')  len += strlen(old_val) + 1; // +1 for ":"
+		else old_val = NULL;
+	}
+
+	// Note: using absolute paths (=> prepending wrapper_exe_dir)
+
+	// +1 for the '/' that will be added after wrapper_exe_dir before APP_EXECUTABLE
+	const int wrapper_dir_len = strlen(wrapper_exe_dir) + 1;
+
+	int num_used_overrides = 0;
+	for(int i=0; i < NUM_FALLBACK_LIBS; ++i)
+	{
+		if(fallback_libs[i].use && !fallback_libs[i].preload)
+		{
+			// + 1 for  separating ":" between entries
+			len += wrapper_dir_len + strlen(fallback_libs[i].dir) + 1;
+			if(fallback_libs[i].extracted_path != NULL)
+			{
+				len += strlen(fallback_libs[i].extracted_path);
+			}
+			else if(fallback_libs[i].hwcaps != NULL)
+			{
+				len += strlen("/glibc-hwcaps/") + strlen(fallback_libs[i].hwcaps);
+			}
+			++num_used_overrides;
+		}
+	}
+
+	if(num_used_overrides == 0)
+	{
+		dprintf("no need to modify LD_LIBRARY_PATH\n");
+		return 1; // nothing to do
+	}
+
+#ifdef AUDIT_MODULE
+	if(set_audit_map())  return 1;
+#endif
+
+	char* new_val = malloc(len);
+	if(new_val == NULL)  return 0; // malloc failed (unlikely)
+
+	new_val[0] = '\0';
+
+	for(int i=0; i < NUM_FALLBACK_LIBS; ++i)
+	{
+		if(fallback_libs[i].use && !fallback_libs[i].preload)
+		{
+			// using strcat() here is safe because we checked the lengths above
+			// and set len accordingly
+			const char* extracted = fallback_libs[i].extracted_path;
+			if(extracted != NULL)
+			{
+				// the directory it was extracted to
+				strncat(new_val, extracted, strrchr(extracted, '/') - extracted);
+				strcat(new_val, ":");
+				continue;
+			}
+			strcat(new_val, wrapper_exe_dir);
+			strcat(new_val, "/");
+			strcat(new_val, fallback_libs[i].dir);
+			if(fallback_libs[i].hwcaps != NULL)
+			{
+				strcat(new_val, "/glibc-hwcaps/");
+				strcat(new_val, fallback_libs[i].hwcaps);
+			}
+			strcat(new_val, ":");
+		}
+	}
+
+	if(old_val != NULL)
+	{
+		// entries that are already in it (e.g. because the app restarted itself through
+		// the wrapper) are skipped, so LD_LIBRARY_PATH doesn't keep growing
+		append_path_list(new_val, old_val);
+	}
+	new_val[strlen(new_val) - 1] = '\0'; // remove the last added ":"
+
+#ifdef LAUNCH_VIA_LDSO
+	if(ldso_launch)
+	{
+		// run_executable() passes this to the dynamic linker, LD_LIBRARY_PATH stays unmodified
+		dprintf("Will launch through %s with --library-path '%s'\n", ldso_path, new_val);
+		ldso_library_path = new_val;
+		return 1;
+	}
+#endif
+
+	int ret = (setenv("LD_LIBRARY_PATH", new_val, 1) == 0);
+
+	if(ret) {
+		dprintf("Set LD_LIBRARY_PATH to '%s'\n", new_val);
+	} else {
+		int e = errno;
+		eprintf("Failed to set LD_LIBRARY_PATH to '%s' : errnno %d (%s)\n", new_val, e, strerror(e));
+	}
+
+	free(new_val);
+	return ret;
+}
+
+#ifdef HUGETEXT_SHIM
+// writes the path of the hugetext shim to out (PATH_MAX bytes) and returns 1 if it should
+// be preloaded. With WRAPPER_HUGETEXT=2, the used bundled libs are passed to it in
+// WRAPPER_HUGETEXT_LIBS so it remaps their code as well
+static int prepare_hugetext_shim(char* out)
+{
+	const char* var = getenv("WRAPPER_HUGETEXT");
+	int mode = (var != NULL && var[0] != '\0') ? atoi(var) : 1;
+	if(mode == 0)  return 0;
+
+	int len = snprintf(out, PATH_MAX, "%s/%s", wrapper_exe_dir, HUGETEXT_SHIM);
+	if(len <= 0 || len >= PATH_MAX || access(out, R_OK) != 0)
+	{
+		dprintf("Hugetext shim %s not found\n", out);
+		return 0;
+	}
+	if(strpbrk(out, " :") != NULL)
+	{
+		eprintf("Can't preload %s, its path contains spaces or colons\n", out);
+		return 0;
+	}
+	// so it can remove itself from LD_PRELOAD
+	setenv("WRAPPER_HUGETEXT_SHIM", out, 1);
+
+	if(mode >= 2)
+	{
+		char libs[NUM_FALLBACK_LIBS * PATH_MAX] = {0};
+		size_t libs_len = 0;
+		for(int i=0; i < NUM_FALLBACK_LIBS; ++i)
+		{
+			char path[PATH_MAX];
+			if(fallback_libs[i].use && !fallback_libs[i].preload && get_bundled_lib_path(&fallback_libs[i], path))
+			{
+				libs_len += snprintf(libs + libs_len, sizeof(libs) - libs_len, "%s%s", (libs_len > 0) ? ":" : "", path);
+			}
+		}
+		if(libs_len > 0 && setenv("WRAPPER_HUGETEXT_LIBS", libs, 1) == 0)
+		{
+			dprintf("Set WRAPPER_HUGETEXT_LIBS to '%s'\n", libs);
+		}
+	}
+	return 1;
+}
+#endif // HUGETEXT_SHIM
+
+#if defined(PRELOAD_ALLOCATOR) || defined(HUGETEXT_SHIM)
+#ifdef LAUNCH_VIA_LDSO
+// set by set_ld_preload() if launching through ld.so, passed to it with --preload
+static char* ldso_preload = NULL;
+#endif
+
+// adds the used bundled libs that must be preloaded (and the hugetext shim) to the start of
+// LD_PRELOAD (keeping what's already in there), or passes them to the dynamic linker when
+// launching through it
+static int set_ld_preload(void)
+{
+	char preload[(NUM_FALLBACK_LIBS + 1) * PATH_MAX];
+	size_t len = 0;
+	preload[0] = '\0';
+	for(int i=0; i < NUM_FALLBACK_LIBS; ++i)
+	{
+		char path[PATH_MAX];
+		if(!fallback_libs[i].use || !fallback_libs[i].preload)  continue;
+		// LD_PRELOAD is separated by spaces or colons
+		if(!get_bundled_lib_path(&fallback_libs[i], path) || strpbrk(path, " :") != NULL)
+		{
+			eprintf("Can't preload %s, its path is too long or contains spaces or colons\n", fallback_libs[i].name);
+			continue;
+		}
+		len += snprintf(preload + len, sizeof(preload) - len, "%s%s", (len > 0) ? ":" : "", path);
+	}
+#ifdef HUGETEXT_SHIM
+	char shim_path[PATH_MAX];
+	if(prepare_hugetext_shim(shim_path))
+	{
+		len += snprintf(preload + len, sizeof(preload) - len, "%s%s", (len > 0) ? ":" : "", shim_path);
+	}
+#endif
+	if(len == 0)  return 1;
+
+#ifdef LAUNCH_VIA_LDSO
+	if(ldso_launch && ldso_supports_preload)
+	{
+		ldso_preload = strdup(preload);
+		if(ldso_preload != NULL)
+		{
+			dprintf("Will launch through %s with --preload '%s'\n", ldso_path, preload);
+			return 1;
+		}
+	}
+#endif
+
+	const char* old_val = getenv("LD_PRELOAD");
+	if(old_val != NULL && old_val[0] != '\0')
+	{
+		char* new_val = malloc(len + strlen(old_val) + 3);
+		if(new_val == NULL)  return 0;
+		sprintf(new_val, "%s:", preload);
+		// entries that are already in it (e.g. because the app restarted itself through
+		// the wrapper) are skipped
+		append_path_list(new_val, old_val);
+		new_val[strlen(new_val) - 1] = '\0'; // remove the last added ":"
+		int ret = (setenv("LD_PRELOAD", new_val, 1) == 0);
+		if(ret)  dprintf("Set LD_PRELOAD to '%s'\n", new_val);
+		free(new_val);
+		return ret;
+	}
+
+	int ret = (setenv("LD_PRELOAD", preload, 1) == 0);
+	if(ret)  dprintf("Set LD_PRELOAD to '%s'\n", preload);
+	return ret;
+}
+#endif // PRELOAD_ALLOCATOR || HUGETEXT_SHIM
+
+#ifdef PREFETCH_LIBS
+enum { MAX_PREFETCH_FILES = 256 };
+
+static char* prefetch_files[MAX_PREFETCH_FILES];
+static int num_prefetch_files = 0;
+
+// tells the kernel to read the whole file into the page cache in the background
+// (posix_fadvise() only queues the reads, so this doesn't block on the disk)
+static void prefetch_file(const char* path)
+{
+	for(int i=0; i < num_prefetch_files; ++i)
+	{
+		if(strcmp(prefetch_files[i], path) == 0)  return;
+	}
+	if(num_prefetch_files == MAX_PREFETCH_FILES)  return;
+
+	char* p = strdup(path);
+	if(p == NULL)  return;
+	prefetch_files[num_prefetch_files++] = p;
+	dprintf("Prefetching %s\n", path);
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0)  return;
+	posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+	close(fd);
+}
+
+// reads the executable and the libs it (transitively) needs into the page cache,
+// resolving them like the dynamic linker will with the final search order.
+// runs in the detached helper process started by start_prefetch()
+static void prefetch_closure(void)
+{
+	char path[PATH_MAX];
+	if(!get_app_exe_path(path))  return;
+
+	prefetch_file(path);
+
+	for(int l=0; l < NUM_FALLBACK_LIBS; ++l)
+	{
+		if(fallback_libs[l].use && fallback_libs[l].preload && get_bundled_lib_path(&fallback_libs[l], path))
+			prefetch_file(path);
+	}
+
+	const char* library_path = getenv("LD_LIBRARY_PATH");
+#ifdef LAUNCH_VIA_LDSO
+	if(ldso_library_path != NULL)  library_path = ldso_library_path;
+#endif
+
+	// prefetch_files[] grows while walking it, so this is a breadth-first
+	// walk over the dependency graph (and duplicates are skipped)
+	for(int i=0; i < num_prefetch_files; ++i)
+	{
+		struct elf_file ef;
+		if(!elf_open(prefetch_files[i], &ef))  continue;
+
+		if(i == 0)
+		{
+			for(int p=0; p < ef.ehdr->e_phnum; ++p)
+			{
+				const ElfW(Phdr)* ph = &ef.phdrs[p];
+				if(ph->p_type == PT_INTERP && ph->p_filesz > 1 && ph->p_filesz < PATH_MAX
+				   && ph->p_offset <= ef.size && ph->p_filesz <= ef.size - ph->p_offset)
+				{
+					snprintf(path, sizeof(path), "%.*s", (int)ph->p_filesz, ef.data + ph->p_offset);
+					prefetch_file(path);
+				}
+			}
+		}
+
+		// DT_RPATH is only used if there's no DT_RUNPATH
+		char rpath[4096] = {0};
+		char runpath[4096] = {0};
+		ElfW(Xword) val;
+		const char* str;
+		if(elf_dyn_val(&ef, DT_RUNPATH, &val) && (str = elf_dyn_string(&ef, val)) != NULL)
+			expand_origin(str, prefetch_files[i], runpath, sizeof(runpath));
+		else if(elf_dyn_val(&ef, DT_RPATH, &val) && (str = elf_dyn_string(&ef, val)) != NULL)
+			expand_origin(str, prefetch_files[i], rpath, sizeof(rpath));
+
+		for(size_t d=0; d < ef.num_dyn && ef.dyn[d].d_tag != DT_NULL; ++d)
+		{
+			if(ef.dyn[d].d_tag != DT_NEEDED)  continue;
+			const char* name = elf_dyn_string(&ef, ef.dyn[d].d_un.d_val);
+			if(name == NULL)  continue;
+
+			int found = 0;
+		#ifdef AUDIT_MODULE
+			// the audit module redirects those before any search
+			for(int l=0; l < NUM_FALLBACK_LIBS && audit_module_path[0] != '\0'; ++l)
+			{
+				if(fallback_libs[l].use && strcmp(fallback_libs[l].name, name) == 0)
+				{
+					found = get_bundled_lib_path(&fallback_libs[l], path);
+					break;
+				}
+			}
+		#endif
+			// same order as the dynamic linker: DT_RPATH, LD_LIBRARY_PATH, DT_RUNPATH, ld.so.cache, default dirs
+			if(!found)  found = find_lib_in_dirs(name, rpath, path) || find_lib_in_dirs(name, library_path, path)
+			                    || find_lib_in_dirs(name, runpath, path) || resolve_lib_path_from(name, NULL, path);
+			if(found)  prefetch_file(path);
+		}
+		elf_close(&ef);
+	}
+
+	dprintf("Prefetched %d files\n", num_prefetch_files);
+}
+
+static void start_prefetch(void)
+{
+	const char* var = getenv("WRAPPER_PREFETCH");
+	if(var != NULL && var[0] != '\0' && atoi(var) == 0)  return;
+
+	fflush(stdout); // so buffered debug output isn't written twice
+
+	pid_t pid = fork();
+	if(pid == 0)
+	{
+		// fork again so the helper isn't a child of the app (which is what this
+		// process becomes after execv()) and gets reaped by init instead
+		if(fork() == 0)
+		{
+			prefetch_closure();
+			fflush(stdout);
+		}
+		_exit(0);
+	}
+	else if(pid > 0)
+	{
+		while(waitpid(pid, NULL, 0) < 0 && errno == EINTR) {}
+	}
+	else
+	{
+		int e = errno;
+		dprintf("Couldn't start prefetch helper: errno %d (%s)\n", e, strerror(e));
+	}
+}
+#endif // PREFETCH_LIBS
+
+#if defined(LAUNCH_POLICY_FILE) || defined(LAUNCHER_DAEMON) || defined(SET_MALLOC_TUNABLES) || defined(SET_CPU_BUDGET_VARS)
+// parses a list like "0-3,8,10-11" (as used by the kernel and taskset) and calls
+// cb(num, user) for each number, returns 0 if it's invalid
+static int parse_num_list(const char* list, void (*cb)(int num, void* user), void* user)
+{
+	const char* c = list;
+	while(*c != '\0' && *c != '\n')
+	{
+		char* end;
+		long first = strtol(c, &end, 10);
+		if(end == c || first < 0)  return 0;
+		long last = first;
+		if(*end == '-')
+		{
+			c = end + 1;
+			last = strtol(c, &end, 10);
+			if(end == c || last < first)  return 0;
+		}
+		for(long n = first; n <= last && n < 65536; ++n)  cb((int)n, user);
+
+		c = end;
+		if(*c == ',')  ++c;
+		else if(*c != '\0' && *c != '\n')  return 0;
+	}
+	return 1;
+}
+
+static void add_cpu_cb(int num, void* user)
+{
+	if(num < CPU_SETSIZE)  CPU_SET(num, (cpu_set_t*)user);
+}
+#endif // LAUNCH_POLICY_FILE || LAUNCHER_DAEMON || SET_MALLOC_TUNABLES || SET_CPU_BUDGET_VARS
+
+#if defined(LAUNCH_POLICY_FILE) || defined(LAUNCHER_DAEMON)
+// reads a number list like /sys/devices/system/cpu/online into set
+static int read_cpu_list_file(const char* path, cpu_set_t* set)
+{
+	char buf[4096];
+	FILE* f = fopen(path, "re");
+	if(f == NULL)  return 0;
+	int ret = fgets(buf, sizeof(buf), f) != NULL && parse_num_list(buf, add_cpu_cb, set);
+	fclose(f);
+	return ret;
+}
+// sets cpus to the hardware threads of the instance-th physical core (modulo the number
+// of cores), with the cores ordered by their lowest CPU number, from the sysfs topology
+static int get_physical_core_cpus(int instance, cpu_set_t* cpus)
+{
+	cpu_set_t online, seen;
+	CPU_ZERO(&online);
+	CPU_ZERO(&seen);
+	if(!read_cpu_list_file("/sys/devices/system/cpu/online", &online))  return 0;
+
+	cpu_set_t cores[256];
+	int num_cores = 0;
+	for(int cpu=0; cpu < CPU_SETSIZE && num_cores < 256; ++cpu)
+	{
+		if(!CPU_ISSET(cpu, &online) || CPU_ISSET(cpu, &seen))  continue;
+
+		char path[128];
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+		CPU_ZERO(&cores[num_cores]);
+		if(!read_cpu_list_file(path, &cores[num_cores]))  CPU_SET(cpu, &cores[num_cores]);
+
+		CPU_AND(&cores[num_cores], &cores[num_cores], &online);
+		CPU_OR(&seen, &seen, &cores[num_cores]);
+		++num_cores;
+	}
+	if(num_cores == 0)  return 0;
+
+	*cpus = cores[instance % num_cores];
+	dprintf("Instance %d gets physical core %d of %d (%d threads)\n", instance, instance % num_cores, num_cores, CPU_COUNT(cpus));
+	return 1;
+}
+#endif // LAUNCH_POLICY_FILE || LAUNCHER_DAEMON
+
+#if defined(SET_MALLOC_TUNABLES) || defined(SET_CPU_BUDGET_VARS)
+// finds the directory of this process' cgroup for the given cgroup v1 controller (like "memory")
+// or, if that controller isn't mounted as v1, the cgroup v2 directory
+// returns the length of the mount point at the start of out (0 if there's no cgroup)
+static size_t get_cgroup_dir(const char* v1_controller, char* out, int* is_v2)
+{
+	FILE* f = fopen("/proc/self/cgroup", "re");
+	if(f == NULL)  return 0;
+
+	char line[1024];
+	char v2_path[PATH_MAX] = {0};
+	size_t ret = 0;
+	while(ret == 0 && fgets(line, sizeof(line), f) != NULL)
+	{
+		line[strcspn(line, "\n")] = '\0';
+		// "hierarchy-ID:controller-list:cgroup-path"
+		char* controllers = strchr(line, ':');
+		char* path = (controllers != NULL) ? strchr(controllers + 1, ':') : NULL;
+		if(path == NULL)  continue;
+		*path++ = '\0';
+		++controllers;
+
+		if(strcmp(line, "0") == 0 && *controllers == '\0')
+		{
+			snprintf(v2_path, sizeof(v2_path), "%s", path);
+			continue;
+		}
+		for(char* c = strtok(controllers, ","); c != NULL; c = strtok(NULL, ","))
+		{
+			if(strcmp(c, v1_controller) == 0)
+			{
+				int len = snprintf(out, PATH_MAX, "/sys/fs/cgroup/%s%s", v1_controller, path);
+				if(len > 0 && len < PATH_MAX)  ret = strlen("/sys/fs/cgroup/") + strlen(v1_controller);
+				*is_v2 = 0;
+				break;
+			}
+		}
+	}
+	fclose(f);
+
+	if(ret == 0 && v2_path[0] != '\0')
+	{
+		int len = snprintf(out, PATH_MAX, "/sys/fs/cgroup%s", v2_path);
+		if(len > 0 && len < PATH_MAX)  ret = strlen("/sys/fs/cgroup");
+		*is_v2 = 1;
+	}
+	return ret;
+}
+
+// calls cb(contents, dir, user) with the (first line of the) given file in this process' cgroup
+// (in dir) and all its parents, because their limits apply as well. (In containers the path from
+// /proc/self/cgroup often doesn't exist in the container's view, then only its root is read)
+static void foreach_cgroup_level(const char* v1_controller, const char* v1_file, const char* v2_file,
+                                 void (*cb)(const char* contents, const char* dir, void* user), void* user)
+{
+	char dir[PATH_MAX];
+	int is_v2 = 0;
+	size_t root_len = get_cgroup_dir(v1_controller, dir, &is_v2);
+	if(root_len == 0)  return;
+
+	for(;;)
+	{
+		char path[PATH_MAX + 64];
+		snprintf(path, sizeof(path), "%s/%s", dir, is_v2 ? v2_file : v1_file);
+		FILE* f = fopen(path, "re");
+		if(f != NULL)
+		{
+			char buf[256];
+			if(fgets(buf, sizeof(buf), f) != NULL)
+			{
+				buf[strcspn(buf, "\n")] = '\0';
+				cb(buf, dir, user);
+			}
+			fclose(f);
+		}
+
+		char* slash = strrchr(dir, '/');
+		if(slash == NULL || (size_t)(slash - dir) < root_len)  break;
+		*slash = '\0';
+	}
+}
+
+struct cpu_budget
+{
+	int cpus;                // the number of CPUs this process can make use of
+	int affinity;            // the number of CPUs in its affinity mask (or online)
+	int cpuset;              // the number of CPUs in the smallest cgroup cpuset, 0 if there's none
+	uint64_t quota_permille; // the smallest cgroup CPU bandwidth limit in 1/1000 CPUs, 0 if there's none
+};
+
+static void min_cpuset_cb(const char* contents, const char* dir, void* user)
+{
+	(void)dir;
+	int* num = user;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if(contents[0] != '\0' && parse_num_list(contents, add_cpu_cb, &set) && CPU_COUNT(&set) > 0
+	   && (*num == 0 || CPU_COUNT(&set) < *num))
+	{
+		*num = CPU_COUNT(&set);
+	}
+}
+
+static void min_cpu_quota_cb(const char* contents, const char* dir, void* user)
+{
+	uint64_t* permille = user;
+	char* end;
+	long long quota = strtoll(contents, &end, 10);
+	if(end == contents || quota <= 0)  return; // "max" (v2) or -1 (v1) mean no limit
+
+	long long period = 0;
+	if(*end == ' ')
+	{
+		period = strtoll(end + 1, NULL, 10); // cgroup v2 cpu.max is "quota period"
+	}
+	else
+	{
+		// cgroup v1 has the period in its own file
+		char path[PATH_MAX + 32];
+		snprintf(path, sizeof(path), "%s/cpu.cfs_period_us", dir);
+		FILE* f = fopen(path, "re");
+		if(f != NULL)
+		{
+			if(fscanf(f, "%lld", &period) != 1)  period = 0;
+			fclose(f);
+		}
+	}
+	if(period <= 0)  return;
+
+	uint64_t val = (uint64_t)quota * 1000 / period;
+	if(*permille == 0 || val < *permille)  *permille = val;
+}
+
+// figures out how many CPUs this process can make use of: the ones it may run on (affinity
+// and cgroup cpusets), limited by the cgroups' CPU bandwidth (quota / period, rounded up).
+// In containers, sysconf(_SC_NPROCESSORS_ONLN) returns the host's CPUs instead
+static void get_cpu_budget(struct cpu_budget* budget)
+{
+	memset(budget, 0, sizeof(*budget));
+
+	cpu_set_t cpus;
+	if(sched_getaffinity(0, sizeof(cpus), &cpus) == 0 && CPU_COUNT(&cpus) > 0)
+	{
+		budget->affinity = CPU_COUNT(&cpus);
+	}
+	else
+	{
+		long num = sysconf(_SC_NPROCESSORS_ONLN);
+		budget->affinity = (num > 0) ? (int)num : 1;
+	}
+	foreach_cgroup_level("cpuset", "cpuset.effective_cpus", "cpuset.cpus.effective", min_cpuset_cb, &budget->cpuset);
+	foreach_cgroup_level("cpu", "cpu.cfs_quota_us", "cpu.max", min_cpu_quota_cb, &budget->quota_permille);
+
+	budget->cpus = budget->affinity;
+	if(budget->cpuset > 0 && budget->cpuset < budget->cpus)  budget->cpus = budget->cpuset;
+	if(budget->quota_permille > 0)
+	{
+		uint64_t quota_cpus = (budget->quota_permille + 999) / 1000;
+		if(quota_cpus < (uint64_t)budget->cpus)  budget->cpus = (int)quota_cpus;
+	}
+}
+#endif // SET_MALLOC_TUNABLES || SET_CPU_BUDGET_VARS
+
+#ifdef SET_MALLOC_TUNABLES
+static void min_memory_limit_cb(const char* contents, const char* dir, void* user)
+{
+	(void)dir;
+	uint64_t* limit = user;
+	char* end;
+	unsigned long long val = strtoull(contents, &end, 10);
+	// cgroup v2 uses "max", v1 a huge number for "no limit"
+	if(end != contents && val < *limit)  *limit = val;
+}
+
+// returns the memory available to this process: the physical memory or the cgroup limit if that's lower
+static uint64_t get_memory_limit(void)
+{
+	long pages = sysconf(_SC_PHYS_PAGES);
+	long page_size = sysconf(_SC_PAGESIZE);
+	uint64_t limit = (pages > 0 && page_size > 0) ? (uint64_t)pages * page_size : UINT64_MAX;
+	foreach_cgroup_level("memory", "memory.limit_in_bytes", "memory.max", min_memory_limit_cb, &limit);
+	return limit;
+}
+
+// returns the transparent hugepage mode ("always", "madvise" or "never"), or NULL if unknown
+static const char* get_thp_mode(void)
+{
+	static char mode[16];
+	FILE* f = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "re");
+	if(f == NULL)  return NULL;
+	char buf[128];
+	const char* ret = NULL;
+	if(fgets(buf, sizeof(buf), f) != NULL)
+	{
+		// the active mode is in brackets, like "always [madvise] never"
+		char* start = strchr(buf, '[');
+		char* end = (start != NULL) ? strchr(start, ']') : NULL;
+		if(end != NULL && (size_t)(end - start) < sizeof(mode))
+		{
+			snprintf(mode, sizeof(mode), "%.*s", (int)(end - start - 1), start + 1);
+			ret = mode;
+		}
+	}
+	fclose(f);
+	return ret;
+}
+
+// appends "key=value" to tunables (":"-separated), unless user_tunables already sets key
+static void add_tunable(char* tunables, size_t size, const char* user_tunables, const char* key, uint64_t value, const char* why)
+{
+	size_t key_len = strlen(key);
+	for(const char* t = user_tunables; t != NULL && *t != '\0'; )
+	{
+		if(strncmp(t, key, key_len) == 0 && t[key_len] == '=')
+		{
+			dprintf("Tunables: keeping user's %.*s\n", (int)strcspn(t, ":"), t);
+			return;
+		}
+		t = strchr(t, ':');
+		if(t != NULL)  ++t;
+	}
+
+	size_t len = strlen(tunables);
+	snprintf(tunables + len, size - len, "%s%s=%llu", (len > 0) ? ":" : "", key, (unsigned long long)value);
+	dprintf("Tunables: %s=%llu because %s\n", key, (unsigned long long)value, why);
+	trace_arg_str(trace_add("tunable", 'i', 0), key, why);
+}
+
+// sets GLIBC_TUNABLES for glibc's malloc based on the CPUs, memory limit and THP mode
+static int set_malloc_tunables(void)
+{
+#ifdef PRELOAD_ALLOCATOR
+	for(int i=0; i < NUM_FALLBACK_LIBS; ++i)
+	{
+		if(fallback_libs[i].use && fallback_libs[i].preload)
+		{
+			dprintf("Tunables: not tuning glibc's malloc, %s is preloaded\n", fallback_libs[i].name);
+			return 1;
+		}
+	}
+#endif
+	const uint64_t MiB = 1024 * 1024;
+	struct cpu_budget budget;
+	get_cpu_budget(&budget);
+	int cpus = budget.cpus;
+	uint64_t mem = get_memory_limit();
+	const char* thp = get_thp_mode();
+	dprintf("Tunables: %d CPUs, memory limit %llu MiB, transparent hugepages: %s\n", cpus,
+	        (unsigned long long)(mem / MiB), (thp != NULL) ? thp : "unknown");
+
+	const char* user_tunables = getenv("GLIBC_TUNABLES");
+	char tunables[512] = {0};
+
+	// by default glibc allows 8 arenas per CPU (on 64bit), each can reserve up to 64MiB
+	// which wastes a lot of memory with many threads and small limits, and more arenas
+	// than CPUs don't reduce contention much anyway. Leave 128MiB of the limit per arena.
+	uint64_t arena_max = (uint64_t)cpus;
+	const char* why = "one arena per available CPU";
+	if(mem / (128 * MiB) < arena_max)
+	{
+		arena_max = mem / (128 * MiB);
+		why = "memory limit allows one arena per 128MiB";
+	}
+	if(arena_max < 1)  arena_max = 1;
+	add_tunable(tunables, sizeof(tunables), user_tunables, "glibc.malloc.arena_max", arena_max, why);
+
+	// with THP in "madvise" mode, malloc only gets hugepages if it asks for them (glibc 2.35+,
+	// older versions ignore it). They cost up to 2MiB of extra memory per mapping, so not in small containers
+	if(thp != NULL && strcmp(thp, "madvise") == 0 && mem >= 2048 * MiB)
+	{
+		add_tunable(tunables, sizeof(tunables), user_tunables, "glibc.malloc.hugetlb", 1,
+		            "transparent hugepages are in madvise mode and there's enough memory");
+	}
+
+	// a bigger per-thread cache (default: 7 chunks per size) avoids locking the arenas,
+	// which matters most if many threads share them
+	if(cpus >= 8 && mem >= 4096 * MiB)
+	{
+		add_tunable(tunables, sizeof(tunables), user_tunables, "glibc.malloc.tcache_count", 32,
+		            "there are many CPUs and enough memory");
+	}
+
+	if(tunables[0] == '\0')  return 1;
+
+	char new_val[1024];
+	int len = (user_tunables != NULL && user_tunables[0] != '\0')
+	          ? snprintf(new_val, sizeof(new_val), "%s:%s", user_tunables, tunables)
+	          : snprintf(new_val, sizeof(new_val), "%s", tunables);
+	if(len <= 0 || len >= sizeof(new_val))  return 1; // not important enough to fail the launch
+
+	if(setenv("GLIBC_TUNABLES", new_val, 1) != 0)
+	{
+		int e = errno;
+		eprintf("Failed to set GLIBC_TUNABLES to '%s' : errno %d (%s)\n", new_val, e, strerror(e));
+		return 1;
+	}
+	dprintf("Set GLIBC_TUNABLES to '%s'\n", new_val);
+	return 1;
+}
+#endif // SET_MALLOC_TUNABLES
+
+#ifdef SET_CPU_BUDGET_VARS
+// sets the environment variables in SET_CPU_BUDGET_VARS to the CPU budget, unless they're already set
+static void set_cpu_budget_vars(void)
+{
+	struct cpu_budget budget;
+	get_cpu_budget(&budget);
+	char quota[32] = "none";
+	if(budget.quota_permille > 0)
+	{
+		snprintf(quota, sizeof(quota), "%llu.%03llu CPUs", (unsigned long long)(budget.quota_permille / 1000),
+		         (unsigned long long)(budget.quota_permille % 1000));
+	}
+	dprintf("CPU budget: %d (affinity: %d CPUs, cgroup cpuset: %d CPUs, cgroup quota: %s)\n",
+	        budget.cpus, budget.affinity, budget.cpuset, quota);
+
+	struct trace_event* ev = trace_add("cpu_budget", 'i', 0);
+	trace_arg_int(ev, "cpus", budget.cpus);
+	trace_arg_int(ev, "affinity", budget.affinity);
+	trace_arg_int(ev, "cpuset", budget.cpuset);
+	trace_arg_int(ev, "quota_permille", (long long)budget.quota_permille);
+
+	char val[16];
+	snprintf(val, sizeof(val), "%d", budget.cpus);
+	for(const char* names = SET_CPU_BUDGET_VARS; *names != '\0'; )
+	{
+		size_t len = strcspn(names, ":");
+		char name[128];
+		if(len > 0 && len < sizeof(name))
+		{
+			memcpy(name, names, len);
+			name[len] = '\0';
+			const char* old_val = getenv(name);
+			if(old_val != NULL && old_val[0] != '\0')
+			{
+				dprintf("Keeping %s=%s\n", name, old_val);
+			}
+			else if(setenv(name, val, 1) != 0)
+			{
+				int e = errno;
+				eprintf("Failed to set %s to %s : errno %d (%s)\n", name, val, e, strerror(e));
+			}
+			else
+			{
+				dprintf("Set %s to %s\n", name, val);
+			}
+		}
+		names += len;
+		if(*names == ':')  ++names;
+	}
+}
+#endif // SET_CPU_BUDGET_VARS
+
+#ifdef LAUNCH_POLICY_FILE
+enum { MAX_POLICY_ENTRIES = 32 };
+
+static struct {
+	char* key;
+	char* value;
+} policy_entries[MAX_POLICY_ENTRIES];
+
+static int num_policy_entries = 0;
+
+static char* trim(char* str)
+{
+	while(isspace((unsigned char)*str))  ++str;
+	char* end = str + strlen(str);
+	while(end > str && isspace((unsigned char)end[-1]))  --end;
+	*end = '\0';
+	return str;
+}
 
-	sdl_getversion = dlsym(handle, "SDL_GetVersion");
-	if(sdl_getversion == NULL)
+static void read_policy_file(void)
+{
+	char path[PATH_MAX];
+	int len = snprintf(path, sizeof(path), "%s/%s", wrapper_exe_dir, LAUNCH_POLICY_FILE);
+	if(len <= 0 || len >= sizeof(path))  return;
+
+	FILE* f = fopen(path, "re");
+	if(f == NULL)  return;
+
+	char line[1024];
+	int line_num = 0;
+	while(fgets(line, sizeof(line), f) != NULL)
 	{
-		eprintf("Couldn't find SDL_GetVersion() in %s !\n", path);
+		++line_num;
+		char* comment = strchr(line, '#');
+		if(comment != NULL)  *comment = '\0';
+
+		char* key = trim(line);
+		if(*key == '\0')  continue;
+
+		char* eq = strchr(key, '=');
+		if(eq == NULL)
+		{
+			eprintf("%s:%d: expected \"key = value\"\n", path, line_num);
+			continue;
+		}
+		*eq = '\0';
+		key = trim(key);
+		char* value = trim(eq + 1);
+
+		if(num_policy_entries < MAX_POLICY_ENTRIES)
+		{
+			policy_entries[num_policy_entries].key = strdup(key);
+			policy_entries[num_policy_entries].value = strdup(value);
+			if(policy_entries[num_policy_entries].key != NULL && policy_entries[num_policy_entries].value != NULL)
+				++num_policy_entries;
+		}
+	}
+	fclose(f);
+	dprintf("Read %d policy settings from %s\n", num_policy_entries, path);
+}
+
+// returns the value for key from the WRAPPER_<KEY> environment variable,
+// or NULL if it's not set
+static const char* get_policy_env_value(const char* key)
+{
+	char env_name[64] = "WRAPPER_";
+	size_t len = strlen(env_name);
+	for(const char* c = key; *c != '\0' && len < sizeof(env_name) - 1; ++c)
+	{
+		env_name[len++] = toupper((unsigned char)*c);
+	}
+	env_name[len] = '\0';
+
+	const char* ret = getenv(env_name);
+	return (ret != NULL && ret[0] != '\0') ? ret : NULL;
+}
+
+// returns the value for key from the WRAPPER_<KEY> environment variable or the
+// policy file, or NULL if it's not set
+static const char* get_policy_value(const char* key)
+{
+	const char* ret = get_policy_env_value(key);
+	if(ret != NULL)  return ret;
+
+	for(int i=0; i < num_policy_entries; ++i)
+	{
+		if(strcmp(policy_entries[i].key, key) == 0)  return policy_entries[i].value;
+	}
+	return NULL;
+}
+
+static void apply_cpu_policy(void)
+{
+	const char* cpus_str = get_policy_value("cpus");
+	const char* core_str = get_policy_value("core_per_instance");
+	// core_per_instance wins if both are set in the same place, but a WRAPPER_CPUS
+	// overrides a core_per_instance from the file (like any other key)
+	if(get_policy_env_value("cpus") != NULL && get_policy_env_value("core_per_instance") == NULL)
+	{
+		core_str = NULL;
+	}
+	if(cpus_str == NULL && core_str == NULL)  return;
+
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	int ok;
+	if(core_str != NULL)
+	{
+		char* end;
+		long instance = strtol(core_str, &end, 10);
+		ok = (end != core_str && *end == '\0' && instance >= 0 && get_physical_core_cpus((int)instance, &cpus));
 	}
 	else
 	{
-		sdl_getversion(&ret);
+		ok = parse_num_list(cpus_str, add_cpu_cb, &cpus) && CPU_COUNT(&cpus) > 0;
 	}
 
-	dlclose(handle);
-	return ret;
+	if(!ok)
+	{
+		eprintf("Policy: invalid CPU setting '%s'\n", (core_str != NULL) ? core_str : cpus_str);
+	}
+	else if(sched_setaffinity(0, sizeof(cpus), &cpus) != 0)
+	{
+		int e = errno;
+		eprintf("Policy: couldn't set CPU affinity: errno %d (%s)\n", e, strerror(e));
+	}
+	else
+	{
+		dprintf("Policy: set CPU affinity to %d CPUs\n", CPU_COUNT(&cpus));
+	}
 }
-#endif // CHECK_LIBSDL2
 
+// for set_mempolicy(), which glibc doesn't wrap (it's in libnuma)
+#define WRAPPER_MPOL_PREFERRED  1
+#define WRAPPER_MPOL_BIND       2
+#define WRAPPER_MPOL_INTERLEAVE 3
 
+struct node_mask
+{
+	unsigned long bits[1024 / (8 * sizeof(unsigned long))];
+};
 
-// directory the wrapper executable is in, *without* trailing slash
-static char wrapper_exe_dir[PATH_MAX] = {0};
+static void add_node_cb(int num, void* user)
+{
+	struct node_mask* mask = user;
+	const int bits_per_long = 8 * sizeof(unsigned long);
+	if(num < 1024)  mask->bits[num / bits_per_long] |= 1UL << (num % bits_per_long);
+}
 
-// returns 1 after successfully setting wrapper_exe_dir to the directory this wrapper is in,
-// otherwise it returns 0
-static int set_wrapper_dir(void)
+static void apply_numa_policy(void)
 {
+	const char* nodes_str = get_policy_value("numa_nodes");
+	if(nodes_str == NULL)  return;
+
+	const char* policy_str = get_policy_value("numa_policy");
+	int mode = WRAPPER_MPOL_BIND;
+	if(policy_str != NULL && strcmp(policy_str, "preferred") == 0)  mode = WRAPPER_MPOL_PREFERRED;
+	else if(policy_str != NULL && strcmp(policy_str, "interleave") == 0)  mode = WRAPPER_MPOL_INTERLEAVE;
+	else if(policy_str != NULL && strcmp(policy_str, "bind") != 0)
 	{
-		// taken from https://github.com/DanielGibson/Snippets/blob/master/DG_misc.h
-	#if defined(__linux)
-		// readlink() doesn't null-terminate!
-		int len = readlink("/proc/self/exe", wrapper_exe_dir, PATH_MAX-1);
-		if (len <= 0)
+		eprintf("Policy: invalid numa_policy '%s' (use bind, preferred or interleave)\n", policy_str);
+		return;
+	}
+
+	struct node_mask mask;
+	memset(&mask, 0, sizeof(mask));
+	if(!parse_num_list(nodes_str, add_node_cb, &mask))
+	{
+		eprintf("Policy: invalid numa_nodes '%s'\n", nodes_str);
+		return;
+	}
+
+	// the kernel uses maxnode-1 bits of the mask
+	if(syscall(SYS_set_mempolicy, mode, mask.bits, (unsigned long)(sizeof(mask.bits) * 8 + 1)) != 0)
+	{
+		int e = errno;
+		eprintf("Policy: couldn't set NUMA memory policy: errno %d (%s)\n", e, strerror(e));
+	}
+	else
+	{
+		dprintf("Policy: set NUMA memory policy %d for nodes %s\n", mode, nodes_str);
+	}
+}
+
+static void apply_sched_policy(void)
+{
+	const char* sched_str = get_policy_value("sched");
+	if(sched_str != NULL)
+	{
+		static const struct { const char* name; int policy; } policies[] = {
+			{ "other", SCHED_OTHER }, { "batch", SCHED_BATCH }, { "idle", SCHED_IDLE },
+			{ "fifo", SCHED_FIFO }, { "rr", SCHED_RR }
+		};
+		int policy = -1;
+		struct sched_param param;
+		memset(&param, 0, sizeof(param));
+		for(size_t i=0; i < sizeof(policies)/sizeof(policies[0]); ++i)
 		{
-			// an error occured, clear exe path
-			wrapper_exe_dir[0] = '\0';
+			size_t len = strlen(policies[i].name);
+			if(strncmp(sched_str, policies[i].name, len) == 0 && (sched_str[len] == '\0' || sched_str[len] == ':'))
+			{
+				policy = policies[i].policy;
+				if(sched_str[len] == ':')  param.sched_priority = atoi(sched_str + len + 1);
+				break;
+			}
+		}
+
+		if(policy < 0)
+		{
+			eprintf("Policy: invalid sched '%s'\n", sched_str);
+		}
+		else if(sched_setscheduler(0, policy, &param) != 0)
+		{
+			int e = errno;
+			eprintf("Policy: couldn't set scheduling policy '%s': errno %d (%s)\n", sched_str, e, strerror(e));
 		}
 		else
 		{
-			wrapper_exe_dir[len] = '\0';
+			dprintf("Policy: set scheduling policy '%s'\n", sched_str);
 		}
-	#elif defined(__FreeBSD__) // TODO: really keep this?
-		// the sysctl should also work when /proc/ is not mounted (which seems to
-		// be common on FreeBSD), so use it..
-		int name[4] = {CTL_KERN, KERN_PROC, KERN_PROC_PATHNAME, -1};
-		size_t len = PATH_MAX-1;
-		int ret = sysctl(name, sizeof(name)/sizeof(name[0]), wrapper_exe_dir, &len, NULL, 0);
-		if(ret != 0)
+	}
+
+	const char* nice_str = get_policy_value("nice");
+	if(nice_str != NULL)
+	{
+		char* end;
+		long nice_val = strtol(nice_str, &end, 10);
+		if(end == nice_str || *end != '\0' || nice_val < -20 || nice_val > 19)
 		{
-			// an error occured, clear exe path
-			wrapper_exe_dir[0] = '\0';
+			eprintf("Policy: invalid nice '%s'\n", nice_str);
+		}
+		else if(setpriority(PRIO_PROCESS, 0, (int)nice_val) != 0)
+		{
+			int e = errno;
+			eprintf("Policy: couldn't set nice value %ld: errno %d (%s)\n", nice_val, e, strerror(e));
+		}
+		else
+		{
+			dprintf("Policy: set nice value %ld\n", nice_val);
 		}
-	#else
-		error "Unsupported Platform!" // not sure how useful this even is on other platforms
-	#endif
 	}
+}
 
-	if(wrapper_exe_dir[0] != '\0')
+// from linux/ioprio.h, glibc doesn't wrap ioprio_set()
+#define WRAPPER_IOPRIO_CLASS_SHIFT 13
+#define WRAPPER_IOPRIO_WHO_PROCESS 1
+
+static void apply_ioprio_policy(void)
+{
+	const char* ioprio_str = get_policy_value("ioprio");
+	if(ioprio_str == NULL)  return;
+
+	int ioclass = 0, level = 0;
+	if(strncmp(ioprio_str, "rt", 2) == 0)  ioclass = 1;
+	else if(strncmp(ioprio_str, "be", 2) == 0)  ioclass = 2;
+	else if(strcmp(ioprio_str, "idle") == 0)  ioclass = 3;
+
+	if(ioclass == 1 || ioclass == 2)
 	{
-		// find the last slash before the executable name and set it to '\0'
-		// so wrapper_exe_dir contains the full path of the directory the executable is in
-		// then change to that directory
-		char* lastSlash = strrchr(wrapper_exe_dir, '/');
-		if(lastSlash != NULL)
+		level = 4; // the default of the best-effort class
+		if(ioprio_str[2] == ':')  level = atoi(ioprio_str + 3);
+		else if(ioprio_str[2] != '\0')  ioclass = 0;
+	}
+
+	if(ioclass == 0 || level < 0 || level > 7)
+	{
+		eprintf("Policy: invalid ioprio '%s' (use rt:0-7, be:0-7 or idle)\n", ioprio_str);
+	}
+	else if(syscall(SYS_ioprio_set, WRAPPER_IOPRIO_WHO_PROCESS, 0, (ioclass << WRAPPER_IOPRIO_CLASS_SHIFT) | level) != 0)
+	{
+		int e = errno;
+		eprintf("Policy: couldn't set I/O priority '%s': errno %d (%s)\n", ioprio_str, e, strerror(e));
+	}
+	else
+	{
+		dprintf("Policy: set I/O priority '%s'\n", ioprio_str);
+	}
+}
+
+static void apply_rlimit_policy(void)
+{
+	static const struct { const char* key; int resource; } limits[] = {
+		{ "rlimit_nofile", RLIMIT_NOFILE }, { "rlimit_memlock", RLIMIT_MEMLOCK },
+		{ "rlimit_core", RLIMIT_CORE }, { "rlimit_stack", RLIMIT_STACK },
+		{ "rlimit_nproc", RLIMIT_NPROC }, { "rlimit_as", RLIMIT_AS },
+		{ "rlimit_rtprio", RLIMIT_RTPRIO }, { "rlimit_nice", RLIMIT_NICE }
+	};
+
+	for(size_t i=0; i < sizeof(limits)/sizeof(limits[0]); ++i)
+	{
+		const char* val = get_policy_value(limits[i].key);
+		if(val == NULL)  continue;
+
+		struct rlimit rl;
+		if(getrlimit(limits[i].resource, &rl) != 0)  continue;
+
+		if(strcmp(val, "max") == 0)
 		{
-			*lastSlash = '\0';
+			rl.rlim_cur = rl.rlim_max; // raising the soft limit up to the hard limit always works
+		}
+		else if(strcmp(val, "unlimited") == 0)
+		{
+			rl.rlim_cur = rl.rlim_max = RLIM_INFINITY;
+		}
+		else
+		{
+			char* end;
+			unsigned long long num = strtoull(val, &end, 10);
+			if(end == val || *end != '\0')
+			{
+				eprintf("Policy: invalid %s '%s'\n", limits[i].key, val);
+				continue;
+			}
+			rl.rlim_cur = num;
+			// only touch the hard limit if it needs to be raised (which needs privileges)
+			if(rl.rlim_max != RLIM_INFINITY && rl.rlim_max < num)  rl.rlim_max = num;
+		}
 
-			return 1;
+		if(setrlimit(limits[i].resource, &rl) != 0)
+		{
+			int e = errno;
+			eprintf("Policy: couldn't set %s to '%s': errno %d (%s)\n", limits[i].key, val, e, strerror(e));
+		}
+		else
+		{
+			dprintf("Policy: set %s to '%s'\n", limits[i].key, val);
+		}
+	}
+}
+
+// applies the policy from LAUNCH_POLICY_FILE and the WRAPPER_* environment variables
+// to this process, so the app inherits it through execv()
+static void apply_launch_policy(void)
+{
+	read_policy_file();
+	apply_cpu_policy();
+	apply_numa_policy();
+	apply_sched_policy();
+	apply_ioprio_policy();
+	apply_rlimit_policy();
+}
+#endif // LAUNCH_POLICY_FILE
+
+#ifdef SUPERVISE_APP
+static int64_t wrapper_start_time = 0; // trace_now() at the start of main()
+static volatile pid_t supervised_pid = 0;
+static const char* supervisor_log_file = NULL; // from WRAPPER_SUPERVISOR_LOG, made absolute
+
+// called at startup, because a relative path must be relative to the directory the
+// wrapper was started in, not the one it changes to (CHANGE_TO_WRAPPER_DIR)
+static void supervisor_log_init(void)
+{
+	static char abs_path[PATH_MAX];
+	const char* var = getenv("WRAPPER_SUPERVISOR_LOG");
+	if(var == NULL || var[0] == '\0')  return;
+	supervisor_log_file = var;
+	if(var[0] != '/' && getcwd(abs_path, sizeof(abs_path)) != NULL)
+	{
+		size_t len = strlen(abs_path);
+		if(len + 1 + strlen(var) < sizeof(abs_path))
+		{
+			snprintf(abs_path + len, sizeof(abs_path) - len, "/%s", var);
+			supervisor_log_file = abs_path;
+		}
+	}
+}
+
+static void forward_signal(int sig, siginfo_t* info, void* ucontext)
+{
+	(void)ucontext;
+	// signals from the terminal (like Ctrl-C) or the kernel are sent to the whole process
+	// group and thus reach the app anyway, only forward the ones sent with kill() and co
+	if(supervised_pid > 0 && info->si_code <= 0)
+	{
+		kill(supervised_pid, sig);
+	}
+}
+
+static void write_supervisor_log(int status, const struct rusage* ru, int64_t start)
+{
+	char log_path[PATH_MAX];
+	if(supervisor_log_file != NULL)
+	{
+		snprintf(log_path, sizeof(log_path), "%s", supervisor_log_file);
+	}
+	else
+	{
+		char dir[PATH_MAX];
+		if(!get_wrapper_cache_dir(dir, 1))  return;
+		uint64_t hash = fnv1a_64(FNV1A_64_INIT, wrapper_exe_dir, strlen(wrapper_exe_dir));
+		int len = snprintf(log_path, sizeof(log_path), "%s/%016llx-runs.jsonl", dir, (unsigned long long)hash);
+		if(len <= 0 || len >= sizeof(log_path))  return;
+	}
+
+	// (path may be the dynamic linker, with LAUNCH_VIA_LDSO)
+	char app_path[PATH_MAX];
+	if(!get_app_exe_path(app_path))  return;
+
+	char line[4096];
+	size_t len = snprintf(line, sizeof(line), "{\"time\":%lld,\"app\":", (long long)time(NULL));
+	len = json_append_str(line, sizeof(line), len, app_path);
+	if(len >= sizeof(line))  return;
+
+	len += snprintf(line + len, sizeof(line) - len,
+	                ",\"pid\":%d,\"exit_code\":%d,\"signal\":%d,\"wrapper_ms\":%.3f,\"wall_ms\":%.3f"
+	                ",\"user_ms\":%.3f,\"sys_ms\":%.3f,\"max_rss_kb\":%ld,\"minflt\":%ld,\"majflt\":%ld"
+	                ",\"nvcsw\":%ld,\"nivcsw\":%ld,\"overrides\":{",
+	                (int)supervised_pid,
+	                WIFEXITED(status) ? WEXITSTATUS(status) : -1,
+	                WIFSIGNALED(status) ? WTERMSIG(status) : 0,
+	                (start - wrapper_start_time) / 1000.0,
+	                (trace_now() - start) / 1000.0,
+	                ru->ru_utime.tv_sec * 1000.0 + ru->ru_utime.tv_usec / 1000.0,
+	                ru->ru_stime.tv_sec * 1000.0 + ru->ru_stime.tv_usec / 1000.0,
+	                ru->ru_maxrss, ru->ru_minflt, ru->ru_majflt, ru->ru_nvcsw, ru->ru_nivcsw);
+
+	for(int i=0; i < NUM_FALLBACK_LIBS && len < sizeof(line); ++i)
+	{
+		if(i > 0)  line[len++] = ',';
+		len = json_append_str(line, sizeof(line), len, fallback_libs[i].name);
+		if(len < sizeof(line))
+			len += snprintf(line + len, sizeof(line) - len, ":%s", fallback_libs[i].use ? "true" : "false");
+	}
+	if(len + 3 >= sizeof(line))  return;
+	strcpy(line + len, "}}\n");
+	len += 3;
+
+	// with O_APPEND, each line is written in one go even if several instances log at once
+	int fd = open(log_path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+	if(fd < 0 || write(fd, line, len) != (ssize_t)len)
+	{
+		int e = errno;
+		eprintf("Couldn't write to supervisor log %s: errno %d (%s)\n", log_path, e, strerror(e));
+	}
+	if(fd >= 0)  close(fd);
+	dprintf("Appended run of %s to %s\n", app_path, log_path);
+}
+
+// starts the app in a child process, waits for it, logs its resource usage and exits with
+// its exit status (or dies from the same signal). Only returns if the app couldn't be started,
+// with errno set like by execv()
+static void supervise_app(const char* path, char** argv)
+{
+	// the child reports a failing execv() through this pipe (a successful one closes it)
+	int err_pipe[2];
+	if(pipe(err_pipe) != 0)  return;
+	fcntl(err_pipe[0], F_SETFD, FD_CLOEXEC);
+	fcntl(err_pipe[1], F_SETFD, FD_CLOEXEC);
+
+	static const int forwarded_signals[] = { SIGHUP, SIGINT, SIGQUIT, SIGTERM, SIGUSR1, SIGUSR2, SIGALRM, SIGCONT, SIGWINCH };
+	const int num_signals = sizeof(forwarded_signals)/sizeof(forwarded_signals[0]);
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = forward_signal;
+	sa.sa_flags = SA_SIGINFO | SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sigset_t forwarded_set, old_set;
+	sigemptyset(&forwarded_set);
+	for(int i=0; i < num_signals; ++i)
+	{
+		sigaction(forwarded_signals[i], &sa, NULL);
+		sigaddset(&forwarded_set, forwarded_signals[i]);
+	}
+
+	// blocked until supervised_pid is set, so a signal that arrives in between isn't lost
+	// (it stays pending and is forwarded once they're unblocked)
+	sigprocmask(SIG_BLOCK, &forwarded_set, &old_set);
+
+	int64_t start = trace_now();
+	fflush(stdout);
+	pid_t pid = fork();
+	if(pid == 0)
+	{
+		// (execv() resets the handlers to the default, but keeps the signal mask)
+		sigprocmask(SIG_SETMASK, &old_set, NULL);
+		close(err_pipe[0]);
+		execv(path, argv);
+		int e = errno;
+		if(write(err_pipe[1], &e, sizeof(e)) != sizeof(e)) {}
+		_exit(127);
+	}
+	close(err_pipe[1]);
+	if(pid < 0)
+	{
+		int e = errno;
+		close(err_pipe[0]);
+		sigprocmask(SIG_SETMASK, &old_set, NULL);
+		errno = e;
+		return;
+	}
+	supervised_pid = pid;
+	sigprocmask(SIG_SETMASK, &old_set, NULL);
+
+	int exec_errno = 0;
+	ssize_t r;
+	while((r = read(err_pipe[0], &exec_errno, sizeof(exec_errno))) < 0 && errno == EINTR) {}
+	close(err_pipe[0]);
+	if(r == sizeof(exec_errno))
+	{
+		waitpid(pid, NULL, 0);
+		supervised_pid = 0;
+		errno = exec_errno;
+		return;
+	}
+
+	int status = 0;
+	struct rusage ru;
+	memset(&ru, 0, sizeof(ru));
+	while(wait4(pid, &status, 0, &ru) < 0)
+	{
+		if(errno != EINTR)
+		{
+			int e = errno;
+			eprintf("Waiting for %s failed: errno %d (%s)\n", APP_EXECUTABLE, e, strerror(e));
+			exit(1);
+		}
+	}
+
+	write_supervisor_log(status, &ru, start);
+
+	if(WIFSIGNALED(status))
+	{
+		int sig = WTERMSIG(status);
+		dprintf("%s was killed by signal %d\n", APP_EXECUTABLE, sig);
+		fflush(stdout);
+		// die the same way, so whoever started the wrapper sees what happened
+		// (but without a core dump of the wrapper, the app already wrote one, if enabled)
+		struct rlimit no_core = { 0, 0 };
+		setrlimit(RLIMIT_CORE, &no_core);
+		signal(sig, SIG_DFL);
+		sigset_t set;
+		sigemptyset(&set);
+		sigaddset(&set, sig);
+		sigprocmask(SIG_UNBLOCK, &set, NULL);
+		raise(sig);
+		exit(128 + sig); // in case the signal doesn't terminate the process
+	}
+	exit(WIFEXITED(status) ? WEXITSTATUS(status) : 1);
+}
+#endif // SUPERVISE_APP
+
+// replaces the wrapper with the app, or runs it supervised. Only returns if that failed
+static void exec_app(const char* path, char** argv)
+{
+#ifdef SUPERVISE_APP
+	const char* var = getenv("WRAPPER_SUPERVISE");
+	if(var == NULL || var[0] == '\0' || atoi(var) != 0)
+	{
+		supervise_app(path, argv);
+		return;
+	}
+#endif
+	execv(path, argv);
+}
+
+#ifdef LAUNCH_VIA_LDSO
+static const char* get_ldso_audit(void)
+{
+#ifdef AUDIT_MODULE
+	return (ldso_launch && audit_module_path[0] != '\0') ? audit_module_path : NULL;
+#else
+	return NULL;
+#endif
+}
+
+static const char* get_ldso_preload(void)
+{
+#if defined(PRELOAD_ALLOCATOR) || defined(HUGETEXT_SHIM)
+	return ldso_preload;
+#else
+	return NULL;
+#endif
+}
+
+// returns the (malloc()ed) arguments to launch the app through the dynamic linker, like
+// ld.so [--library-path PATH] [--audit MODULE] [--preload LIBS] --argv0 NAME /path/to/app args...
+// or NULL if it's not launched through it (or malloc() failed)
+static char** build_ldso_argv(int argc, char** argv, char* full_exe_path)
+{
+	const char* ldso_audit = get_ldso_audit();
+	const char* preload = get_ldso_preload();
+	if(ldso_library_path == NULL && ldso_audit == NULL && preload == NULL)  return NULL;
+
+	char** ldso_argv = malloc((argc + 10) * sizeof(char*));
+	if(ldso_argv == NULL)  return NULL;
+
+	int n = 0;
+	ldso_argv[n++] = ldso_path;
+	if(ldso_library_path != NULL)
+	{
+		ldso_argv[n++] = "--library-path";
+		ldso_argv[n++] = ldso_library_path;
+	}
+	if(ldso_audit != NULL)
+	{
+		ldso_argv[n++] = "--audit";
+		ldso_argv[n++] = (char*)ldso_audit;
+	}
+	if(preload != NULL)
+	{
+		ldso_argv[n++] = "--preload";
+		ldso_argv[n++] = (char*)preload;
+	}
+	ldso_argv[n++] = "--argv0";
+	ldso_argv[n++] = argv[0];
+	ldso_argv[n++] = full_exe_path;
+	for(int i=1; i < argc; ++i)  ldso_argv[n++] = argv[i];
+	ldso_argv[n] = NULL;
+	return ldso_argv;
+}
+#endif // LAUNCH_VIA_LDSO
+
+// the argv[0] the app gets
+static char* get_app_argv0(void)
+{
+#ifdef APP_NAME
+	if(APP_NAME[0] != '\0')
+	{
+		return APP_NAME; // override argv[0] so it contains your configured app name
+	}
+#endif
+	return APP_EXECUTABLE; // override argv[0] so it contains the name of the launched executable instead of this wrapper
+}
+
+static void run_executable(int argc, char** argv)
+{
+	argv[0] = get_app_argv0();
+
+	char full_exe_path[PATH_MAX];
+	if(get_app_exe_path(full_exe_path))
+	{
+	#ifdef LAUNCH_VIA_LDSO
+		const char* ldso_audit = get_ldso_audit();
+		const char* preload = get_ldso_preload();
+		if(ldso_library_path != NULL || ldso_audit != NULL || preload != NULL)
+		{
+			char** ldso_argv = build_ldso_argv(argc, argv, full_exe_path);
+			if(ldso_argv != NULL)
+			{
+				struct trace_event* ev = trace_add("execv", 'i', 0);
+				trace_arg_str(ev, "path", full_exe_path);
+				trace_arg_str(ev, "ldso", ldso_path);
+				trace_arg_str(ev, "library_path", (ldso_library_path != NULL) ? ldso_library_path : "");
+				trace_arg_str(ev, "audit", (ldso_audit != NULL) ? ldso_audit : "");
+				trace_arg_str(ev, "preload", (preload != NULL) ? preload : "");
+				trace_write();
+				fflush(stdout);
+
+				exec_app(ldso_path, ldso_argv);
+
+				int e = errno;
+				eprintf("Executing %s through %s failed: errno %d (%s), trying without it\n", APP_EXECUTABLE, ldso_path, e, strerror(e));
+				free(ldso_argv);
+			}
+			if(ldso_library_path != NULL && setenv("LD_LIBRARY_PATH", ldso_library_path, 1) != 0)  return;
+		#ifdef AUDIT_MODULE
+			if(ldso_audit != NULL && !prepend_ld_audit(ldso_audit))  return;
+		#endif
+		#if defined(PRELOAD_ALLOCATOR) || defined(HUGETEXT_SHIM)
+			ldso_launch = 0;
+			if(preload != NULL && !set_ld_preload())  return;
+		#endif
 		}
+	#else
+		(void)argc;
+	#endif
+
+		struct trace_event* ev = trace_add("execv", 'i', 0);
+		trace_arg_str(ev, "path", full_exe_path);
+		const char* ld_path = getenv("LD_LIBRARY_PATH");
+		trace_arg_str(ev, "LD_LIBRARY_PATH", (ld_path != NULL) ? ld_path : "");
+	#if defined(PRELOAD_ALLOCATOR) || defined(HUGETEXT_SHIM)
+		const char* ld_preload = getenv("LD_PRELOAD");
+		trace_arg_str(ev, "LD_PRELOAD", (ld_preload != NULL) ? ld_preload : "");
+	#endif
+	#if defined(AUDIT_MODULE) || defined(LDPROFILE_MODULE)
+		const char* ld_audit = getenv("LD_AUDIT");
+		trace_arg_str(ev, "LD_AUDIT", (ld_audit != NULL) ? ld_audit : "");
+	#endif
+		trace_write();
+
+		fflush(stdout); // otherwise debug output is lost if stdout isn't a terminal
+
+		exec_app(full_exe_path, argv);
+
+		// if we get here, execv() failed
+		int e = errno;
+		eprintf("Executing %s failed: errno %d (%s)\n", APP_EXECUTABLE, e, strerror(e));
 	}
-	return 0;
+	// if execv() was successful, this function never returns
 }
 
-// returns 1 after successfully changing to the directory this executable is in,
-// otherwise it returns 0
-static int change_to_wrapper_dir(void)
-{
-	return chdir(wrapper_exe_dir) == 0;
-}
+#ifdef LAUNCHER_DAEMON
+// a launch request is this header (sent with the client's stdin, stdout and stderr as
+// SCM_RIGHTS), followed by data_len bytes: the working directory, argc arguments (without
+// argv[0]) and envc environment entries, each terminated by '\0'.
+// The daemon replies with an int32_t: the PID of the new instance, or -errno
+#define LAUNCH_REQUEST_MAGIC 0x57524c31 // "WRL1"
+#define LAUNCH_REQUEST_MAX_DATA (4 * 1024 * 1024)
 
-struct fallback_lib {
-	const char* name;
-	const char* dir;
-	int use; // set by check_fallback_libs()
+struct launch_request
+{
+	uint32_t magic;
+	uint32_t argc;
+	uint32_t envc;
+	uint32_t data_len;
 };
 
-static struct fallback_lib fallback_libs[] = {
-#ifdef CHECK_LIBSTDCPP
-	{ "libstdc++.so.6", FALLBACK_DIR_STDCPP, 0 },
-#endif
-#ifdef CHECK_LIBGCC
-	{ "libgcc_s.so.1", FALLBACK_DIR_GCC, 0 },
-#endif
-#ifdef CHECK_LIBSDL2
-	{ "libSDL2-2.0.so.0", FALLBACK_DIR_SDL2, 0 },
-#endif
-#ifdef CHECK_LIBCURL4
-	{ "libcurl.so.4", FALLBACK_DIR_CURL, 0 },
-#endif
+// these are taken from the daemon's environment (the wrapper set them up),
+// all other variables from the client's
+static const char* const daemon_env_vars[] = {
+	"LD_LIBRARY_PATH", "LD_PRELOAD", "LD_AUDIT", "WRAPPER_AUDIT_MAP", "GLIBC_TUNABLES",
+	"WRAPPER_STATE", "WRAPPER_ORIG_LD_LIBRARY_PATH", NULL
 };
 
-static const int NUM_FALLBACK_LIBS = sizeof(fallback_libs)/sizeof(fallback_libs[0]);
+static volatile sig_atomic_t daemon_stop = 0;
 
-static int check_fallback_libs(void)
+static void stop_daemon(int sig)
 {
-	int sys_ver, our_ver;
-	char local_path[PATH_MAX];
+	(void)sig;
+	daemon_stop = 1;
+}
 
-	int fb_lib_idx = 0;
+// returns 1 if the environment entry ("NAME=value") is for one of names
+static int is_env_var_in(const char* entry, const char* const* names)
+{
+	for(int i=0; names[i] != NULL; ++i)
+	{
+		size_t len = strlen(names[i]);
+		if(strncmp(entry, names[i], len) == 0 && entry[len] == '=')  return 1;
+	}
+	return 0;
+}
 
-#ifdef CHECK_LIBSTDCPP
-	sys_ver = get_libstdcpp_version(fallback_libs[fb_lib_idx].name);
-	snprintf(local_path, PATH_MAX, "%s/%s", fallback_libs[fb_lib_idx].dir, fallback_libs[fb_lib_idx].name);
-	our_ver = get_libstdcpp_version(local_path);
-	dprintf("System libstdc++ version: %s ours: %s\n", get_gcc_version_name(libstdcpp_version_checks, sys_ver),
-	                                                   get_gcc_version_name(libstdcpp_version_checks, our_ver));
-	if(our_ver > sys_ver)
+static const char* get_env_entry_value(char** env, const char* name)
+{
+	size_t len = strlen(name);
+	for(int i=0; env[i] != NULL; ++i)
 	{
-		dprintf("Overwriting System libstdc++\n");
-		fallback_libs[fb_lib_idx].use = 1;
+		if(strncmp(env[i], name, len) == 0 && env[i][len] == '=')  return env[i] + len + 1;
 	}
+	return NULL;
+}
 
-	++fb_lib_idx;
-#endif
+static int read_full(int fd, void* buf, size_t size)
+{
+	char* c = buf;
+	while(size > 0)
+	{
+		ssize_t n = read(fd, c, size);
+		if(n < 0 && errno == EINTR)  continue;
+		if(n <= 0)  return 0;
+		c += n;
+		size -= n;
+	}
+	return 1;
+}
 
-#ifdef CHECK_LIBGCC
-	sys_ver = get_libgcc_version(fallback_libs[fb_lib_idx].name);
-	snprintf(local_path, PATH_MAX, "%s/%s", fallback_libs[fb_lib_idx].dir, fallback_libs[fb_lib_idx].name);
-	our_ver = get_libgcc_version(local_path);
-	dprintf("System libgcc version: %s ours: %s\n", get_gcc_version_name(libgcc_version_checks, sys_ver),
-	                                                get_gcc_version_name(libgcc_version_checks, our_ver));
-	if(our_ver > sys_ver)
+static int write_full(int fd, const void* buf, size_t size)
+{
+	const char* c = buf;
+	while(size > 0)
 	{
-		dprintf("Overwriting System libgcc\n");
-		fallback_libs[fb_lib_idx].use = 1;
+		ssize_t n = send(fd, c, size, MSG_NOSIGNAL);
+		if(n < 0 && errno == EINTR)  continue;
+		if(n <= 0)  return 0;
+		c += n;
+		size -= n;
 	}
+	return 1;
+}
 
-	++fb_lib_idx;
-#endif
+// sets cpus for an instance from WRAPPER_CPUS or WRAPPER_CORE_PER_INSTANCE in its environment
+// or, if pin_cores is set, to the next physical core. returns 0 if it shouldn't be pinned
+static int get_instance_cpus(char** env, int pin_cores, cpu_set_t* cpus)
+{
+	static int next_core = 0;
 
-#ifdef CHECK_LIBSDL2
-	My_SDL2_version sdl_sys_ver = get_libsdl2_version(fallback_libs[fb_lib_idx].name);
-	snprintf(local_path, PATH_MAX, "%s/%s", fallback_libs[fb_lib_idx].dir, fallback_libs[fb_lib_idx].name);
-	My_SDL2_version sdl_our_ver = get_libsdl2_version(local_path);
-	dprintf("System SDL2 version: %d.%d.%d ours: %d.%d.%d\n", (int)sdl_sys_ver.major, (int)sdl_sys_ver.minor, (int)sdl_sys_ver.patch,
-	                                                          (int)sdl_our_ver.major, (int)sdl_our_ver.minor, (int)sdl_our_ver.patch);
-	if( sdl_our_ver.major != 0 // otherwise it hasn't been found
-	   && (sdl_sys_ver.major != sdl_our_ver.major // changes to the major version break the API/ABI
-	       // minor versions don't break API/ABI (has been decided with 2.24.0 which followed 2.0.22)
-	       || sdl_sys_ver.minor < sdl_our_ver.minor
-	       || (sdl_sys_ver.minor == sdl_our_ver.minor && sdl_sys_ver.patch < sdl_our_ver.patch) ) )
+	CPU_ZERO(cpus);
+	const char* cpus_str = get_env_entry_value(env, "WRAPPER_CPUS");
+	const char* core_str = get_env_entry_value(env, "WRAPPER_CORE_PER_INSTANCE");
+	if(cpus_str != NULL)
 	{
-		dprintf("Overwriting System libSDL2\n");
-		fallback_libs[fb_lib_idx].use = 1;
+		if(parse_num_list(cpus_str, add_cpu_cb, cpus) && CPU_COUNT(cpus) > 0)  return 1;
+		eprintf("Launcher daemon: invalid WRAPPER_CPUS '%s'\n", cpus_str);
+		return 0;
 	}
+	if(core_str != NULL)
+	{
+		char* end;
+		long instance = strtol(core_str, &end, 10);
+		if(end != core_str && *end == '\0' && instance >= 0 && get_physical_core_cpus((int)instance, cpus))  return 1;
+		eprintf("Launcher daemon: invalid WRAPPER_CORE_PER_INSTANCE '%s'\n", core_str);
+		return 0;
+	}
+	return pin_cores && get_physical_core_cpus(next_core++, cpus);
+}
 
-	++fb_lib_idx;
-#endif
+// starts an instance with vfork() (the daemon's memory isn't copied, which makes a difference
+// if it's big) and execve(), returns its PID or -errno.
+// (not posix_spawn() because that can't set the CPU affinity)
+static pid_t spawn_instance(const char* path, char** argv, char** env, const char* cwd,
+                            const int* fds, const cpu_set_t* cpus)
+{
+	volatile int child_errno = 0; // shared with the vfork()ed child
 
-#ifdef CHECK_LIBCURL4
+	pid_t pid = vfork();
+	if(pid == 0)
 	{
-		// only use the bundled libcurl.so.4 if none is available on the system
-		// there should be no backwards compat problems as long as it's libcurl.so.4
-		// (and you linked against a libcurl without versioned symbols)
-		// This way a (hopefully) security patched version supplied
-		// by the user's Linux distribution is used, if available
-		void* curlHandle = dlopen(fallback_libs[fb_lib_idx].name, RTLD_LAZY);
-		if(curlHandle == NULL)
+		signal(SIGCHLD, SIG_DFL); // ignored (for auto-reaping) by the daemon, that would be inherited
+		signal(SIGTERM, SIG_DFL);
+		signal(SIGINT, SIG_DFL);
+		setsid(); // so instances aren't affected by what happens to the daemon's terminal
+
+		for(int i=0; i < 3; ++i)
 		{
-			dprintf("Couldn't find libcurl.so.4 on System, will use bundled version\n");
-			fallback_libs[fb_lib_idx].use = 1;
+			// the received fds are close-on-exec, which dup2() clears for the new fd
+			if(fds[i] == i ? fcntl(i, F_SETFD, 0) != 0 : dup2(fds[i], i) < 0)
+			{
+				child_errno = errno;
+				_exit(127);
+			}
 		}
-		else
+		if(chdir(cwd) != 0 || (cpus != NULL && sched_setaffinity(0, sizeof(*cpus), cpus) != 0))
 		{
-			dprintf("Will use System's libcurl.so.4\n");
-			dlclose(curlHandle);
+			child_errno = errno;
+			_exit(127);
 		}
+		execve(path, argv, env);
+		child_errno = errno;
+		_exit(127);
 	}
-
-	++fb_lib_idx;
-#endif
-
-	return 1;
+	if(pid < 0)  return -errno;
+	// the child either called execve() successfully or _exit()ed when vfork() returns here
+	if(child_errno != 0)
+	{
+		waitpid(pid, NULL, 0);
+		return -child_errno;
+	}
+	return pid;
 }
 
-static int set_ld_library_path(void)
+static void handle_launch_request(int conn, char* app_path, int pin_cores)
 {
-	char* old_val = getenv("LD_LIBRARY_PATH");
-	size_t len = 1; // 1 for terminating \0,
-	if(old_val != NULL)
+	struct launch_request req;
+	int fds[3] = { -1, -1, -1 };
+	char* data = NULL;
+	char** argv = NULL;
+	char** env = NULL;
+	int32_t result = -EINVAL;
+
+	struct ucred cred;
+	socklen_t cred_len = sizeof(cred);
+	if(getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) != 0 || cred.uid != getuid())
 	{
-		if(old_val[0] != '\0')  len += strlen(old_val) + 1; // +1 for ":"
-		else old_val = NULL;
+		eprintf("Launcher daemon: rejected connection from another user\n");
+		return;
 	}
 
-	// Note: using absolute paths (=> prepending wrapper_exe_dir)
+	// don't let a stuck client block the daemon
+	struct timeval timeout = { 5, 0 };
+	setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
 
-	// +1 for the '/' that will be added after wrapper_exe_dir before APP_EXECUTABLE
-	const int wrapper_dir_len = strlen(wrapper_exe_dir) + 1;
+	union
+	{
+		char buf[CMSG_SPACE(sizeof(fds))];
+		struct cmsghdr align;
+	} cmsg_buf;
+	struct iovec iov = { &req, sizeof(req) };
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cmsg_buf.buf;
+	msg.msg_controllen = sizeof(cmsg_buf.buf);
 
-	int num_used_overrides = 0;
-	for(int i=0; i < NUM_FALLBACK_LIBS; ++i)
+	ssize_t n = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+	struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+	if(cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS
+	   && cmsg->cmsg_len == CMSG_LEN(sizeof(fds)))
 	{
-		if(fallback_libs[i].use)
-		{
-			// + 1 for  separating ":" between entries
-			len += wrapper_dir_len + strlen(fallback_libs[i].dir) + 1;
-			++num_used_overrides;
-		}
+		memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+	}
+	if(n != sizeof(req) || fds[0] < 0 || req.magic != LAUNCH_REQUEST_MAGIC
+	   || req.data_len > LAUNCH_REQUEST_MAX_DATA || req.argc + req.envc + 1 > req.data_len)
+	{
+		eprintf("Launcher daemon: got an invalid request\n");
+		goto out;
 	}
 
-	if(num_used_overrides == 0)
+	data = malloc(req.data_len);
+	argv = malloc((req.argc + 11) * sizeof(char*)); // + 10 for build_ldso_argv()
+	int num_daemon_vars = sizeof(daemon_env_vars) / sizeof(daemon_env_vars[0]);
+	env = malloc((req.envc + num_daemon_vars + 1) * sizeof(char*));
+	if(data == NULL || argv == NULL || env == NULL)
 	{
-		dprintf("no need to modify LD_LIBRARY_PATH\n");
-		return 1; // nothing to do
+		result = -ENOMEM;
+		goto out;
+	}
+	if(!read_full(conn, data, req.data_len) || data[req.data_len - 1] != '\0')
+	{
+		eprintf("Launcher daemon: got an incomplete request\n");
+		goto out;
 	}
 
-	char* new_val = malloc(len);
-	if(new_val == NULL)  return 0; // malloc failed (unlikely)
+	// split data into the strings
+	const char* cwd = data;
+	char* str = data + strlen(data) + 1;
+	const char* data_end = data + req.data_len;
+	argv[0] = get_app_argv0();
+	int argc = 1;
+	for(uint32_t i=0; i < req.argc && str < data_end; ++i)
+	{
+		argv[argc++] = str;
+		str += strlen(str) + 1;
+	}
+	argv[argc] = NULL;
 
-	new_val[0] = '\0';
+	int num_env = 0;
+	for(int i=0; environ[i] != NULL; ++i)
+	{
+		if(is_env_var_in(environ[i], daemon_env_vars))  env[num_env++] = environ[i];
+	}
+	static const char* const client_only_vars[] = { "WRAPPER_CONNECT", NULL };
+	for(uint32_t i=0; i < req.envc && str < data_end; ++i)
+	{
+		if(!is_env_var_in(str, daemon_env_vars) && !is_env_var_in(str, client_only_vars))  env[num_env++] = str;
+		str += strlen(str) + 1;
+	}
+	env[num_env] = NULL;
+	if(str != data_end)
+	{
+		eprintf("Launcher daemon: got a malformed request\n");
+		goto out;
+	}
 
-	for(int i=0; i < NUM_FALLBACK_LIBS; ++i)
+	cpu_set_t cpus;
+	int pin = get_instance_cpus(env, pin_cores, &cpus);
+
+	const char* exec_path = app_path;
+	char** exec_argv = argv;
+#ifdef LAUNCH_VIA_LDSO
+	char** ldso_argv = build_ldso_argv(argc, argv, app_path);
+	if(ldso_argv != NULL)
 	{
-		if(fallback_libs[i].use)
-		{
-			// using strcat() here is safe because we checked the lengths above
-			// and set len accordingly
-			strcat(new_val, wrapper_exe_dir);
-			strcat(new_val, "/");
-			strcat(new_val, fallback_libs[i].dir);
-			strcat(new_val, ":");
-		}
+		exec_path = ldso_path;
+		exec_argv = ldso_argv;
 	}
+#endif
 
-	if(old_val != NULL)
+	int64_t trace_start = trace_now();
+	result = spawn_instance(exec_path, exec_argv, env, cwd, fds, pin ? &cpus : NULL);
+	if(result > 0)
+		dprintf("Launcher daemon: started instance %d in %s (took %lld usec)\n", (int)result, cwd, (long long)(trace_now() - trace_start));
+	else
+		eprintf("Launcher daemon: starting %s failed: errno %d (%s)\n", exec_path, -result, strerror(-result));
+
+#ifdef LAUNCH_VIA_LDSO
+	free(ldso_argv);
+#endif
+
+out:
+	write_full(conn, &result, sizeof(result));
+	for(int i=0; i < 3; ++i)
 	{
-		strcat(new_val, old_val);
+		if(fds[i] >= 0)  close(fds[i]);
 	}
-	else // remove the last added ":"
+	free(env);
+	free(argv);
+	free(data);
+}
+
+// sets up the listening socket at socket_path, returns the fd or -1
+static int listen_on_socket(const char* socket_path)
+{
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(strlen(socket_path) >= sizeof(addr.sun_path))
 	{
-		new_val[strlen(new_val) - 1] = '\0';
+		eprintf("Launcher daemon: socket path %s is too long\n", socket_path);
+		return -1;
 	}
+	strcpy(addr.sun_path, socket_path);
 
-	int ret = (setenv("LD_LIBRARY_PATH", new_val, 1) == 0);
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(fd < 0)  return -1;
 
-	if(ret) {
-		dprintf("Set LD_LIBRARY_PATH to '%s'\n", new_val);
-	} else {
+	mode_t old_umask = umask(077); // only for the daemon's user
+	int ret = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+	if(ret != 0 && errno == EADDRINUSE)
+	{
+		// if nothing is listening on it anymore, it's left over from a daemon that died
+		int test_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if(test_fd >= 0 && connect(test_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 && errno == ECONNREFUSED)
+		{
+			unlink(socket_path);
+			ret = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+		}
+		if(test_fd >= 0)  close(test_fd);
+	}
+	umask(old_umask);
+
+	if(ret != 0 || listen(fd, SOMAXCONN) != 0)
+	{
 		int e = errno;
-		eprintf("Failed to set LD_LIBRARY_PATH to '%s' : errnno %d (%s)\n", new_val, e, strerror(e));
+		eprintf("Launcher daemon: couldn't listen on %s: errno %d (%s)\n", socket_path, e, strerror(e));
+		close(fd);
+		return -1;
 	}
+	return fd;
+}
 
-	free(new_val);
-	return ret;
+// called instead of run_executable() with WRAPPER_DAEMON set, after everything is set up
+static int run_launcher_daemon(const char* socket_path)
+{
+	char app_path[PATH_MAX];
+	if(!get_app_exe_path(app_path))  return 1;
+
+	int listen_fd = listen_on_socket(socket_path);
+	if(listen_fd < 0)  return 1;
+
+	char* pin_var = getenv("WRAPPER_DAEMON_PIN_CORES");
+	int pin_cores = (pin_var != NULL && atoi(pin_var) != 0);
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = stop_daemon; // no SA_RESTART, so accept() is interrupted
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+	signal(SIGCHLD, SIG_IGN); // the instances are reaped automatically
+
+	trace_add("launcher_daemon", 'i', 0);
+	trace_write();
+	dprintf("Launcher daemon: listening on %s for instances of %s\n", socket_path, app_path);
+	fflush(stdout);
+
+	while(!daemon_stop)
+	{
+		int conn = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+		if(conn < 0)
+		{
+			if(errno != EINTR && errno != ECONNABORTED)
+			{
+				int e = errno;
+				eprintf("Launcher daemon: accept() failed: errno %d (%s)\n", e, strerror(e));
+				break;
+			}
+			continue;
+		}
+		handle_launch_request(conn, app_path, pin_cores);
+		close(conn);
+		fflush(stdout);
+	}
+
+	close(listen_fd);
+	unlink(socket_path);
+	dprintf("Launcher daemon: stopped\n");
+	return 0;
 }
 
-static void run_executable(char** argv)
+// with WRAPPER_CONNECT set, asks the launcher daemon to start an instance with our
+// arguments, working directory, environment and stdin/stdout/stderr
+static int run_launcher_client(const char* socket_path, int argc, char** argv)
 {
-#ifdef APP_NAME
-	if(APP_NAME[0] != '\0')
+	char cwd[PATH_MAX];
+	if(getcwd(cwd, sizeof(cwd)) == NULL)
 	{
-		argv[0] = APP_NAME; // override argv[0] so it contains your configured app name
+		eprintf("Couldn't get the current working directory!\n");
+		return 1;
 	}
-	else
-#endif
+
+	struct launch_request req;
+	req.magic = LAUNCH_REQUEST_MAGIC;
+	req.argc = argc - 1;
+	req.envc = 0;
+	size_t data_len = strlen(cwd) + 1;
+	for(int i=1; i < argc; ++i)  data_len += strlen(argv[i]) + 1;
+	for(int i=0; environ[i] != NULL; ++i)
 	{
-		argv[0] = APP_EXECUTABLE; // override argv[0] so it contains the name of the launched executable instead of this wrapper
+		data_len += strlen(environ[i]) + 1;
+		++req.envc;
 	}
+	if(data_len > LAUNCH_REQUEST_MAX_DATA)
+	{
+		eprintf("Arguments and environment are too big for the launcher daemon\n");
+		return 1;
+	}
+	req.data_len = data_len;
 
-	char full_exe_path[PATH_MAX];
-	int len = snprintf(full_exe_path, sizeof(full_exe_path), "%s/%s", wrapper_exe_dir, APP_EXECUTABLE);
+	char* data = malloc(data_len);
+	if(data == NULL)  return 1;
+	char* c = data;
+	c = stpcpy(c, cwd) + 1;
+	for(int i=1; i < argc; ++i)  c = stpcpy(c, argv[i]) + 1;
+	for(int i=0; environ[i] != NULL; ++i)  c = stpcpy(c, environ[i]) + 1;
 
-	if(len <= 0 || len >= sizeof(full_exe_path))
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
 	{
-		eprintf("ERROR: Couldn't create full path to executable, snprintf() returned %d\n", len);
+		int e = errno;
+		eprintf("Couldn't connect to the launcher daemon at %s: errno %d (%s)\n", socket_path, e, strerror(e));
+		free(data);
+		if(fd >= 0)  close(fd);
+		return 1;
 	}
-	else if(execv(full_exe_path, argv) < 0)
+
+	const int fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+	union
 	{
-		int e = errno;
-		eprintf("Executing %s failed: errno %d (%s)\n", APP_EXECUTABLE, e, strerror(e));
+		char buf[CMSG_SPACE(sizeof(fds))];
+		struct cmsghdr align;
+	} cmsg_buf;
+	memset(&cmsg_buf, 0, sizeof(cmsg_buf));
+	struct iovec iov = { &req, sizeof(req) };
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cmsg_buf.buf;
+	msg.msg_controllen = sizeof(cmsg_buf.buf);
+	struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	int32_t result = 0;
+	int ok = sendmsg(fd, &msg, MSG_NOSIGNAL) == sizeof(req) && write_full(fd, data, data_len)
+	         && read_full(fd, &result, sizeof(result));
+	close(fd);
+	free(data);
+
+	if(!ok)
+	{
+		eprintf("Launcher daemon at %s didn't answer\n", socket_path);
+		return 1;
+	}
+	if(result <= 0)
+	{
+		eprintf("Launcher daemon couldn't start %s: errno %d (%s)\n", APP_EXECUTABLE, -result, strerror(-result));
+		return 1;
 	}
-	// else, if execv() was successful, this function never returns
+	dprintf("Launcher daemon started %s with PID %d\n", APP_EXECUTABLE, (int)result);
+	return 0;
 }
+#endif // LAUNCHER_DAEMON
 
 int main(int argc, char** argv)
 {
+#ifdef SUPERVISE_APP
+	wrapper_start_time = trace_now();
+#endif
+#ifdef PRELOAD_ALLOCATOR
+	if(getenv("WRAPPER_ALLOCATOR_TEST") != NULL)
+	{
+		return allocator_self_test(); // started by allocator_trial_load()
+	}
+#endif
+
 	char* debugVar = getenv("WRAPPER_DEBUG");
 	if(debugVar != NULL && atoi(debugVar) != 0)
 	{
 		debugOutput = 1;
 	}
 
+	trace_init();
+#ifdef SUPERVISE_APP
+	supervisor_log_init();
+#endif
+
+#ifdef LAUNCHER_DAEMON
+	char* connect_socket = getenv("WRAPPER_CONNECT");
+	if(connect_socket != NULL && connect_socket[0] != '\0')
+	{
+		return run_launcher_client(connect_socket, argc, argv);
+	}
+#endif
+
+	int64_t trace_start = trace_now();
 	if(!set_wrapper_dir())
 	{
 		eprintf("Couldn't figure out the wrapper directory!\n");
 		return 1;
 	}
+	trace_arg_str(trace_add("set_wrapper_dir", 'X', trace_start), "dir", wrapper_exe_dir);
 
 #ifdef CHANGE_TO_WRAPPER_DIR
+	trace_start = trace_now();
 	if(!change_to_wrapper_dir())
 	{
 		eprintf("Couldn't change to wrapper directory!\n");
 		return 1;
 	}
+	trace_add("change_to_wrapper_dir", 'X', trace_start);
+#endif
+
+#ifdef BUNDLED_LIBS_MANIFEST
+	// (this is an environment variable instead of a commandline option because all
+	//  commandline arguments are passed to the app)
+	char* write_manifest = getenv("WRAPPER_WRITE_MANIFEST");
+	if(write_manifest != NULL && atoi(write_manifest) != 0)
+	{
+		return write_bundled_manifest() ? 0 : 1;
+	}
+#endif
+#ifdef COMPRESSED_LIBS
+	char* compress_libs = getenv("WRAPPER_COMPRESS_LIBS");
+	if(compress_libs != NULL && atoi(compress_libs) != 0)
+	{
+		return compress_bundled_libs() ? 0 : 1;
+	}
+#endif
+
+#ifdef SELECT_ISA_VARIANTS
+	trace_start = trace_now();
+	detect_isa_level();
+	select_isa_variants();
+	struct trace_event* isa_ev = trace_add("select_isa_variants", 'X', trace_start);
+	trace_arg_int(isa_ev, "level", isa_level);
+	trace_arg_str(isa_ev, "app_suffix", app_exe_suffix);
+#endif
+
+	int have_decisions = 0;
+#ifdef PASS_DECISIONS_TO_RELAUNCHES
+	trace_start = trace_now();
+	restore_original_ld_library_path();
+	have_decisions = read_relaunch_token();
+	trace_arg_int(trace_add("read_relaunch_token", 'X', trace_start), "hit", have_decisions);
+	char* orig_ld_path = getenv("LD_LIBRARY_PATH");
+	if(orig_ld_path != NULL)  orig_ld_path = strdup(orig_ld_path);
+#endif
+#ifdef USE_LAUNCH_CACHE
+	if(!have_decisions)
+	{
+		trace_start = trace_now();
+		have_decisions = read_launch_cache();
+		trace_arg_int(trace_add("read_launch_cache", 'X', trace_start), "hit", have_decisions);
+	}
+#endif
+	trace_start = trace_now();
+	if(!have_decisions && check_fallback_libs())
+	{
+		trace_add("check_fallback_libs", 'X', trace_start);
+		have_decisions = 1;
+#ifdef USE_LAUNCH_CACHE
+		trace_start = trace_now();
+		write_launch_cache();
+		trace_add("write_launch_cache", 'X', trace_start);
+#endif
+	}
+
+#ifdef COMPRESSED_LIBS
+	if(have_decisions)
+	{
+		trace_start = trace_now();
+		extract_used_compressed_libs();
+		trace_add("extract_used_compressed_libs", 'X', trace_start);
+	}
+#endif
+
+#ifdef LAUNCH_VIA_LDSO
+	ldso_launch = have_decisions && prepare_ldso_launch();
+#endif
+
+	trace_start = trace_now();
+	int ld_path_ok = have_decisions && set_ld_library_path();
+#if defined(PRELOAD_ALLOCATOR) || defined(HUGETEXT_SHIM)
+	ld_path_ok = ld_path_ok && set_ld_preload();
+#endif
+#ifdef LDPROFILE_MODULE
+	if(ld_path_ok)  set_ldprofile();
+#endif
+	trace_add("set_ld_library_path", 'X', trace_start);
+
+#ifdef PASS_DECISIONS_TO_RELAUNCHES
+	if(ld_path_ok)  write_relaunch_token(orig_ld_path);
+#endif
+
+#ifdef PREFETCH_LIBS
+	if(ld_path_ok)
+	{
+		trace_start = trace_now();
+		start_prefetch();
+		trace_add("start_prefetch", 'X', trace_start);
+	}
+#endif
+
+#ifdef LAUNCH_POLICY_FILE
+	if(ld_path_ok)
+	{
+		trace_start = trace_now();
+		apply_launch_policy();
+		trace_add("apply_launch_policy", 'X', trace_start);
+	}
+#endif
+
+// after the policy, so the CPU affinity from it is taken into account (by both)
+#ifdef SET_MALLOC_TUNABLES
+	if(ld_path_ok)
+	{
+		trace_start = trace_now();
+		set_malloc_tunables();
+		trace_add("set_malloc_tunables", 'X', trace_start);
+	}
+#endif
+#ifdef SET_CPU_BUDGET_VARS
+	if(ld_path_ok)
+	{
+		trace_start = trace_now();
+		set_cpu_budget_vars();
+		trace_add("set_cpu_budget_vars", 'X', trace_start);
+	}
 #endif
 
-	if(check_fallback_libs() && set_ld_library_path())
+	if(ld_path_ok)
 	{
-		run_executable(argv); // if it succeeds, it doesn't return.
+#ifdef LAUNCHER_DAEMON
+		char* daemon_socket = getenv("WRAPPER_DAEMON");
+		if(daemon_socket != NULL && daemon_socket[0] != '\0')
+		{
+			return run_launcher_daemon(daemon_socket);
+		}
+#endif
+		run_executable(argc, argv); // if it succeeds, it doesn't return.
 	}
 	return 1;
 }
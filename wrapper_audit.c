@@ -0,0 +1,92 @@
+/*
+ * Tiny LD_AUDIT module for wrapper.c (see AUDIT_MODULE in there)
+ *
+ * Build it with the same (old) GCC as the wrapper:
+ *   "gcc -std=gnu99 -shared -fPIC -O2 -o wrapper_audit.so wrapper_audit.c"
+ * and put wrapper_audit.so next to the wrapper.
+ *
+ * Instead of prepending the directories of the bundled libs to LD_LIBRARY_PATH
+ * (so the dynamic linker tries them first for *every* lib your app loads),
+ * the wrapper sets LD_AUDIT to this module and WRAPPER_AUDIT_MAP to the sonames
+ * it decided to override, like
+ *   "libstdc++.so.6=/path/to/libs/stdcpp/libstdc++.so.6:libSDL2-2.0.so.0=/path/to/..."
+ * and la_objsearch() below redirects exactly those to the bundled files.
+ * All other lookups are left alone.
+ *
+ * (C) 2017-2023 Daniel Gibson
+ *
+ * LICENSE
+ *   This software is dual-licensed to the public domain and under the following
+ *   license: you are granted a perpetual, irrevocable license to copy, modify,
+ *   publish, and distribute this file as you see fit.
+ *   No warranty implied; use at your own risk.
+ */
+
+#define _GNU_SOURCE
+#include <link.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the wrapper checks only a handful of libs, so this is plenty
+#define MAX_REDIRECTS 16
+
+static struct {
+	const char* soname;
+	const char* path;
+} redirects[MAX_REDIRECTS];
+
+static int num_redirects = 0;
+
+static char map_buf[8192];
+
+static void parse_map(void)
+{
+	const char* map = getenv("WRAPPER_AUDIT_MAP");
+	if(map == NULL || strlen(map) >= sizeof(map_buf))  return;
+
+	strcpy(map_buf, map);
+
+	char* entry = map_buf;
+	while(entry != NULL && *entry != '\0' && num_redirects < MAX_REDIRECTS)
+	{
+		char* next = strchr(entry, ':');
+		if(next != NULL)  *next++ = '\0';
+
+		char* path = strchr(entry, '=');
+		if(path != NULL && path != entry && path[1] == '/')
+		{
+			*path++ = '\0';
+			redirects[num_redirects].soname = entry;
+			redirects[num_redirects].path = path;
+			++num_redirects;
+		}
+		entry = next;
+	}
+}
+
+unsigned int la_version(unsigned int version)
+{
+	parse_map();
+	// we only need la_objsearch() which exists since version 1, so whatever
+	// the dynamic linker supports (up to what we were built with) is fine
+	return (version < LAV_CURRENT) ? version : LAV_CURRENT;
+}
+
+char* la_objsearch(const char* name, uintptr_t* cookie, unsigned int flag)
+{
+	(void)cookie;
+
+	// LA_SER_ORIG is the name from DT_NEEDED (or dlopen()) before any search,
+	// returning an absolute path from there makes the dynamic linker load that file
+	if(flag == LA_SER_ORIG && strchr(name, '/') == NULL)
+	{
+		for(int i=0; i < num_redirects; ++i)
+		{
+			if(strcmp(name, redirects[i].soname) == 0)
+			{
+				return (char*)redirects[i].path;
+			}
+		}
+	}
+	return (char*)name;
+}
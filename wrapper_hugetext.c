@@ -0,0 +1,237 @@
+/*
+ * Tiny LD_PRELOAD shim for wrapper.c (see HUGETEXT_SHIM in there) that moves the code of
+ * your app's executable (and optionally of the used bundled libs) onto huge pages
+ *
+ * Build it with the same (old) GCC as the wrapper:
+ *   "gcc -std=gnu99 -shared -fPIC -O2 -o wrapper_hugetext.so wrapper_hugetext.c"
+ * and put wrapper_hugetext.so next to the wrapper.
+ *
+ * Big executables spend a lot of time on iTLB misses, because their code is mapped
+ * from the file with 4KiB pages. When the shim is loaded (before main() of your app),
+ * it copies the 2MiB-aligned parts of each executable segment to anonymous memory
+ * backed by huge pages (from hugetlbfs if some are reserved in /proc/sys/vm/nr_hugepages,
+ * otherwise transparent hugepages, unless they're disabled) and moves that over the
+ * original mapping with mremap(), which replaces it atomically.
+ * If that's not possible, nothing is changed.
+ *
+ * NOTE: the remapped code isn't backed by the file anymore, so it uses memory per process
+ *       (instead of being shared with other instances) and profilers may not be able to
+ *       find the symbols for it (perf can with --buildid-all or a perf map).
+ *
+ * The wrapper passes the paths of the bundled libs to remap in WRAPPER_HUGETEXT_LIBS
+ * (":"-separated) if WRAPPER_HUGETEXT=2, and with WRAPPER_DEBUG=1 the remapped sizes are printed.
+ * It also passes the path it preloaded the shim with in WRAPPER_HUGETEXT_SHIM, so the shim can
+ * remove itself from LD_PRELOAD (dladdr() would need libdl before glibc 2.34).
+ *
+ * (C) 2017-2023 Daniel Gibson
+ *
+ * LICENSE
+ *   This software is dual-licensed to the public domain and under the following
+ *   license: you are granted a perpetual, irrevocable license to copy, modify,
+ *   publish, and distribute this file as you see fit.
+ *   No warranty implied; use at your own risk.
+ */
+
+#define _GNU_SOURCE
+#include <link.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// the size of a huge page that a page table entry one level up can map (PMD), 2MiB on x86-64
+#define HUGE_PAGE_SIZE ((uintptr_t)2 * 1024 * 1024)
+
+static int debugOutput = 0;
+
+#define dprintf(...) do { if(debugOutput){ printf(__VA_ARGS__); } } while(0)
+
+static int thp_enabled = 0;
+
+static int is_thp_enabled(void)
+{
+	FILE* f = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "re");
+	if(f == NULL)  return 0;
+	char buf[128];
+	// the active mode is in brackets, like "always [madvise] never"
+	int ret = fgets(buf, sizeof(buf), f) != NULL && strstr(buf, "[never]") == NULL;
+	fclose(f);
+	return ret;
+}
+
+// maps size bytes of anonymous memory backed by huge pages (hugetlbfs if use_hugetlb is set,
+// otherwise 2MiB aligned and madvise()d for transparent hugepages), or returns MAP_FAILED
+static char* map_huge(size_t size, int use_hugetlb)
+{
+	if(use_hugetlb)
+	{
+		return mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	}
+
+	// transparent hugepages can only be used for 2MiB aligned ranges, and mremap()
+	// only keeps them if both the old and the new address are aligned
+	size_t map_size = size + HUGE_PAGE_SIZE;
+	char* raw = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(raw == MAP_FAILED)  return MAP_FAILED;
+
+	char* aligned = (char*)(((uintptr_t)raw + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+	if(aligned > raw)  munmap(raw, aligned - raw);
+	if(raw + map_size > aligned + size)  munmap(aligned + size, (raw + map_size) - (aligned + size));
+
+	if(madvise(aligned, size, MADV_HUGEPAGE) != 0)
+	{
+		munmap(aligned, size);
+		return MAP_FAILED;
+	}
+	return aligned;
+}
+
+// returns the AnonHugePages (in KiB) of the mapping at addr from /proc/self/smaps, or -1
+static long get_anon_huge_kib(uintptr_t addr)
+{
+	FILE* f = fopen("/proc/self/smaps", "re");
+	if(f == NULL)  return -1;
+	char line[512];
+	int in_mapping = 0;
+	long ret = -1;
+	while(fgets(line, sizeof(line), f) != NULL)
+	{
+		unsigned long start, end;
+		if(sscanf(line, "%lx-%lx ", &start, &end) == 2)
+		{
+			in_mapping = (start <= addr && addr < end);
+		}
+		else if(in_mapping && sscanf(line, "AnonHugePages: %ld kB", &ret) == 1)
+		{
+			break;
+		}
+	}
+	fclose(f);
+	return ret;
+}
+
+// moves the 2MiB aligned part of the code segment at [seg_start, seg_start + seg_size) to
+// huge pages, returns the number of remapped bytes
+static size_t remap_segment(uintptr_t seg_start, size_t seg_size, const char* name)
+{
+	uintptr_t start = (seg_start + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+	uintptr_t end = (seg_start + seg_size) & ~(HUGE_PAGE_SIZE - 1);
+	if(end <= start)  return 0; // less than 2MiB (aligned) of code
+	size_t size = end - start;
+
+	// hugetlbfs first (only works if pages are reserved, and older kernels can't mremap() them)
+	for(int use_hugetlb = 1; use_hugetlb >= 0; --use_hugetlb)
+	{
+		if(!use_hugetlb && !thp_enabled)  break;
+
+		char* copy = map_huge(size, use_hugetlb);
+		if(copy == MAP_FAILED)  continue;
+
+		memcpy(copy, (const void*)start, size);
+		if(mprotect(copy, size, PROT_READ | PROT_EXEC) != 0
+		   || mremap(copy, size, size, MREMAP_MAYMOVE | MREMAP_FIXED, (void*)start) == MAP_FAILED)
+		{
+			munmap(copy, size);
+			continue;
+		}
+
+		if(use_hugetlb)
+		{
+			dprintf("hugetext: remapped %zu MiB of code of %s to hugetlbfs pages\n", size >> 20, name);
+		}
+		else if(debugOutput)
+		{
+			// transparent hugepages are best effort (depending on fragmentation and the defrag setting)
+			long huge_kib = get_anon_huge_kib(start);
+			printf("hugetext: remapped %zu MiB of code of %s for transparent hugepages, %ld MiB are huge\n",
+			       size >> 20, name, (huge_kib > 0) ? huge_kib >> 10 : 0);
+		}
+		return size;
+	}
+	dprintf("hugetext: couldn't remap the code of %s to huge pages\n", name);
+	return 0;
+}
+
+static int is_listed(const char* name, const char* list)
+{
+	size_t len = strlen(name);
+	while(list != NULL && *list != '\0')
+	{
+		const char* colon = strchr(list, ':');
+		size_t entry_len = (colon != NULL) ? (size_t)(colon - list) : strlen(list);
+		if(entry_len == len && memcmp(list, name, len) == 0)  return 1;
+		list = (colon != NULL) ? colon + 1 : NULL;
+	}
+	return 0;
+}
+
+static int remap_object_cb(struct dl_phdr_info* info, size_t size, void* user)
+{
+	(void)size;
+	int* index = user;
+	// the first object is the executable (its name is "" unless it was started through ld.so)
+	int is_exe = ((*index)++ == 0);
+	const char* name = (info->dlpi_name != NULL && info->dlpi_name[0] != '\0') ? info->dlpi_name : "the executable";
+	if(!is_exe && !is_listed(info->dlpi_name, getenv("WRAPPER_HUGETEXT_LIBS")))  return 0;
+
+	for(int i=0; i < info->dlpi_phnum; ++i)
+	{
+		const ElfW(Phdr)* ph = &info->dlpi_phdr[i];
+		if(ph->p_type == PT_LOAD && (ph->p_flags & PF_X) && !(ph->p_flags & PF_W))
+		{
+			remap_segment(info->dlpi_addr + ph->p_vaddr, ph->p_memsz, name);
+		}
+	}
+	return 0;
+}
+
+// removes this shim (its path is in WRAPPER_HUGETEXT_SHIM) from LD_PRELOAD,
+// so processes started by the app don't get it
+static void remove_from_ld_preload(void)
+{
+	const char* self = getenv("WRAPPER_HUGETEXT_SHIM");
+	const char* old_val = getenv("LD_PRELOAD");
+	if(old_val == NULL || self == NULL || self[0] == '\0')  return;
+
+	char* new_val = malloc(strlen(old_val) + 1);
+	if(new_val == NULL)  return;
+	size_t new_len = 0;
+	size_t self_len = strlen(self);
+	for(const char* entry = old_val; entry != NULL; )
+	{
+		// LD_PRELOAD is separated by spaces or colons
+		size_t len = strcspn(entry, " :");
+		if(len > 0 && !(len == self_len && memcmp(entry, self, len) == 0))
+		{
+			if(new_len > 0)  new_val[new_len++] = ':';
+			memcpy(new_val + new_len, entry, len);
+			new_len += len;
+		}
+		entry = (entry[len] != '\0') ? entry + len + 1 : NULL;
+	}
+	new_val[new_len] = '\0';
+
+	if(new_len > 0)
+		setenv("LD_PRELOAD", new_val, 1);
+	else
+		unsetenv("LD_PRELOAD");
+	free(new_val);
+}
+
+__attribute__((constructor))
+static void hugetext_init(void)
+{
+	const char* debug_var = getenv("WRAPPER_DEBUG");
+	debugOutput = (debug_var != NULL && atoi(debug_var) != 0);
+
+	remove_from_ld_preload();
+	thp_enabled = is_thp_enabled();
+
+	int index = 0;
+	dl_iterate_phdr(remap_object_cb, &index);
+
+	unsetenv("WRAPPER_HUGETEXT_LIBS");
+	unsetenv("WRAPPER_HUGETEXT_SHIM");
+	fflush(stdout);
+}
@@ -0,0 +1,271 @@
+/*
+ * Tiny LD_AUDIT module for wrapper.c (see LDPROFILE_MODULE in there) that profiles
+ * how long the dynamic linker takes to load your app's libs
+ *
+ * Build it with the same (old) GCC as the wrapper:
+ *   "gcc -std=gnu99 -shared -fPIC -O2 -o wrapper_ldprofile.so wrapper_ldprofile.c"
+ * and put wrapper_ldprofile.so next to the wrapper.
+ *
+ * If WRAPPER_LDPROFILE is set (to 1 for stderr, or a file to append to), the wrapper
+ * adds this module to LD_AUDIT. It timestamps every lib the dynamic linker looks for
+ * (la_objsearch()) and maps (la_objopen()), counts the paths it tried for each and the
+ * symbols bound from and to each lib (la_symbind*()), and right before the constructors
+ * of your app run (la_preinit()) prints a report sorted by load time, like
+ *
+ *   ldprofile: 9 objects mapped after 1.92 ms, relocated after 2.60 ms
+ *     load ms  tried  binds from  binds to  kind     path
+ *       0.981      1           0       412  bundled  /path/to/libs/stdcpp/libstdc++.so.6
+ *   ...
+ *
+ * "bundled" are the libs the wrapper chose from WRAPPER_LDPROFILE_BUNDLED, "app" are the
+ * other files in the app's directory (WRAPPER_LDPROFILE_APP_DIR), the rest is "system".
+ * NOTE: with lazy binding (the default), most functions are only bound when they're first
+ *       called, so to count all bindings, also set LD_BIND_NOW=1 (which makes loading slower).
+ * NOTE: the dynamic linker relocates the libs after all of them are mapped and the audit
+ *       interface has no callback for that, so the relocation time is only reported for all
+ *       libs together ("relocated after"), the load times per lib don't include it.
+ *       For the cost of the relocations, LD_DEBUG=statistics is the best bet.
+ *
+ * The module removes WRAPPER_LDPROFILE from the environment and itself from LD_AUDIT (the
+ * wrapper passes its path in WRAPPER_LDPROFILE_MODULE), so processes started by your app
+ * don't profile themselves and don't load it.
+ *
+ * (C) 2017-2023 Daniel Gibson
+ *
+ * LICENSE
+ *   This software is dual-licensed to the public domain and under the following
+ *   license: you are granted a perpetual, irrevocable license to copy, modify,
+ *   publish, and distribute this file as you see fit.
+ *   No warranty implied; use at your own risk.
+ */
+
+#define _GNU_SOURCE
+#include <link.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// more than any sane app loads at startup, later ones aren't counted
+#define MAX_OBJECTS 512
+
+static struct object {
+	char path[256];
+	double load_ms; // from the first search for it (or the previous lib) to la_objopen()
+	int tried;      // paths the dynamic linker tried for it
+	unsigned bind_from;
+	unsigned bind_to;
+	const char* kind;
+} objects[MAX_OBJECTS];
+
+static int num_objects = 0;
+
+static double start_ms;
+static double last_ms;       // when the last lib was mapped
+static double search_ms = 0; // when the lib that's currently searched was first searched, or 0
+static int search_tries = 0;
+static double consistent_ms = 0;
+
+static char output[4096];
+static char bundled[8192];
+static char app_dir[4096];
+
+static double now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// copies the variable to dst (if it fits) and removes it from the environment,
+// which is shared with your app
+static void take_env(const char* name, char* dst, size_t dst_size)
+{
+	const char* val = getenv(name);
+	if(val != NULL && strlen(val) < dst_size)  strcpy(dst, val);
+	unsetenv(name);
+}
+
+// removes this module (its path is in WRAPPER_LDPROFILE_MODULE) from LD_AUDIT,
+// changing the environment in place
+static void remove_from_ld_audit(void)
+{
+	const char* self = getenv("WRAPPER_LDPROFILE_MODULE");
+	const char* old_val = getenv("LD_AUDIT");
+	if(old_val != NULL && self != NULL && self[0] != '\0')
+	{
+		char* new_val = malloc(strlen(old_val) + 1);
+		if(new_val == NULL)  return;
+		size_t new_len = 0;
+		size_t self_len = strlen(self);
+		for(const char* entry = old_val; entry != NULL; )
+		{
+			size_t len = strcspn(entry, ":");
+			if(len > 0 && !(len == self_len && memcmp(entry, self, len) == 0))
+			{
+				if(new_len > 0)  new_val[new_len++] = ':';
+				memcpy(new_val + new_len, entry, len);
+				new_len += len;
+			}
+			entry = (entry[len] != '\0') ? entry + len + 1 : NULL;
+		}
+		new_val[new_len] = '\0';
+
+		if(new_len > 0)
+			setenv("LD_AUDIT", new_val, 1);
+		else
+			unsetenv("LD_AUDIT");
+		free(new_val);
+	}
+	unsetenv("WRAPPER_LDPROFILE_MODULE");
+}
+
+static int is_listed(const char* path, const char* list)
+{
+	size_t len = strlen(path);
+	while(list != NULL && *list != '\0')
+	{
+		const char* colon = strchr(list, ':');
+		size_t entry_len = (colon != NULL) ? (size_t)(colon - list) : strlen(list);
+		if(entry_len == len && memcmp(list, path, len) == 0)  return 1;
+		list = (colon != NULL) ? colon + 1 : NULL;
+	}
+	return 0;
+}
+
+static const char* get_kind(const char* path, int is_exe)
+{
+	size_t app_dir_len = strlen(app_dir);
+	if(is_listed(path, bundled))  return "bundled";
+	if(is_exe || (app_dir_len > 0 && strncmp(path, app_dir, app_dir_len) == 0 && path[app_dir_len] == '/'))  return "app";
+	return "system";
+}
+
+static int cmp_load_ms(const void* a, const void* b)
+{
+	double la = (*(const struct object* const*)a)->load_ms;
+	double lb = (*(const struct object* const*)b)->load_ms;
+	return (la < lb) - (la > lb);
+}
+
+static void write_report(void)
+{
+	double end_ms = now_ms();
+	FILE* f = stderr;
+	if(strcmp(output, "1") != 0)
+	{
+		f = fopen(output, "ae");
+		if(f == NULL)  f = stderr;
+	}
+
+	// (the cookies are indices into objects, so that must stay as it is)
+	static const struct object* sorted[MAX_OBJECTS];
+	for(int i=0; i < num_objects; ++i)  sorted[i] = &objects[i];
+	qsort(sorted, num_objects, sizeof(sorted[0]), cmp_load_ms);
+
+	fprintf(f, "ldprofile: %d objects mapped after %.2f ms, relocated after %.2f ms\n",
+	        num_objects, ((consistent_ms > 0) ? consistent_ms : last_ms) - start_ms, end_ms - start_ms);
+	fprintf(f, "  load ms  tried  binds from  binds to  kind     path\n");
+	for(int i=0; i < num_objects; ++i)
+	{
+		const struct object* o = sorted[i];
+		fprintf(f, "%9.3f  %5d  %10u  %8u  %-7s  %s\n", o->load_ms, o->tried, o->bind_from, o->bind_to, o->kind, o->path);
+	}
+
+	if(f != stderr)  fclose(f);
+	else  fflush(f);
+}
+
+unsigned int la_version(unsigned int version)
+{
+	// (the dynamic linker already read LD_AUDIT, this is only for processes started by the app)
+	remove_from_ld_audit();
+
+	const char* var = getenv("WRAPPER_LDPROFILE");
+	// returning 0 makes the dynamic linker ignore this module
+	if(var == NULL || var[0] == '\0' || strcmp(var, "0") == 0)  return 0;
+
+	take_env("WRAPPER_LDPROFILE", output, sizeof(output));
+	take_env("WRAPPER_LDPROFILE_BUNDLED", bundled, sizeof(bundled));
+	take_env("WRAPPER_LDPROFILE_APP_DIR", app_dir, sizeof(app_dir));
+
+	start_ms = last_ms = now_ms();
+	return (version < LAV_CURRENT) ? version : LAV_CURRENT;
+}
+
+char* la_objsearch(const char* name, uintptr_t* cookie, unsigned int flag)
+{
+	(void)cookie;
+	if(flag == LA_SER_ORIG)
+	{
+		if(search_ms == 0)  search_ms = now_ms();
+	}
+	else
+	{
+		++search_tries; // one call for each path the dynamic linker tries
+	}
+	return (char*)name;
+}
+
+unsigned int la_objopen(struct link_map* map, Lmid_t lmid, uintptr_t* cookie)
+{
+	double t = now_ms();
+	if(lmid != LM_ID_BASE || num_objects == MAX_OBJECTS)
+	{
+		*cookie = (uintptr_t)-1;
+		return 0;
+	}
+
+	struct object* o = &objects[num_objects];
+	// the executable is the first object and has no name (unless launched through ld.so)
+	int is_exe = (num_objects == 0);
+	const char* path = (map->l_name != NULL && map->l_name[0] != '\0') ? map->l_name : "(executable)";
+	snprintf(o->path, sizeof(o->path), "%s", path);
+	o->load_ms = t - ((search_ms > 0) ? search_ms : last_ms);
+	o->tried = search_tries;
+	o->kind = get_kind(path, is_exe);
+
+	*cookie = num_objects++;
+	last_ms = t;
+	search_ms = 0;
+	search_tries = 0;
+	return LA_FLG_BINDTO | LA_FLG_BINDFROM;
+}
+
+void la_activity(uintptr_t* cookie, unsigned int flag)
+{
+	(void)cookie;
+	// the first time all libs needed at startup are mapped
+	if(flag == LA_ACT_CONSISTENT && consistent_ms == 0)  consistent_ms = now_ms();
+}
+
+static void count_binding(uintptr_t refcook, uintptr_t defcook)
+{
+	if(refcook < (uintptr_t)num_objects)  ++objects[refcook].bind_from;
+	if(defcook < (uintptr_t)num_objects)  ++objects[defcook].bind_to;
+}
+
+#if __ELF_NATIVE_CLASS == 64
+uintptr_t la_symbind64(Elf64_Sym* sym, unsigned int ndx, uintptr_t* refcook, uintptr_t* defcook,
+                       unsigned int* flags, const char* symname)
+{
+	(void)ndx; (void)flags; (void)symname;
+	count_binding(*refcook, *defcook);
+	return sym->st_value;
+}
+#else
+uintptr_t la_symbind32(Elf32_Sym* sym, unsigned int ndx, uintptr_t* refcook, uintptr_t* defcook,
+                       unsigned int* flags, const char* symname)
+{
+	(void)ndx; (void)flags; (void)symname;
+	count_binding(*refcook, *defcook);
+	return sym->st_value;
+}
+#endif
+
+// called after all libs were relocated, right before the constructors run
+void la_preinit(uintptr_t* cookie)
+{
+	(void)cookie;
+	write_report();
+}